@@ -1,5 +1,6 @@
 #include <inc/x86.h>
 #include <inc/elf.h>
+#include <inc/memlayout.h>
 
 /**********************************************************************
  * This a dirt simple boot loader, whose sole job is to boot
@@ -27,18 +28,25 @@
  *    and a stack so C code then run, then calls bootmain()
  *
  *  * bootmain() in this file takes over, reads in the kernel and jumps to it.
+ *
+ *  * bootmain() records the TSC when it starts and when it jumps to the
+ *    kernel at BOOTTSC_PADDR, for the kernel's boot time breakdown.
  **********************************************************************/
 
 #define SECTSIZE	512
+#define MAXSECTS	128	// Sectors per read command (at most 256)
 #define ELFHDR		((struct Elf *) 0x10000) // scratch space
 
-void readsect(void*, uint32_t);
+void readsect(void*, uint32_t, uint32_t);
 void readseg(uint32_t, uint32_t, uint32_t);
 
 void
 bootmain(void)
 {
 	struct Proghdr *ph, *eph;
+	uint64_t *tsc = (uint64_t *) BOOTTSC_PADDR;
+
+	tsc[0] = read_tsc();
 
 	// read 1st page off disk
 	readseg((uint32_t) ELFHDR, SECTSIZE*8, 0);
@@ -57,6 +65,7 @@ bootmain(void)
 
 	// call the entry point from the ELF header
 	// note: does not return!
+	tsc[1] = read_tsc();
 	((void (*)(void)) (ELFHDR->e_entry))();
 
 bad:
@@ -81,17 +90,21 @@ readseg(uint32_t pa, uint32_t count, uint32_t offset)
 	// translate from bytes to sectors, and kernel starts at sector 1
 	offset = (offset / SECTSIZE) + 1;
 
-	// If this is too slow, we could read lots of sectors at a time.
-	// We'd write more to memory than asked, but it doesn't matter --
-	// we load in increasing order.
+	// Read up to MAXSECTS sectors with each command.  We may write
+	// more to memory than asked, but it doesn't matter -- we load in
+	// increasing order.
 	while (pa < end_pa) {
+		uint32_t n = (end_pa - pa + SECTSIZE - 1) / SECTSIZE;
+
+		if (n > MAXSECTS)
+			n = MAXSECTS;
 		// Since we haven't enabled paging yet and we're using
 		// an identity segment mapping (see boot.S), we can
 		// use physical addresses directly.  This won't be the
 		// case once JOS enables the MMU.
-		readsect((uint8_t*) pa, offset);
-		pa += SECTSIZE;
-		offset++;
+		readsect((uint8_t*) pa, offset, n);
+		pa += n * SECTSIZE;
+		offset += n;
 	}
 }
 
@@ -103,23 +116,25 @@ waitdisk(void)
 		/* do nothing */;
 }
 
+// Read 'n' sectors starting at sector 'offset' into 'dst' with a single
+// command.
 void
-readsect(void *dst, uint32_t offset)
+readsect(void *dst, uint32_t offset, uint32_t n)
 {
 	// wait for disk to be ready
 	waitdisk();
 
-	outb(0x1F2, 1);		// count = 1
+	outb(0x1F2, n);		// count = n (0 means 256)
 	outb(0x1F3, offset);
 	outb(0x1F4, offset >> 8);
 	outb(0x1F5, offset >> 16);
 	outb(0x1F6, (offset >> 24) | 0xE0);
 	outb(0x1F7, 0x20);	// cmd 0x20 - read sectors
 
-	// wait for disk to be ready
-	waitdisk();
-
-	// read a sector
-	insl(0x1F0, dst, SECTSIZE/4);
+	for (; n > 0; n--, dst += SECTSIZE) {
+		// wait for the disk to have the next sector ready
+		waitdisk();
+		insl(0x1F0, dst, SECTSIZE/4);
+	}
 }
 
@@ -1,6 +1,67 @@
 
 #include "fs.h"
 
+// The block cache holds at most bc_stat.bs_limit blocks besides the
+// pinned superblock and bitmap.  bc_slots[] lists the evictable blocks
+// that are cached, and a CLOCK hand sweeps it for a victim when a new
+// block needs room: blocks whose PTE_A bit is set get a second chance
+// and have the bit cleared, the first one found clear is evicted.
+//
+// Clean blocks are mapped read-only, so the first write to one faults
+// and bc_pgfault puts it in the dirty set before making it writable.
+// bc_dirty_map has a bit for each dirty block and bc_dirty[] lists
+// them, so that write-back touches only blocks that are dirty.
+// Cleaning a block clears its bit but leaves it on the list until the
+// list is next written back or compacted.
+//
+// Disk transfers run in the background where the kernel can do DMA
+// (see ide_start), so the server goes on with requests meanwhile.
+// Write-back maps the blocks read-only and starts their writes without
+// waiting for them.  A block stays in the dirty set until its write is
+// done, and is only cleaned then; a write to it meanwhile faults and
+// waits for the disk write first, so that what reaches the disk is
+// never torn by a later change.  Read-ahead lands in staging pages above the
+// cache, out of sight of the rest of the server, and bc_install moves
+// the blocks into the cache once they are read: when the server is
+// told a transfer finished, or when one of the blocks is touched.
+// A transfer never finishes before an earlier one of the same blocks,
+// so a read never overtakes the write of the same block.  The transfers
+// of one write-back or read-ahead are started as a batch, and the disk
+// is told about them at once.
+#define BC_MINLIMIT	16	// Enough for any one file system operation
+#define BC_MAXLIMIT	16384	// 64MB of cache
+#define BC_LIMIT	2048	// Default
+#define BC_MAXRUN	(256 / BLKSECTS)	// Blocks per IDE command
+// Most superblock and bitmap blocks a disk can have
+#define BC_MAXPINNED	(2 + DISKSIZE / BLKSIZE / BLKBITSIZE)
+#define BC_MAXDIRTY	(BC_MAXPINNED + BC_MAXLIMIT)
+#define BC_NWRITES	16	// Writes in flight at once
+#define BC_NPENDING	8	// Read-ahead runs in flight at once
+#define BC_STAGE	(DISKMAP + DISKSIZE)	// Where read-ahead lands
+
+static uint32_t bc_slots[BC_MAXLIMIT];
+static uint32_t bc_nslots;
+static uint32_t bc_hand;
+
+struct BcStat bc_stat = { .bs_limit = BC_LIMIT };
+
+static uint32_t bc_dirty_map[DISKSIZE / BLKSIZE / 32];
+static uint32_t bc_dirty[BC_MAXDIRTY];
+static uint32_t bc_ndirty;		// Entries in bc_dirty[], some stale
+
+// Writes in flight, oldest first
+static struct IdeDma bc_writes[BC_NWRITES];
+static uint32_t bc_wr_head, bc_wr_tail;
+
+// Read-ahead runs in flight, oldest first.  Entry i reads into the
+// staging pages at BC_STAGE + i * BC_MAXRUN * BLKSIZE.
+static struct BcPending {
+	struct IdeDma bp_req;
+	uint32_t bp_blockno;
+	uint32_t bp_n;			// Blocks, 0 once installed
+} bc_pending[BC_NPENDING];
+static uint32_t bc_rd_head, bc_rd_tail;
+
 // Return the virtual address of this disk block.
 void*
 diskaddr(uint32_t blockno)
@@ -24,6 +85,247 @@ va_is_dirty(void *va)
 	return (uvpt[PGNUM(va)] & PTE_D) != 0;
 }
 
+// Is this block in the dirty set?
+bool
+block_is_dirty(uint32_t blockno)
+{
+	return (bc_dirty_map[blockno / 32] & (1 << (blockno % 32))) != 0;
+}
+
+// Sort blocknos[0..n-1] into increasing order.
+static void
+sort_blocks(uint32_t *blocknos, uint32_t n)
+{
+	uint32_t gap, i, j, b;
+
+	// Shell sort
+	for (gap = n / 2; gap > 0; gap /= 2)
+		for (i = gap; i < n; i++) {
+			b = blocknos[i];
+			for (j = i; j >= gap && blocknos[j - gap] > b; j -= gap)
+				blocknos[j] = blocknos[j - gap];
+			blocknos[j] = b;
+		}
+}
+
+static bool bc_writing(uint32_t blockno);
+static void bc_write_finish(void);
+
+// Make the cached block at va writable and add it to the dirty set,
+// once any write of it in flight is done.
+static void
+bc_dirty_add(void *va)
+{
+	uint32_t blockno = ((uint32_t) va - DISKMAP) / BLKSIZE;
+	uint32_t i, n;
+	int r;
+
+	while (bc_writing(blockno))
+		bc_write_finish();
+	if ((r = sys_page_map(0, va, 0, va, PTE_U | PTE_W | PTE_P)) < 0)
+		panic("in bc_dirty_add, sys_page_map: %e", r);
+	if (block_is_dirty(blockno))
+		return;
+
+	if (bc_ndirty == BC_MAXDIRTY) {
+		// Drop the stale entries and duplicates.  Every block in
+		// the set is cached, so that leaves room.
+		sort_blocks(bc_dirty, bc_ndirty);
+		for (i = n = 0; i < bc_ndirty; i++)
+			if (block_is_dirty(bc_dirty[i])
+			    && (n == 0 || bc_dirty[i] != bc_dirty[n - 1]))
+				bc_dirty[n++] = bc_dirty[i];
+		bc_ndirty = n;
+	}
+	bc_dirty_map[blockno / 32] |= 1 << (blockno % 32);
+	bc_dirty[bc_ndirty++] = blockno;
+	bc_stat.bs_dirty++;
+}
+
+// Map the cached block at va read-only, which also clears its PTE_A and
+// PTE_D bits, and take it out of the dirty set.  Its contents must be
+// on disk.  The block may have been evicted while it was written.
+static void
+bc_clean(void *va)
+{
+	uint32_t blockno = ((uint32_t) va - DISKMAP) / BLKSIZE;
+	int r;
+
+	if (va_is_mapped(va)
+	    && (r = sys_page_map(0, va, 0, va, PTE_U | PTE_P)) < 0)
+		panic("in bc_clean, sys_page_map: %e", r);
+	if (block_is_dirty(blockno)) {
+		bc_dirty_map[blockno / 32] &= ~(1 << (blockno % 32));
+		bc_stat.bs_dirty--;
+	}
+}
+
+// Is this block kept in memory for good?  The superblock and bitmap
+// are small and touched by every allocation.
+static bool
+bc_pinned(uint32_t blockno)
+{
+	return blockno == 1 || (super && blockno < 2 + (super->s_nblocks
+		+ BLKBITSIZE - 1) / BLKBITSIZE);
+}
+
+// Evict a block chosen by the CLOCK hand, other than blocks lo to hi - 1,
+// and return its slot in bc_slots[] for reuse.
+static uint32_t
+bc_evict(uint32_t lo, uint32_t hi)
+{
+	uint32_t slot;
+	bool accessed;
+	void *va;
+	int r;
+
+	// Terminates within two trips round: the first clears every
+	// PTE_A bit it passes.
+	while (1) {
+		slot = bc_hand;
+		bc_hand = (bc_hand + 1) % bc_nslots;
+		if (bc_slots[slot] >= lo && bc_slots[slot] < hi)
+			continue;
+		va = diskaddr(bc_slots[slot]);
+		if (!va_is_mapped(va))
+			return slot;
+		accessed = uvpt[PGNUM(va)] & PTE_A;
+		if (block_is_dirty(bc_slots[slot])) {
+			// Clearing PTE_A by remapping the page would lose
+			// PTE_D, so the block must be written out first.
+			// The cache is under pressure, so write back every
+			// dirty block while at it; that clears both bits.
+			bc_writeback();
+		} else if (accessed &&
+			   (r = sys_page_map(0, va, 0, va,
+					     uvpt[PGNUM(va)] & PTE_SYSCALL)) < 0)
+			panic("in bc_evict, sys_page_map: %e", r);
+		if (accessed)
+			continue;
+		if ((r = sys_page_unmap(0, va)) < 0)
+			panic("in bc_evict, sys_page_unmap: %e", r);
+		bc_stat.bs_evictions++;
+		return slot;
+	}
+}
+
+// Make room in the cache for blockno, evicting a block other than lo
+// to hi - 1 if it is full.
+static void
+bc_add(uint32_t blockno, uint32_t lo, uint32_t hi)
+{
+	uint32_t slot;
+
+	if (bc_pinned(blockno))
+		return;
+	if (bc_nslots < bc_stat.bs_limit)
+		slot = bc_nslots++;
+	else
+		slot = bc_evict(lo, hi);
+	bc_slots[slot] = blockno;
+}
+
+// Read the n blocks starting at blockno, none of which may be cached,
+// into the cache with a single disk command.
+static void
+bc_read(uint32_t blockno, uint32_t n)
+{
+	uint32_t i;
+	void *va;
+	int r;
+
+	assert(n <= BC_MAXRUN);
+	for (i = 0; i < n; i++) {
+		// Make room, without evicting the blocks being read in
+		bc_add(blockno + i, blockno, blockno + n);
+		va = diskaddr(blockno + i);
+		if ((r = sys_page_alloc(0, va, PTE_U | PTE_W | PTE_P)) < 0)
+			panic("in bc_read, sys_page_alloc: %e", r);
+	}
+	if ((r = ide_read(blockno * BLKSECTS, diskaddr(blockno),
+			  n * BLKSECTS)) < 0)
+		panic("in bc_read, ide_read: %e", r);
+	bc_stat.bs_reads++;
+
+	// The blocks are clean, since we just read them from disk
+	for (i = 0; i < n; i++)
+		bc_clean(diskaddr(blockno + i));
+}
+
+// Return the read-ahead run in flight that holds blockno, if any.
+static struct BcPending *
+bc_pending_find(uint32_t blockno)
+{
+	struct BcPending *bp;
+	uint32_t i;
+
+	for (i = bc_rd_head; i != bc_rd_tail; i++) {
+		bp = &bc_pending[i % BC_NPENDING];
+		if (blockno >= bp->bp_blockno && blockno < bp->bp_blockno + bp->bp_n)
+			return bp;
+	}
+	return NULL;
+}
+
+// Wait for the read-ahead run bp to finish, and move its blocks from
+// the staging pages into the cache, clean.
+static void
+bc_install(struct BcPending *bp)
+{
+	char *stage = (char *) BC_STAGE + (bp - bc_pending) * BC_MAXRUN * BLKSIZE;
+	uint32_t i, blockno;
+	int r;
+
+	if ((r = ide_finish(&bp->bp_req)) < 0)
+		panic("in bc_install, ide_read: %e", r);
+	for (i = 0; i < bp->bp_n; i++) {
+		blockno = bp->bp_blockno + i;
+		bc_add(blockno, bp->bp_blockno, bp->bp_blockno + bp->bp_n);
+		if ((r = sys_page_map(0, stage + i * BLKSIZE, 0, diskaddr(blockno),
+				      PTE_U | PTE_P)) < 0)
+			panic("in bc_install, sys_page_map: %e", r);
+		if ((r = sys_page_unmap(0, stage + i * BLKSIZE)) < 0)
+			panic("in bc_install, sys_page_unmap: %e", r);
+	}
+	bp->bp_n = 0;
+}
+
+// Start reading the n blocks at blockno, none of which may be cached or
+// in flight, into a free staging area, as part of a batch that the
+// caller ends with ide_kick.  Returns false, having started nothing,
+// if every staging area is still in use.
+static bool
+bc_read_async(uint32_t blockno, uint32_t n)
+{
+	struct BcPending *bp;
+	char *stage;
+	uint32_t i;
+	int r;
+
+	assert(n <= BC_MAXRUN);
+	bc_reap();
+	if (bc_rd_tail - bc_rd_head == BC_NPENDING)
+		return false;
+
+	bp = &bc_pending[bc_rd_tail % BC_NPENDING];
+	stage = (char *) BC_STAGE + (bp - bc_pending) * BC_MAXRUN * BLKSIZE;
+	for (i = 0; i < n; i++)
+		if ((r = sys_page_alloc(0, stage + i * BLKSIZE,
+					PTE_U | PTE_W | PTE_P)) < 0)
+			panic("in bc_read_async, sys_page_alloc: %e", r);
+	bp->bp_req.id_secno = blockno * BLKSECTS;
+	bp->bp_req.id_nsecs = n * BLKSECTS;
+	bp->bp_req.id_flags = IDE_DMA_NOTIFY | IDE_DMA_MORE;
+	bp->bp_req.id_va = stage;
+	if ((r = ide_start(&bp->bp_req)) < 0)
+		panic("in bc_read_async, ide_start: %e", r);
+	bp->bp_blockno = blockno;
+	bp->bp_n = n;
+	bc_rd_tail++;
+	bc_stat.bs_reads++;
+	return true;
+}
+
 // Fault any disk block that is read in to memory by
 // loading it from disk.
 static void
@@ -31,7 +333,7 @@ bc_pgfault(struct UTrapframe *utf)
 {
 	void *addr = (void *) utf->utf_fault_va;
 	uint32_t blockno = ((uint32_t)addr - DISKMAP) / BLKSIZE;
-	int r;
+	struct BcPending *bp;
 
 	// Check that the fault was within the block cache region
 	if (addr < (void*)DISKMAP || addr >= (void*)(DISKMAP + DISKSIZE))
@@ -42,32 +344,31 @@ bc_pgfault(struct UTrapframe *utf)
 	if (super && blockno >= super->s_nblocks)
 		panic("reading non-existent block %08x\n", blockno);
 
-	// Allocate a page in the disk map region, read the contents
-	// of the block from the disk into that page.
-	// Hint: first round addr to page boundary. fs/ide.c has code to read
-	// the disk.
-	//
-	// LAB 5: you code here:
-    addr = ROUNDDOWN(addr, PGSIZE);
-    r = sys_page_alloc(0, addr, PTE_U | PTE_W | PTE_P);
-    if (r < 0) {
-        panic("in bc_pgfault, sys_page_alloc: %e", r);
-    }
-    r = ide_read(blockno * BLKSECTS, addr, BLKSECTS);
-    if (r < 0) {
-        panic("in bc_pgfault, ide_read: %e", r);
-    }
+	// A write to a clean cached block
+	addr = ROUNDDOWN(addr, PGSIZE);
+	if ((utf->utf_err & FEC_WR) && va_is_mapped(addr)) {
+		bc_dirty_add(addr);
+		return;
+	}
 
-	// Clear the dirty bit for the disk block page since we just read the
-	// block from disk
-	if ((r = sys_page_map(0, addr, 0, addr, uvpt[PGNUM(addr)] & PTE_SYSCALL)) < 0)
-		panic("in bc_pgfault, sys_page_map: %e", r);
+	// Allocate a page in the disk map region and read the contents
+	// of the block from the disk into that page, unless it is on its
+	// way already.
+	if ((bp = bc_pending_find(blockno)))
+		bc_install(bp);
+	else {
+		bc_read(blockno, 1);
+		bc_stat.bs_misses++;
+	}
 
 	// Check that the block we read was allocated. (exercise for
 	// the reader: why do we do this *after* reading the block
 	// in?)
 	if (bitmap && block_is_free(blockno))
 		panic("reading free block %08x\n", blockno);
+
+	if (utf->utf_err & FEC_WR)
+		bc_dirty_add(addr);
 }
 
 // Flush the contents of the block containing VA out to disk if
@@ -97,10 +398,132 @@ flush_block(void *addr)
     if (r < 0) {
         panic("in flush_block, ide_write: %e", r);
     }
-    r = sys_page_map(0, addr, 0, addr, uvpt[PGNUM(addr)] & PTE_SYSCALL);
-    if (r < 0) {
-        panic("in flush_block, sys_page_map: %e", r);
-    }
+    bc_stat.bs_writes++;
+    bc_clean(addr);
+}
+
+// Is a write of this block in flight?
+static bool
+bc_writing(uint32_t blockno)
+{
+	struct IdeDma *req;
+	uint32_t i;
+
+	for (i = bc_wr_head; i != bc_wr_tail; i++) {
+		req = &bc_writes[i % BC_NWRITES];
+		if (blockno >= req->id_secno / BLKSECTS
+		    && blockno < (req->id_secno + req->id_nsecs) / BLKSECTS)
+			return true;
+	}
+	return false;
+}
+
+// Wait for the oldest write in flight to finish, and clean its blocks.
+static void
+bc_write_finish(void)
+{
+	struct IdeDma *req = &bc_writes[bc_wr_head++ % BC_NWRITES];
+	uint32_t i;
+	int r;
+
+	if ((r = ide_finish(req)) < 0)
+		panic("in bc_write_finish, ide_write: %e", r);
+	// Nothing wrote to the blocks since, see bc_dirty_add
+	for (i = 0; i < req->id_nsecs / BLKSECTS; i++)
+		bc_clean(diskaddr(req->id_secno / BLKSECTS + i));
+}
+
+// Start writing the n blocks at blockno out to disk, first waiting for
+// the oldest write in flight if there are too many.  If more is set,
+// more writes of the batch follow.  The blocks are mapped read-only
+// until the write is done.
+static void
+bc_write(uint32_t blockno, uint32_t n, bool more)
+{
+	struct IdeDma *req;
+	uint32_t i;
+	void *va;
+	int r;
+
+	if (bc_wr_tail - bc_wr_head == BC_NWRITES)
+		bc_write_finish();
+	for (i = 0; i < n; i++) {
+		va = diskaddr(blockno + i);
+		if ((r = sys_page_map(0, va, 0, va, PTE_U | PTE_P)) < 0)
+			panic("in bc_write, sys_page_map: %e", r);
+	}
+	req = &bc_writes[bc_wr_tail % BC_NWRITES];
+	req->id_secno = blockno * BLKSECTS;
+	req->id_nsecs = n * BLKSECTS;
+	req->id_flags = IDE_DMA_WRITE | (more ? IDE_DMA_MORE : 0);
+	req->id_va = diskaddr(blockno);
+	if ((r = ide_start(req)) < 0)
+		panic("in bc_write, ide_start: %e", r);
+	bc_wr_tail++;
+	bc_stat.bs_writes++;
+}
+
+// Wait for every write started so far to reach the disk.
+void
+bc_wait(void)
+{
+	while (bc_wr_head != bc_wr_tail)
+		bc_write_finish();
+}
+
+// Move the read-ahead that has finished into the cache, and forget the
+// writes that have.  Called when the kernel says a transfer is done.
+void
+bc_reap(void)
+{
+	struct BcPending *bp;
+
+	while (bc_rd_head != bc_rd_tail) {
+		bp = &bc_pending[bc_rd_head % BC_NPENDING];
+		if (bp->bp_n && bp->bp_req.id_status == IDE_DMA_BUSY)
+			break;
+		if (bp->bp_n)
+			bc_install(bp);
+		bc_rd_head++;
+	}
+	while (bc_wr_head != bc_wr_tail
+	       && bc_writes[bc_wr_head % BC_NWRITES].id_status != IDE_DMA_BUSY)
+		bc_write_finish();
+}
+
+// Start writing out whichever of the n blocks in blocknos[] are dirty,
+// and not on their way to disk already, in block order, with one disk
+// command for each run of consecutive blocks.  They are cleaned when
+// their writes are done; use bc_wait to wait for that.
+// Reorders blocknos[].
+void
+bc_flush_blocks(uint32_t *blocknos, uint32_t n)
+{
+	uint32_t i, m, run;
+
+	for (i = m = 0; i < n; i++)
+		if (block_is_dirty(blocknos[i]) && !bc_writing(blocknos[i]))
+			blocknos[m++] = blocknos[i];
+	sort_blocks(blocknos, m);
+	for (i = n = 0; i < m; i++)
+		if (n == 0 || blocknos[i] != blocknos[n - 1])
+			blocknos[n++] = blocknos[i];
+
+	for (i = 0; i < n; i += run) {
+		for (run = 1; i + run < n && run < BC_MAXRUN
+			     && blocknos[i + run] == blocknos[i] + run; run++)
+			/* do nothing */;
+		bc_write(blocknos[i], run, i + run < n);
+		bc_stat.bs_writebacks += run;
+	}
+}
+
+// Start writing back every block in the dirty set.
+void
+bc_writeback(void)
+{
+	bc_flush_blocks(bc_dirty, bc_ndirty);
+	bc_ndirty = 0;
 }
 
 // Test that the block cache works, by smashing the superblock and
@@ -133,6 +556,80 @@ check_bc(void)
 	cprintf("block cache is good\n");
 }
 
+// Start reading the n blocks starting at blockno into the cache ahead
+// of their use.  Runs of blocks that are not cached or on their way yet
+// are read with one disk command each; other blocks are left alone.
+// Gives up on the rest if too many reads are in flight already.
+void
+bc_readahead(uint32_t blockno, uint32_t n)
+{
+	uint32_t i, run;
+
+	if (blockno == 0 || (super && blockno >= super->s_nblocks))
+		return;
+	if (super)
+		n = MIN(n, super->s_nblocks - blockno);
+	// Leave room for the blocks the reader has yet to get to
+	n = MIN(n, bc_stat.bs_limit / 2);
+
+	for (i = 0; i < n; i += run) {
+		run = 1;
+		if (va_is_mapped(diskaddr(blockno + i))
+		    || bc_pending_find(blockno + i))
+			continue;
+		while (i + run < n && run < BC_MAXRUN
+		       && !va_is_mapped(diskaddr(blockno + i + run))
+		       && !bc_pending_find(blockno + i + run))
+			run++;
+		if (!bc_read_async(blockno + i, run))
+			break;
+		bc_stat.bs_readahead += run;
+	}
+	ide_kick();
+}
+
+// Set the most evictable blocks to cache at once to 'limit', evicting
+// blocks until they fit.  Read-ahead in flight is installed first,
+// since its runs were sized for the old limit and need not fit the new.
+//
+// Returns 0 on success, -E_INVAL if limit is out of range.
+int
+bc_set_limit(uint32_t limit)
+{
+	struct BcPending *bp;
+	uint32_t slot;
+
+	if (limit < BC_MINLIMIT || limit > BC_MAXLIMIT)
+		return -E_INVAL;
+	for (; bc_rd_head != bc_rd_tail; bc_rd_head++) {
+		bp = &bc_pending[bc_rd_head % BC_NPENDING];
+		if (bp->bp_n)
+			bc_install(bp);
+	}
+	while (bc_nslots > limit) {
+		slot = bc_evict(0, 0);
+		bc_slots[slot] = bc_slots[--bc_nslots];
+		if (bc_hand >= bc_nslots)
+			bc_hand = 0;
+	}
+	bc_stat.bs_limit = limit;
+	return 0;
+}
+
+// Fill in *stat with the block cache's statistics.
+void
+bc_get_stat(struct BcStat *stat)
+{
+	uint32_t blockno;
+
+	bc_stat.bs_cached = bc_nslots;
+	bc_stat.bs_pinned = 0;
+	for (blockno = 1; bc_pinned(blockno); blockno++)
+		if (va_is_mapped(diskaddr(blockno)))
+			bc_stat.bs_pinned++;
+	*stat = bc_stat;
+}
+
 void
 bc_init(void)
 {
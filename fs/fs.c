@@ -202,6 +202,8 @@ file_get_block(struct File *f, uint32_t filebno, char **blk)
 		   *diskbno = newblock;
 	   }
 	   *blk = diskaddr(*diskbno);
+	   if (va_is_mapped(*blk))
+		   bc_stat.bs_hits++;
 	   return 0;
 }
 
@@ -364,6 +366,87 @@ file_open(const char *path, struct File **pf)
 	return walk_path(path, 0, pf, 0);
 }
 
+// Sequential read detection, for readahead.  A read that starts in the
+// block where the last read of the same file ended, or in the block
+// after it, is sequential.  Each sequential read that finds a block it
+// needs missing from the cache reads that block and the window after
+// it in as few disk commands as possible, then doubles the window, up
+// to what one IDE command can transfer.  Any other read shuts the
+// window.
+#define RA_NFILES	16		// Files tracked at once
+#define RA_MIN		4		// First window, in blocks
+#define RA_MAX		(256 / BLKSECTS)	// Largest window
+
+static struct Readahead {
+	struct File *ra_file;
+	uint32_t ra_next;		// File block after the last read
+	uint32_t ra_window;		// Blocks to read ahead, 0 if random
+	uint32_t ra_used;		// When last used, for replacement
+} ra_files[RA_NFILES];
+static uint32_t ra_clock;
+
+// Read ahead in f, if it is being read sequentially, for a read of
+// count > 0 bytes at offset.
+static void
+file_readahead(struct File *f, off_t offset, size_t count)
+{
+	struct Readahead *ra = &ra_files[0];
+	uint32_t bno[RA_MAX], filebno, lastbno, nblocks, i, n, run;
+	uint32_t *pdiskbno;
+
+	for (i = 0; i < RA_NFILES; i++) {
+		if (ra_files[i].ra_file == f) {
+			ra = &ra_files[i];
+			break;
+		}
+		if (ra_files[i].ra_used < ra->ra_used)
+			ra = &ra_files[i];
+	}
+	if (ra->ra_file != f) {
+		// Reading a file from the start is sequential
+		ra->ra_file = f;
+		ra->ra_next = 0;
+		ra->ra_window = 0;
+	}
+	ra->ra_used = ++ra_clock;
+
+	filebno = offset / BLKSIZE;
+	lastbno = (offset + count - 1) / BLKSIZE;
+	if (filebno != ra->ra_next && filebno + 1 != ra->ra_next) {
+		ra->ra_window = 0;
+		goto out;
+	}
+
+	// Find the first block of the read that is not cached
+	for (; filebno <= lastbno; filebno++)
+		if (file_block_walk(f, filebno, &pdiskbno, 0) == 0
+		    && *pdiskbno != 0 && !va_is_mapped(diskaddr(*pdiskbno)))
+			break;
+	if (filebno > lastbno)
+		goto out;
+
+	ra->ra_window = ra->ra_window ? MIN(ra->ra_window * 2, RA_MAX) : RA_MIN;
+	nblocks = (f->f_size + BLKSIZE - 1) / BLKSIZE;
+	n = MIN(ra->ra_window, nblocks - filebno);
+	for (i = 0; i < n; i++) {
+		if (file_block_walk(f, filebno + i, &pdiskbno, 0) < 0
+		    || *pdiskbno == 0)
+			break;
+		bno[i] = *pdiskbno;
+	}
+	n = i;
+
+	// Blocks that are consecutive on disk go in one read
+	for (i = 0; i < n; i += run) {
+		for (run = 1; i + run < n && bno[i + run] == bno[i] + run; run++)
+			/* do nothing */;
+		bc_readahead(bno[i], run);
+	}
+
+out:
+	ra->ra_next = lastbno + 1;
+}
+
 // Read count bytes from f into buf, starting from seek position
 // offset.  This meant to mimic the standard pread function.
 // Returns the number of bytes read, < 0 on error.
@@ -378,6 +461,8 @@ file_read(struct File *f, void *buf, size_t count, off_t offset)
 		return 0;
 
 	count = MIN(count, f->f_size - offset);
+	if (count > 0)
+		file_readahead(f, offset, count);
 
 	for (pos = offset; pos < offset + count; ) {
 		if ((r = file_get_block(f, pos / BLKSIZE, &blk)) < 0)
@@ -479,21 +564,29 @@ file_set_size(struct File *f, off_t newsize)
 // Loop over all the blocks in file.
 // Translate the file block number into a disk block number
 // and then check whether that disk block is dirty.  If so, write it out.
+// The blocks go out together, so that runs of them that are
+// consecutive on disk take one disk command each.
 void
 file_flush(struct File *f)
 {
-	int i;
+	static uint32_t blocknos[NDIRECT + NINDIRECT + 2];
+	int i, n = 0;
 	uint32_t *pdiskbno;
 
+	if (bc_stat.bs_dirty == 0)
+		return;
 	for (i = 0; i < (f->f_size + BLKSIZE - 1) / BLKSIZE; i++) {
 		if (file_block_walk(f, i, &pdiskbno, 0) < 0 ||
-		    pdiskbno == NULL || *pdiskbno == 0)
+		    pdiskbno == NULL || *pdiskbno == 0
+		    || !block_is_dirty(*pdiskbno))
 			continue;
-		flush_block(diskaddr(*pdiskbno));
+		blocknos[n++] = *pdiskbno;
 	}
-	flush_block(f);
+	blocknos[n++] = ((uint32_t) f - DISKMAP) / BLKSIZE;
 	if (f->f_indirect)
-		flush_block(diskaddr(f->f_indirect));
+		blocknos[n++] = f->f_indirect;
+	bc_flush_blocks(blocknos, n);
+	bc_wait();
 }
 
 
@@ -501,8 +594,8 @@ file_flush(struct File *f)
 void
 fs_sync(void)
 {
-	int i;
-	for (i = 1; i < super->s_nblocks; i++)
-		flush_block(diskaddr(i));
+	// Only the blocks in the dirty set need writing
+	bc_writeback();
+	bc_wait();
 }
 
@@ -13,6 +13,7 @@
 
 struct Super *super;		// superblock
 uint32_t *bitmap;		// bitmap blocks mapped in memory
+struct BcStat bc_stat;		// block cache statistics
 
 /* ide.c */
 bool	ide_probe_disk1(void);
@@ -20,12 +21,23 @@ void	ide_set_disk(int diskno);
 void	ide_set_partition(uint32_t first_sect, uint32_t nsect);
 int	ide_read(uint32_t secno, void *dst, size_t nsecs);
 int	ide_write(uint32_t secno, const void *src, size_t nsecs);
+int	ide_start(struct IdeDma *req);
+int	ide_finish(struct IdeDma *req);
+void	ide_kick(void);
 
 /* bc.c */
 void*	diskaddr(uint32_t blockno);
 bool	va_is_mapped(void *va);
 bool	va_is_dirty(void *va);
+bool	block_is_dirty(uint32_t blockno);
 void	flush_block(void *addr);
+void	bc_readahead(uint32_t blockno, uint32_t n);
+void	bc_flush_blocks(uint32_t *blocknos, uint32_t n);
+void	bc_writeback(void);
+void	bc_wait(void);
+void	bc_reap(void);
+int	bc_set_limit(uint32_t limit);
+void	bc_get_stat(struct BcStat *stat);
 void	bc_init(void);
 
 /* fs.c */
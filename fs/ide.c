@@ -1,5 +1,8 @@
 /*
- * Minimal PIO-based (non-interrupt-driven) IDE driver code.
+ * Minimal IDE driver code.  Transfers go to the kernel, which does them
+ * with its virtio-blk driver (kern/virtio_blk.c) or bus-master DMA
+ * engine (kern/ide.c), when there is one, and are done here with PIO,
+ * polling the drive, when there isn't.
  * For information about what all this IDE/ATA magic means,
  * see the materials available on the class references page.
  */
@@ -13,6 +16,10 @@
 #define IDE_ERR		0x01
 
 static int diskno = 1;
+// Cleared when the kernel says it can't do DMA
+static bool ide_use_dma = true;
+// Transfers started with IDE_DMA_MORE that the device may not know of
+static bool ide_unkicked;
 
 static int
 ide_wait_ready(bool check_error)
@@ -59,9 +66,8 @@ ide_set_disk(int d)
 	diskno = d;
 }
 
-
-int
-ide_read(uint32_t secno, void *dst, size_t nsecs)
+static int
+ide_pio_read(uint32_t secno, void *dst, size_t nsecs)
 {
 	int r;
 
@@ -85,8 +91,8 @@ ide_read(uint32_t secno, void *dst, size_t nsecs)
 	return 0;
 }
 
-int
-ide_write(uint32_t secno, const void *src, size_t nsecs)
+static int
+ide_pio_write(uint32_t secno, const void *src, size_t nsecs)
 {
 	int r;
 
@@ -110,3 +116,87 @@ ide_write(uint32_t secno, const void *src, size_t nsecs)
 	return 0;
 }
 
+
+// Start the transfer described by req: id_nsecs sectors from id_secno,
+// into or out of the page-aligned buffer at id_va, as id_flags says.
+// A transfer never finishes before an earlier one of the same sectors,
+// so a read started after a write of them sees what was written.
+// With IDE_DMA_MORE the device may not hear of the transfer until the
+// next one without it, or ide_kick.  Without DMA the transfer is done
+// before this returns.  Either way, the caller gets its status from
+// ide_finish.
+//
+// Returns 0 on success, < 0 if the transfer can't be started.
+int
+ide_start(struct IdeDma *req)
+{
+	int r;
+
+	assert(req->id_nsecs <= 256);
+	req->id_diskno = diskno;
+	if (ide_use_dma) {
+		if ((r = sys_ide_dma(req)) != -E_NOT_SUPP) {
+			if (r == 0)
+				ide_unkicked = req->id_flags & IDE_DMA_MORE;
+			return r;
+		}
+		ide_use_dma = false;
+	}
+
+	if (req->id_flags & IDE_DMA_WRITE)
+		req->id_status = ide_pio_write(req->id_secno, req->id_va,
+					       req->id_nsecs);
+	else
+		req->id_status = ide_pio_read(req->id_secno, req->id_va,
+					      req->id_nsecs);
+	return 0;
+}
+
+// Tell the device about the transfers started with IDE_DMA_MORE.
+void
+ide_kick(void)
+{
+	if (ide_unkicked) {
+		ide_unkicked = false;
+		sys_ide_dma(NULL);
+	}
+}
+
+// Wait for a transfer started by ide_start to finish, and return its
+// status: 0 on success, < 0 on error.
+int
+ide_finish(struct IdeDma *req)
+{
+	int r;
+
+	if (req->id_status == IDE_DMA_BUSY)
+		ide_kick();
+	while ((r = req->id_status) == IDE_DMA_BUSY)
+		sys_futex_wait((volatile uint32_t *) &req->id_status,
+			       IDE_DMA_BUSY, 0);
+	return r;
+}
+
+// Read nsecs sectors from secno into the page-aligned dst.
+int
+ide_read(uint32_t secno, void *dst, size_t nsecs)
+{
+	struct IdeDma req = { secno, nsecs, 0, 0, dst };
+	int r;
+
+	if ((r = ide_start(&req)) < 0)
+		return r;
+	return ide_finish(&req);
+}
+
+// Write nsecs sectors from the page-aligned src to secno.
+int
+ide_write(uint32_t secno, const void *src, size_t nsecs)
+{
+	struct IdeDma req = { secno, nsecs, 0, IDE_DMA_WRITE, (void *) src };
+	int r;
+
+	if ((r = ide_start(&req)) < 0)
+		return r;
+	return ide_finish(&req);
+}
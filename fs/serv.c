@@ -298,6 +298,45 @@ serve_sync(envid_t envid, union Fsipc *req)
 	return 0;
 }
 
+// Set the block cache's limit to ipc->cache.req_limit blocks, unless it
+// is 0, and return the cache's statistics in ipc->cacheRet.
+int
+serve_cache(envid_t envid, union Fsipc *ipc)
+{
+	int r;
+
+	if (ipc->cache.req_limit && (r = bc_set_limit(ipc->cache.req_limit)) < 0)
+		return r;
+	bc_get_stat(&ipc->cacheRet.ret_stat);
+	return 0;
+}
+
+// How often dirty blocks are written back, in msec
+#define WB_INTERVAL	5000
+
+static envid_t syncer_envid;
+
+// The syncer thread asks the server, whose envid is arg, to write back
+// the dirty blocks in its cache every WB_INTERVAL msec.  The server's
+// main thread does the writing, between requests, so nothing else
+// touches the block cache.
+static void *
+syncer(void *arg)
+{
+	envid_t fs_envid = (envid_t) arg;
+	uint32_t sleep_word = 0;
+
+	syncer_envid = sys_getenvid();
+	// Nobody wakes this word, so this sleeps for WB_INTERVAL.  The
+	// kernel may still end the wait early, when it remaps the page
+	// (see futex_wake_page); that only brings one write-back forward.
+	for (;;) {
+		sys_futex_wait(&sleep_word, 0, WB_INTERVAL);
+		ipc_send(fs_envid, FSREQ_WRITEBACK, 0, 0);
+	}
+	return NULL;
+}
+
 typedef int (*fshandler)(envid_t envid, union Fsipc *req);
 
 fshandler handlers[] = {
@@ -308,7 +347,8 @@ fshandler handlers[] = {
 	[FSREQ_FLUSH] =		(fshandler)serve_flush,
 	[FSREQ_WRITE] =		(fshandler)serve_write,
 	[FSREQ_SET_SIZE] =	(fshandler)serve_set_size,
-	[FSREQ_SYNC] =		serve_sync
+	[FSREQ_SYNC] =		serve_sync,
+	[FSREQ_CACHE] =		serve_cache
 };
 #define NHANDLERS (sizeof(handlers)/sizeof(handlers[0]))
 
@@ -326,6 +366,15 @@ serve(void)
 			cprintf("fs req %d from %08x [page %08x: %s]\n",
 				req, whom, uvpt[PGNUM(fsreq)], fsreq);
 
+		if (req == FSREQ_WRITEBACK && whom == syncer_envid) {
+			bc_writeback();
+			continue;
+		}
+		if (req == FSREQ_INTERRUPT && whom == 0) {
+			bc_reap();
+			continue;
+		}
+
 		// All requests must contain an argument page
 		if (!(perm & PTE_P)) {
 			cprintf("Invalid request from %08x: no argument page\n",
@@ -350,6 +399,9 @@ serve(void)
 void
 umain(int argc, char **argv)
 {
+	pthread_t t;
+	int r;
+
 	static_assert(sizeof(struct File) == 256);
 	binaryname = "fs";
 	cprintf("FS is running\n");
@@ -360,6 +412,8 @@ umain(int argc, char **argv)
 
 	serve_init();
 	fs_init();
+	if ((r = pthread_create(&t, syncer, (void *) thisenv->env_id)) < 0)
+		panic("cannot create syncer thread: %e", r);
 	serve();
 }
 
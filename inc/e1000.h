@@ -0,0 +1,93 @@
+#ifndef JOS_INC_E1000_H
+#define JOS_INC_E1000_H
+
+#include <inc/types.h>
+#include <inc/mmu.h>
+
+// Definitions of the Intel 8254x (e1000) shared by the kernel driver,
+// and the network server when it drives the card itself (see sys_net_bypass)
+
+#define TX_DESC_COUNT 32
+#define RX_DESC_COUNT 128
+
+// Register offsets
+#define E1000_CTRL      0x00000
+#define E1000_STATUS    0x00008
+#define E1000_EERD      0x00014
+#define E1000_ICR       0x000C0
+#define E1000_ICS       0x000C8
+#define E1000_IMS       0x000D0
+#define E1000_IMC       0x000D8
+#define E1000_RCTL      0x00100
+#define E1000_TCTL      0x00400
+#define E1000_TIPG      0x00410
+#define E1000_RDBAL     0x02800
+#define E1000_RDBAH     0x02804
+#define E1000_RDLEN     0x02808
+#define E1000_RDH       0x02810
+#define E1000_RDT       0x02818
+#define E1000_RSRPD     0x02C00
+#define E1000_TDBAL     0x03800
+#define E1000_TDBAH     0x03804
+#define E1000_TDLEN     0x03808
+#define E1000_TDH       0x03810
+#define E1000_TDT       0x03818
+#define E1000_TIDV      0x03820
+#define E1000_MTA       0x05200
+#define E1000_RAL0      0x05400
+#define E1000_RAH0      0x05404
+
+// Reception Status
+#define RX_STATUS_DD    1           // Descriptor Done
+#define RX_STATUS_EOP   (1 << 1)    // End of Packet
+
+// Trasmission status
+#define TX_STATUS_DD        1           // Descriptor Done
+#define TX_STATUS_EC        (1 << 1)    // Excess Collisions
+#define TX_STATUS_LC        (1 << 2)    // Late Collision
+#define TX_STATUS_TU        (1 << 3)    // Transmit Underrun
+
+// Trasmission Command
+#define TX_CMD_EOP       1           // End Of Packet
+#define TX_CMD_IFCS      (1 << 1)    // Insert FCS
+#define TX_CMD_IC        (1 << 2)    // Insert Checksum
+#define TX_CMD_RS        (1 << 3)    // Report Status
+#define TX_CMD_RSV       (1 << 4)    // Report Packet Sent
+#define TX_CMD_DEXT      (1 << 5)    // Extension (0 for legacy mode)
+#define TX_CMD_VLE       (1 << 6)    // VLAN Packet Enable
+#define TX_CMD_IDE       (1 << 7)    // Interrupt Delay Enable
+
+struct tx_desc
+{
+        uint64_t addr;
+        uint16_t length;
+        uint8_t cso;
+        uint8_t cmd;
+        uint8_t status;
+        uint8_t css;
+        uint16_t special;
+} __attribute__ ((packed));
+
+struct rx_desc
+{
+        uint64_t addr;
+        uint16_t length;
+        uint16_t packet_checksum;
+        uint8_t status;
+        uint8_t errors;
+        uint16_t special;
+} __attribute__ ((packed));
+
+// Layout of the card as mapped by sys_net_bypass, as offsets from the
+// address passed to it: the registers, followed by the transmission and
+// reception rings, and a page sized buffer for each of their descriptors.
+// the descriptors already point to their buffers.
+#define E1000_MAP_REGS_SIZE     0x20000
+#define E1000_MAP_REGS          0
+#define E1000_MAP_TX_RING       E1000_MAP_REGS_SIZE
+#define E1000_MAP_RX_RING       (E1000_MAP_TX_RING + PGSIZE)
+#define E1000_MAP_TX_BUF(i)     (E1000_MAP_RX_RING + PGSIZE + (i) * PGSIZE)
+#define E1000_MAP_RX_BUF(i)     (E1000_MAP_TX_BUF(TX_DESC_COUNT) + (i) * PGSIZE)
+#define E1000_MAP_SIZE          E1000_MAP_RX_BUF(RX_DESC_COUNT)
+
+#endif	// !JOS_INC_E1000_H
@@ -39,6 +39,18 @@ enum {
 	ENV_WAITING_FOR_IO
 };
 
+// env_affinity of an env that may run on any CPU
+#define ENV_AFFINITY_ALL	0xFFFFFFFF
+
+// Scheduling priorities, from most to least urgent.  An env's base
+// priority is set with sys_env_set_priority; the scheduler moves it
+// down one level each time it uses up a whole time slice, and back to
+// its base priority when it blocks (see kern/sched.c).
+#define ENV_PRIO_HIGH		0
+#define ENV_PRIO_NORMAL		1
+#define ENV_PRIO_LOW		2
+#define ENV_NPRIO		4
+
 // Special environment types
 enum EnvType {
 	ENV_TYPE_USER = 0,
@@ -46,6 +58,18 @@ enum EnvType {
 	ENV_TYPE_NS,		// Network server
 };
 
+// Resources an environment has used, kept by the kernel.  All but
+// es_pages are also visible in envs[]; sys_env_stat fills in all.
+struct EnvStat {
+	uint64_t es_utime;		// TSC cycles run in user mode
+	uint64_t es_stime;		// TSC cycles the kernel ran for it
+	uint32_t es_syscalls;		// System calls made
+	uint32_t es_pgfaults;		// Page faults taken
+	uint32_t es_ipc_sends;		// IPC messages sent
+	uint32_t es_ipc_recvs;		// IPC messages and notifications received
+	uint32_t es_pages;		// Pages mapped below UTOP
+};
+
 struct Env {
 	struct Trapframe env_tf;	// Saved registers
 	struct Env *env_link;		// Next free Env
@@ -54,13 +78,23 @@ struct Env {
 	enum EnvType env_type;		// Indicates special system environments
 	unsigned env_status;		// Status of the environment
 	uint32_t env_runs;		// Number of times environment has run
+	struct EnvStat env_stat;	// Resources used so far
 	int env_cpunum;			// The CPU that the env is running on
+	uint32_t env_affinity;		// CPUs it may run on (bit i = cpus[i])
+	int env_pref_cpu;		// CPU the scheduler runs it on, or -1
+	int env_priority;		// Base priority, ENV_PRIO_*
+	int env_level;			// Current priority, >= env_priority
+	int env_slice_used;		// Ticks of its time slice used up
 
 	// Address space
 	pde_t *env_pgdir;		// Kernel virtual address of page dir
 
 	// Exception handling
 	void *env_pgfault_upcall;	// Page fault upcall entry point
+	uintptr_t env_xstacktop;	// Top of its user exception stack
+
+	// Threads (see sys_thread_create)
+	void *env_tls;			// Thread-local data, for the user
 
 	// Lab 4 IPC
 	bool env_ipc_recving;		// Env is blocked receiving
@@ -70,6 +104,13 @@ struct Env {
 	uint32_t env_ipc_value;		// Data value sent to us
 	envid_t env_ipc_from;		// envid of the sender
 	int env_ipc_perm;		// Perm of page mapping received
+	bool env_notify_pending;	// Kernel notification not received yet
+	uint32_t env_notify_value;	// Value of the pending notification
+
+	// Futexes (see kern/futex.c)
+	physaddr_t env_futex_addr;	// Word it is blocked on, or 0
+	uint32_t env_futex_deadline;	// time_msec() to give up at, or 0
+	struct Env *env_futex_link;	// Next waiter in the same bucket
 };
 
 #endif // !JOS_INC_ENV_H
@@ -27,6 +27,8 @@ enum {
 	E_NOT_SUPP	,	// Operation not supported
 	E_RX_EMPTY,    // receive queue is empty
 	E_RX_FULL,
+	E_AGAIN		,	// Futex word changed before blocking
+	E_TIMEOUT	,	// Wait timed out
 	MAXERROR
 };
 
@@ -70,7 +70,28 @@ enum {
 	FSREQ_STAT,
 	FSREQ_FLUSH,
 	FSREQ_REMOVE,
-	FSREQ_SYNC
+	FSREQ_SYNC,
+	// Cache returns a Fsret_cache on the request page
+	FSREQ_CACHE,
+	// Sent, with no page, by the file server's own syncer thread
+	FSREQ_WRITEBACK,
+	// Sent by the kernel (envid 0) when a disk transfer finishes
+	FSREQ_INTERRUPT
+};
+
+// Block cache statistics, returned by FSREQ_CACHE
+struct BcStat {
+	uint32_t bs_limit;		// Most evictable blocks cached at once
+	uint32_t bs_cached;		// Evictable blocks cached now
+	uint32_t bs_pinned;		// Superblock and bitmap blocks cached
+	uint32_t bs_dirty;		// Blocks in the dirty set
+	uint32_t bs_hits;		// File block lookups that found it cached
+	uint32_t bs_misses;		// Blocks read in on a page fault
+	uint32_t bs_evictions;		// Blocks dropped to make room
+	uint32_t bs_writebacks;		// Dirty blocks written back in batches
+	uint32_t bs_readahead;		// Blocks read before they were used
+	uint32_t bs_reads;		// Disk read commands
+	uint32_t bs_writes;		// Disk write commands
 };
 
 union Fsipc {
@@ -108,6 +129,12 @@ union Fsipc {
 	struct Fsreq_remove {
 		char req_path[MAXPATHLEN];
 	} remove;
+	struct Fsreq_cache {
+		uint32_t req_limit;	// New cache limit, or 0 to keep it
+	} cache;
+	struct Fsret_cache {
+		struct BcStat ret_stat;
+	} cacheRet;
 
 	// Ensure Fsipc is one page
 	char _pad[PGSIZE];
@@ -0,0 +1,29 @@
+// See COPYRIGHT for copyright information.
+
+#ifndef JOS_INC_IDE_H
+#define JOS_INC_IDE_H
+
+#include <inc/types.h>
+
+// A disk transfer for the kernel's bus-master IDE DMA engine, or its
+// virtio-blk driver if there is a virtio disk, queued with sys_ide_dma.
+// The kernel copies the request when it is queued, and sets id_status
+// when the transfer is done, waking any futex waiters on it.
+struct IdeDma {
+	uint32_t id_secno;		// First sector
+	uint16_t id_nsecs;		// Sectors, 1 to IDE_DMA_MAXSECS
+	uint8_t id_diskno;		// IDE drive on the primary channel, 0 or 1
+	uint8_t id_flags;		// IDE_DMA_*
+	void *id_va;			// Page-aligned buffer
+	volatile int32_t id_status;	// IDE_DMA_BUSY, then 0 or < 0
+};
+
+#define IDE_DMA_WRITE	0x01	// Memory to disk
+#define IDE_DMA_NOTIFY	0x02	// Notify the submitter when done
+#define IDE_DMA_MORE	0x04	// More follow: don't tell the device yet
+
+#define IDE_DMA_BUSY	1
+#define IDE_DMA_MAXSECS	256	// What one ATA command can move
+#define IDE_DMA_NREQ	32	// Transfers the kernel queues at once
+
+#endif	// !JOS_INC_IDE_H
@@ -22,6 +22,7 @@
 #include <inc/args.h>
 #include <inc/malloc.h>
 #include <inc/ns.h>
+#include <inc/ide.h>
 
 #define USED(x)		(void)(x)
 
@@ -33,8 +34,10 @@ extern const char *binaryname;
 extern const volatile struct Env *thisenv;
 extern const volatile struct Env envs[NENV];
 extern const volatile struct PageInfo pages[];
+extern const volatile struct CpuStat cpustats[];
 
-// allows getting the current env regardless of type of fork used
+// allows getting the current env regardless of type of fork used,
+// and in threads (see pthread_create), where thisenv is the main thread's
 #ifndef curenv
 #define curenv  (&envs[ENVX(sys_getenvid())])
 #endif
@@ -65,9 +68,22 @@ int	sys_page_unmap(envid_t env, void *pg);
 int	sys_ipc_try_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int	sys_ipc_recv(void *rcv_pg);
 unsigned int sys_time_msec(void);
-int sys_net_try_send(void *va, size_t length);
-int sys_net_recv(void *va);
-int sys_get_mac_addr(void *addr);
+int sys_net_try_send(int dev, void *va, size_t length, int flags);
+int sys_net_recv(int dev, void *va);
+int sys_get_mac_addr(int dev, void *addr);
+int sys_net_try_send_tso(int dev, void *va, size_t length, uint16_t mss);
+int sys_net_try_send_sg(int dev, const struct jif_sg *sg, size_t nsg, uint16_t mss);
+int sys_net_bypass(int dev, void *va);
+int sys_env_set_affinity(envid_t env, uint32_t mask);
+int sys_env_set_priority(envid_t env, int priority);
+int sys_futex_wait(const volatile uint32_t *addr, uint32_t expected, uint32_t timeout_ms);
+int sys_futex_wake(const volatile uint32_t *addr, int n);
+envid_t sys_thread_create(void *eip, void *esp, void *xstacktop, void *tls);
+void sys_thread_exit(void);
+int sys_prof_ctl(int op, int arg);
+int sys_env_stat(envid_t envid, struct EnvStat *st);
+int sys_trace_ctl(int op);
+int sys_ide_dma(struct IdeDma *req);
 
 // This must be inlined.  Exercise for reader: why?
 static __inline envid_t __attribute__((always_inline))
@@ -108,10 +124,26 @@ int	open(const char *path, int mode);
 int	ftruncate(int fd, off_t size);
 int	remove(const char *path);
 int	sync(void);
+int	fscache(uint32_t limit, struct BcStat *stat);
 
 // pageref.c
 int	pageref(void *addr);
 
+// pthread.c
+typedef struct pthread *pthread_t;
+typedef struct {
+	volatile uint32_t m_state;	// 0 free, 1 locked, 2 locked with waiters
+} pthread_mutex_t;
+#define PTHREAD_MUTEX_INITIALIZER	{ 0 }
+
+int	pthread_create(pthread_t *thread, void *(*func)(void *), void *arg);
+int	pthread_join(pthread_t thread, void **ret_store);
+void	pthread_exit(void *ret) __attribute__((noreturn));
+pthread_t pthread_self(void);
+void	pthread_mutex_lock(pthread_mutex_t *m);
+int	pthread_mutex_trylock(pthread_mutex_t *m);
+void	pthread_mutex_unlock(pthread_mutex_t *m);
+
 // sockets.c
 int     accept(int s, struct sockaddr *addr, socklen_t *addrlen);
 int     bind(int s, struct sockaddr *name, socklen_t namelen);
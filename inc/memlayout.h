@@ -114,6 +114,9 @@
 #define UPAGES		(UVPT - PTSIZE)
 // Read-only copies of the global env structures
 #define UENVS		(UPAGES - PTSIZE)
+// Read-only per-CPU statistics (struct CpuStat), in the last page of
+// the RO ENVS region
+#define UCPUSTAT	(UPAGES - PGSIZE)
 
 /*
  * Top of user VM. User can manipulate VA from UTOP-1 and down!
@@ -141,6 +144,11 @@
 // Physical address of startup code for non-boot CPUs (APs)
 #define MPENTRY_PADDR	0x7000
 
+// Physical address, just past the boot sector, where the boot loader
+// leaves two 64-bit TSC values: when it started, and when it jumped to
+// the kernel
+#define BOOTTSC_PADDR	0x7E00
+
 #ifndef __ASSEMBLER__
 
 typedef uint32_t pte_t;
@@ -14,6 +14,46 @@ struct jif_pkt {
 
 #define MAX_PACKET_SIZE 16288
 
+// Outgoing packets are handed from the network server to the output
+// environment through a ring of transmit slots shared by both (PTE_SHARE).
+// The network server fills the slots in order, and notifies the output
+// environment of each with an NSREQ_OUTPUT_TXSLOT message, which consumes
+// them in the same order.
+// The output environment zeroes ts_len once it has handed a slot to the
+// NIC, so a slot with a length is one the network server filled and is
+// about to send the message for: a burst of packets the NIC can be told
+// about at once (see NET_SEND_MORE).
+// A slot is reused only after TXSLOT_COUNT - 2 later packets were handed
+// to the NIC, so TXSLOT_COUNT must exceed the NIC transmit ring by 2 to
+// guarantee the card is done reading it.
+// Each NIC has its own output environment, and its own ring of slots.
+#define TXSLOT_BASE	0x10000000
+#define TXSLOT_SIZE	(4 * PGSIZE)
+#define TXSLOT_COUNT	34
+#define TXSLOT_NIC_BASE(nic)	(TXSLOT_BASE + (nic) * TXSLOT_COUNT * TXSLOT_SIZE)
+
+// Most NICs the network server bonds into its interface
+#define NS_NIC_MAX	4
+
+// One of the buffers a packet is gathered from by sys_net_try_send_sg
+struct jif_sg {
+	void *sg_addr;
+	size_t sg_len;
+};
+
+#define JIF_SG_MAX	16
+
+// Flags of sys_net_try_send
+#define NET_SEND_MORE	0x01	// More packets follow: don't tell the NIC yet
+
+struct jif_txslot {
+	int ts_len;
+	// if non zero, the packet is a TCP segment for the NIC to cut into
+	// frames of this many bytes of payload
+	int ts_mss;
+	char ts_data[0];
+};
+
 // Definitions for requests from clients to network server
 enum {
 	// The following messages pass a page containing an Nsipc.
@@ -29,18 +69,20 @@ enum {
 	NSREQ_SEND,
 	NSREQ_SOCKET,
 
-	// The following three messages pass a page containing a struct jif_pkt
+	// The following two messages pass a page containing a struct jif_pkt
 	NSREQ_INPUT,
 	// NSREQ_OUTPUT messages, unlike all other messages, are sent *from* the
 	// network server, to the output environment
-	// also states that the packet to send should me marked as EOP
 	NSREQ_OUTPUT,
-	// this message states that the packet is part of multiple packets
-	// which means it is not EOP packet
-	NSREQ_OUTPUT_MULTI,
+	// sent like NSREQ_OUTPUT, but passes no page,
+	// the packet is in the next transmit slot
+	NSREQ_OUTPUT_TXSLOT,
 
-	// The following message passes no page
+	// The following messages pass no page
 	NSREQ_TIMER,
+	// sent by the kernel (envid 0) when the NIC driven by the network
+	// server interrupts, see sys_net_bypass
+	NSREQ_INTERRUPT,
 };
 
 union Nsipc {
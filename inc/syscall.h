@@ -21,7 +21,36 @@ enum {
 	SYS_net_try_send,
 	SYS_net_recv,
 	SYS_get_mac_addr,
+	SYS_net_try_send_tso,
+	SYS_net_try_send_sg,
+	SYS_net_bypass,
+	SYS_env_set_affinity,
+	SYS_env_set_priority,
+	SYS_futex_wait,
+	SYS_futex_wake,
+	SYS_thread_create,
+	SYS_thread_exit,
+	SYS_prof_ctl,
+	SYS_env_stat,
+	SYS_trace_ctl,
+	SYS_ide_dma,
 	NSYSCALLS
 };
 
+/* sys_prof_ctl operations */
+enum {
+	PROF_START = 0,		// start sampling
+	PROF_STOP,		// stop sampling, keeping the samples
+	PROF_RESET,		// discard the samples
+	PROF_FLAT,		// print a flat profile
+	PROF_GRAPH,		// print a call-graph profile
+};
+
+/* sys_trace_ctl operations */
+enum {
+	TRACE_CTL_START = 0,	// discard old events and start tracing
+	TRACE_CTL_STOP,		// stop tracing, keeping the events
+	TRACE_CTL_DUMP,		// stop tracing and print the events
+};
+
 #endif /* !JOS_INC_SYSCALL_H */
@@ -39,6 +39,11 @@
 #define IRQ_IDE         14
 #define IRQ_ERROR       19
 
+// Inter-processor interrupts, sent by one CPU's local APIC to another's.
+// Vectors IRQ_OFFSET+16 and up overlap T_SYSCALL, so these start at 20.
+#define IRQ_IPI_WAKEUP  20
+#define IRQ_IPI_CALL    21
+
 #ifndef __ASSEMBLER__
 
 #include <inc/types.h>
@@ -86,6 +91,20 @@ struct UTrapframe {
 	uintptr_t utf_esp;
 } __attribute__((packed));
 
+#define CPUSTAT_NVEC	64	// Vectors counted; higher ones count in the last
+
+/* What a CPU has been doing, kept by the kernel for each CPU and mapped
+ * read-only for users at UCPUSTAT.  Each CPU's counters take whole cache
+ * lines, so CPUs counting their own events do not false-share. */
+struct CpuStat {
+	uint32_t cs_online;		/* Nonzero if the CPU is running */
+	uint32_t cs_halts;		/* Times it went idle */
+	uint32_t cs_switches;		/* Switches to a different env */
+	uint32_t cs_padding;
+	uint64_t cs_idle_tsc;		/* TSC cycles spent halted */
+	uint32_t cs_traps[CPUSTAT_NVEC]; /* Traps taken, by vector */
+} __attribute__((aligned(64)));
+
 #endif /* !__ASSEMBLER__ */
 
 #endif /* !JOS_INC_TRAP_H */
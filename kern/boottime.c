@@ -0,0 +1,92 @@
+// Boot time breakdown.
+//
+// The boot loader and each step of i386_init record the TSC when they
+// finish; boottime_print shows how long each step took.  TSC cycles
+// are turned into time using the timer ticks since time_init, so the
+// times are only shown once the kernel has run for a while.
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/memlayout.h>
+#include <inc/x86.h>
+
+#include <kern/time.h>
+#include <kern/boottime.h>
+
+#define BOOT_NPHASE	16
+
+static struct BootPhase {
+	const char *bp_name;
+	uint64_t bp_tsc;		// When the phase ended
+} boot_phases[BOOT_NPHASE];
+static int boot_nphase;
+
+// Set once the first user environment runs
+bool boot_done;
+
+// When time_init ran, to calibrate the TSC against time_msec()
+static uint64_t boot_tsc_time0;
+
+// Take the boot loader's timestamps.  Must run before anything can
+// reuse the low memory it left them in.
+void
+boottime_init(void)
+{
+	const uint64_t *tsc = (const uint64_t *) (KERNBASE + BOOTTSC_PADDR);
+	uint64_t now = read_tsc();
+
+	// a different loader would not have left sane values
+	if (tsc[0] == 0 || tsc[0] > tsc[1] || tsc[1] > now)
+		return;
+	boot_phases[0].bp_name = "loader start";
+	boot_phases[0].bp_tsc = tsc[0];
+	boot_phases[1].bp_name = "boot loader";
+	boot_phases[1].bp_tsc = tsc[1];
+	boot_nphase = 2;
+}
+
+// Record that the named phase of booting has just finished.
+void
+boottime_mark(const char *phase)
+{
+	if (boot_nphase == BOOT_NPHASE)
+		return;
+	boot_phases[boot_nphase].bp_name = phase;
+	boot_phases[boot_nphase].bp_tsc = read_tsc();
+	if (strcmp(phase, "time_init") == 0)
+		boot_tsc_time0 = boot_phases[boot_nphase].bp_tsc;
+	boot_nphase++;
+}
+
+void
+boottime_print(void)
+{
+	uint64_t khz = 0, cycles;
+	unsigned msec = time_msec();
+	int i;
+
+	if (boot_nphase < 2) {
+		cprintf("no boot times recorded\n");
+		return;
+	}
+	// the timer ticks every 10ms, so wait for a few before trusting it
+	if (boot_tsc_time0 && msec >= 100)
+		khz = (read_tsc() - boot_tsc_time0) / msec;
+
+	cprintf("%-16s %14s %10s\n", "phase", "cycles", "ms");
+	for (i = 1; i < boot_nphase; i++) {
+		cycles = boot_phases[i].bp_tsc - boot_phases[i - 1].bp_tsc;
+		cprintf("%-16s %14llu", boot_phases[i].bp_name, cycles);
+		if (khz)
+			cprintf(" %6llu.%03llu", cycles / khz,
+				cycles * 1000 / khz % 1000);
+		cprintf("\n");
+	}
+	cycles = boot_phases[boot_nphase - 1].bp_tsc - boot_phases[0].bp_tsc;
+	cprintf("%-16s %14llu", "total", cycles);
+	if (khz)
+		cprintf(" %6llu.%03llu", cycles / khz, cycles * 1000 / khz % 1000);
+	cprintf("\n");
+	if (!khz)
+		cprintf("(times in ms once the timer has run for 100ms)\n");
+}
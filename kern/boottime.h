@@ -0,0 +1,17 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_BOOTTIME_H
+#define JOS_KERN_BOOTTIME_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+extern bool boot_done;
+
+void boottime_init(void);
+void boottime_mark(const char *phase);
+void boottime_print(void);
+
+#endif	// !JOS_KERN_BOOTTIME_H
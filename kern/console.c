@@ -5,9 +5,12 @@
 #include <inc/kbdreg.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/trap.h>
 
 #include <kern/console.h>
 #include <kern/picirq.h>
+#include <kern/env.h>
+#include <kern/sched.h>
 
 static void cons_intr(int (*proc)(void));
 static void cons_putc(int c);
@@ -32,8 +35,12 @@ delay(void)
 #define COM_DLM		1	// Out: Divisor Latch High (DLAB=1)
 #define COM_IER		1	// Out: Interrupt Enable Register
 #define   COM_IER_RDI	0x01	//   Enable receiver data interrupt
+#define   COM_IER_TXI	0x02	//   Enable transmitter empty interrupt
 #define COM_IIR		2	// In:	Interrupt ID Register
+#define   COM_IIR_FIFO	0xC0	//   FIFOs enabled
 #define COM_FCR		2	// Out: FIFO Control Register
+#define   COM_FCR_ENABLE 0x01	//   Enable the FIFOs
+#define   COM_FCR_CLEAR	0x06	//   Clear both FIFOs
 #define COM_LCR		3	// Out: Line Control Register
 #define	  COM_LCR_DLAB	0x80	//   Divisor latch access bit
 #define	  COM_LCR_WLEN8	0x03	//   Wordlength: 8 bits
@@ -46,7 +53,32 @@ delay(void)
 #define   COM_LSR_TXRDY	0x20	//   Transmit buffer avail
 #define   COM_LSR_TSRE	0x40	//   Transmitter off
 
+#define COM_TXFIFO	16	// Bytes the 16550 transmit FIFO holds
+
 static bool serial_exists;
+static int serial_txburst;	// Bytes to send each time it is empty
+
+// Output waiting for the UART.  Writers queue characters here and
+// return; the UART's transmitter-empty interrupt refills it from the
+// ring (see serial_tx_start).  Only when the ring is full do kernel
+// writers wait for the UART, and sys_cputs puts the env to sleep
+// instead (see cons_write).
+#define SERIAL_TXBUFSIZE 4096
+
+static struct {
+	uint8_t buf[SERIAL_TXBUFSIZE];
+	uint32_t rpos;			// Free-running; index mod the size
+	uint32_t wpos;
+} serial_tx;
+
+static bool serial_tx_ien;	// Transmitter interrupt enabled
+static bool serial_tx_waiting;	// Envs sleep until the ring drains
+
+static uint32_t
+serial_tx_used(void)
+{
+	return serial_tx.wpos - serial_tx.rpos;
+}
 
 static int
 serial_proc_data(void)
@@ -56,31 +88,77 @@ serial_proc_data(void)
 	return inb(COM1+COM_RX);
 }
 
+// Wake the envs that found the ring full once it is half empty.
+static void
+serial_tx_wakeup(void)
+{
+	int i;
+
+	if (!serial_tx_waiting || serial_tx_used() > SERIAL_TXBUFSIZE / 2)
+		return;
+	serial_tx_waiting = false;
+	for (i = 0; i < NENV; i++) {
+		struct Env *env = &envs[i];
+		if (env->env_status == ENV_WAITING_FOR_IO && env->env_waits_for_output) {
+			env->env_waits_for_output = false;
+			sched_wakeup(env);
+		}
+	}
+}
+
+// Move queued output into the UART if it has room, and keep its
+// transmitter interrupt on for as long as output is queued.
+static void
+serial_tx_start(void)
+{
+	int i;
+
+	if (serial_tx_used() && (inb(COM1 + COM_LSR) & COM_LSR_TXRDY))
+		for (i = 0; i < serial_txburst && serial_tx_used(); i++)
+			outb(COM1 + COM_TX,
+			     serial_tx.buf[serial_tx.rpos++ % SERIAL_TXBUFSIZE]);
+
+	if (!!serial_tx_used() != serial_tx_ien) {
+		serial_tx_ien = !serial_tx_ien;
+		outb(COM1 + COM_IER,
+		     COM_IER_RDI | (serial_tx_ien ? COM_IER_TXI : 0));
+	}
+	serial_tx_wakeup();
+}
+
 void
 serial_intr(void)
 {
-	if (serial_exists)
+	if (serial_exists) {
 		cons_intr(serial_proc_data);
+		serial_tx_start();
+	}
 }
 
+// Queue c for the UART, waiting for it only if the ring is full.
 static void
 serial_putc(int c)
 {
 	int i;
 
-	for (i = 0;
-	     !(inb(COM1 + COM_LSR) & COM_LSR_TXRDY) && i < 12800;
-	     i++)
-		delay();
-
-	outb(COM1 + COM_TX, c);
+	if (!serial_exists)
+		return;
+	while (serial_tx_used() == SERIAL_TXBUFSIZE) {
+		for (i = 0;
+		     !(inb(COM1 + COM_LSR) & COM_LSR_TXRDY) && i < 12800;
+		     i++)
+			delay();
+		serial_tx_start();
+	}
+	serial_tx.buf[serial_tx.wpos++ % SERIAL_TXBUFSIZE] = c;
+	serial_tx_start();
 }
 
 static void
 serial_init(void)
 {
-	// Turn off the FIFO
-	outb(COM1+COM_FCR, 0);
+	// Turn on the FIFOs, interrupting on every received byte
+	outb(COM1+COM_FCR, COM_FCR_ENABLE | COM_FCR_CLEAR);
 
 	// Set speed; requires DLAB latch
 	outb(COM1+COM_LCR, COM_LCR_DLAB);
@@ -98,12 +176,14 @@ serial_init(void)
 	// Clear any preexisting overrun indications and interrupts
 	// Serial port doesn't exist if COM_LSR returns 0xFF
 	serial_exists = (inb(COM1+COM_LSR) != 0xFF);
-	(void) inb(COM1+COM_IIR);
+	// An 8250 or 16450 has no FIFO to fill
+	serial_txburst = (inb(COM1+COM_IIR) & COM_IIR_FIFO) == COM_IIR_FIFO
+		? COM_TXFIFO : 1;
 	(void) inb(COM1+COM_RX);
 
 	// Enable serial interrupts
 	if (serial_exists)
-		irq_setmask_8259A(irq_mask_8259A & ~(1<<4));
+		irq_enable(IRQ_SERIAL);
 }
 
 
@@ -112,13 +192,13 @@ serial_init(void)
 // For information on PC parallel port programming, see the class References
 // page.
 
+// The parallel port only mirrors the console, so rather than waiting
+// for a busy or missing printer, drop the character.
 static void
 lpt_putc(int c)
 {
-	int i;
-
-	for (i = 0; !(inb(0x378+1) & 0x80) && i < 12800; i++)
-		delay();
+	if (!(inb(0x378+1) & 0x80))
+		return;
 	outb(0x378+0, c);
 	outb(0x378+2, 0x08|0x04|0x01);
 	outb(0x378+2, 0x08);
@@ -375,7 +455,7 @@ kbd_init(void)
 {
 	// Drain the kbd buffer so that QEMU generates interrupts.
 	kbd_intr();
-	irq_setmask_8259A(irq_mask_8259A & ~(1<<1));
+	irq_enable(IRQ_KBD);
 }
 
 
@@ -440,6 +520,25 @@ cons_putc(int c)
 	cga_putc(c);
 }
 
+// Write up to len bytes of s to the console for an env, without
+// waiting for the UART.  Returns the number written, which is 0 if the
+// serial ring is full; then the env should sleep in ENV_WAITING_FOR_IO
+// with env_waits_for_output set until the ring drains.
+size_t
+cons_write(const char *s, size_t len)
+{
+	size_t n;
+
+	for (n = 0; n < len; n++) {
+		if (serial_exists && serial_tx_used() == SERIAL_TXBUFSIZE) {
+			serial_tx_waiting = true;
+			break;
+		}
+		cons_putc(s[n]);
+	}
+	return n;
+}
+
 // initialize the console devices
 void
 cons_init(void)
@@ -19,6 +19,7 @@
 
 void cons_init(void);
 int cons_getc(void);
+size_t cons_write(const char *s, size_t len);
 
 void kbd_intr(void); // irq 1
 void serial_intr(void); // irq 4
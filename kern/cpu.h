@@ -17,16 +17,25 @@ enum {
 	CPU_HALTED,
 };
 
+struct IpiCall;
+
 // Per-CPU state
 struct CpuInfo {
 	uint8_t cpu_id;                 // Local APIC ID; index into cpus[] below
 	volatile unsigned cpu_status;   // The status of the CPU
 	struct Env *cpu_env;            // The currently-running environment.
 	struct Taskstate cpu_ts;        // Used by x86 to find stack for interrupt
+	struct IpiCall *volatile cpu_ipi_call; // Pending cross-CPU call, if any
+	volatile bool cpu_ipi_kicked;   // A wakeup IPI is already on its way
+	struct Env *cpu_handoff;        // Woken to run here next, see sched_wakeup
+	uint64_t cpu_tsc_mark;          // TSC when time was last charged to an env
+	uint64_t cpu_halt_tsc;          // TSC when the CPU last halted
+	struct CpuStat *cpu_stat;       // Counters, in cpu_stats[] (user-visible)
 };
 
 // Initialized in mpconfig.c
 extern struct CpuInfo cpus[NCPU];
+extern struct CpuStat cpu_stats[];	// Mapped at UCPUSTAT
 extern int ncpu;                    // Total number of CPUs in the system
 extern struct CpuInfo *bootcpu;     // The boot-strap processor (BSP)
 extern physaddr_t lapicaddr;        // Physical MMIO address of the local APIC
@@ -42,5 +51,6 @@ void lapic_init(void);
 void lapic_startap(uint8_t apicid, uint32_t addr);
 void lapic_eoi(void);
 void lapic_ipi(int vector);
+void lapic_ipi_cpu(uint8_t apicid, int vector);
 
 #endif
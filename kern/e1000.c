@@ -1,16 +1,15 @@
 #include <inc/string.h>
 #include <inc/error.h>
+#include <inc/e1000.h>
 #include <kern/env.h>
 #include <kern/e1000.h>
+#include <kern/netdev.h>
 #include <kern/pmap.h>
 #include <kern/picirq.h>
 #include <kern/sched.h>
 
 typedef uint32_t reg_t;
 
-#define TX_DESC_COUNT 16
-#define RX_DESC_COUNT 128
-
 // calculates the number of unused registers,
 // between two byte offsets
 #define UNUSED_BETWEEN(REG1, REG2) ((REG2 - REG1 - sizeof(reg_t)) / sizeof(reg_t))
@@ -20,32 +19,6 @@ typedef uint32_t reg_t;
 #define ADD_REG(name, offset, next) reg_t name; \
     reg_t _unused_after_##name[UNUSED_BETWEEN(offset, next)];
 
-#define E1000_CTRL      0x00000
-#define E1000_STATUS    0x00008
-#define E1000_EERD      0x00014
-#define E1000_ICR       0x000C0
-#define E1000_ICS       0x000C8
-#define E1000_IMS       0x000D0
-#define E1000_IMC       0x000D8
-#define E1000_RCTL      0x00100
-#define E1000_TCTL      0x00400
-#define E1000_TIPG      0x00410
-#define E1000_RDBAL     0x02800
-#define E1000_RDBAH     0x02804
-#define E1000_RDLEN     0x02808
-#define E1000_RDH       0x02810
-#define E1000_RDT       0x02818
-#define E1000_RSRPD     0x02C00
-#define E1000_TDBAL     0x03800
-#define E1000_TDBAH     0x03804
-#define E1000_TDLEN     0x03808
-#define E1000_TDH       0x03810
-#define E1000_TDT       0x03818
-#define E1000_TIDV      0x03820
-#define E1000_MTA       0x05200
-#define E1000_RAL0      0x05400
-#define E1000_RAH0      0x05404
-
 // RCTL Register
 #define RCTL_EN             (1 << 1)   // Receiver Enable
 #define RCTL_BAM            (1 << 15)  // Broadcast Accept Mode
@@ -53,7 +26,6 @@ typedef uint32_t reg_t;
 #define RCTL_BSEX           (1 << 25)  // Buffer Size Extension
 #define RCTL_SECRC          (1 << 26)  // Strip Ethernet CRC
 
-
 // RCTL Register setup values
 #define RCTL_BSIZE       0
 
@@ -61,10 +33,6 @@ typedef uint32_t reg_t;
 #define RA_HIGH_MASK        0xFFFF     // Mask bits for high receive address
 #define RA_HIGH_AV          (1 << 31)  // Address Valid
 
-// Reception Status
-#define RX_STATUS_DD    1           // Descriptor Done
-#define RX_STATUS_EOP   (1 << 1)    // End of Packet
-
 // TCTL Register
 #define TCTL_EN         (1 << 1)    // Transmit Enable
 #define TCTL_PSP        (1 << 3)    // Pad Short Packets
@@ -94,21 +62,31 @@ typedef uint32_t reg_t;
 #define TIPG_IPGR1          (8 << TIPG_IPGR1_SHIFT)
 #define TIPG_IPGR2          (20 << TIPG_IPGR2_SHIFT)
 
-// Trasmission status
-#define TX_STATUS_DD        1           // Descriptor Done
-#define TX_STATUS_EC        (1 << 1)    // Excess Collisions
-#define TX_STATUS_LC        (1 << 2)    // Late Collision
-#define TX_STATUS_TU        (1 << 3)    // Transmit Underrun
-
-// Trasmission Command
-#define TX_CMD_EOP       1           // End Of Packet
-#define TX_CMD_IFCS      (1 << 1)    // Insert FCS
-#define TX_CMD_IC        (1 << 2)    // Insert Checksum
-#define TX_CMD_RS        (1 << 3)    // Report Status
-#define TX_CMD_RSV       (1 << 4)    // Report Packet Sent
-#define TX_CMD_DEXT      (1 << 5)    // Extension (0 for legacy mode)
-#define TX_CMD_VLE       (1 << 6)    // VLAN Packet Enable
-#define TX_CMD_IDE       (1 << 7)    // Interrupt Delay Enable
+// Extended Transmission Command, shared by context and data descriptors
+// (TUCMD and DCMD respectively), shifted into place by the descriptor setup
+#define TX_XCMD_EOP      1           // End Of Packet (data only)
+#define TX_XCMD_IFCS     (1 << 1)    // Insert FCS (data only)
+#define TX_XCMD_TCP      1           // Packet is TCP (context only)
+#define TX_XCMD_IP       (1 << 1)    // Packet is IPv4 (context only)
+#define TX_XCMD_TSE      (1 << 2)    // TCP Segmentation Enable
+#define TX_XCMD_RS       (1 << 3)    // Report Status
+#define TX_XCMD_DEXT     (1 << 5)    // Extension (1 for context and data)
+#define TX_XCMD_IDE      (1 << 7)    // Interrupt Delay Enable
+#define TX_XCMD_SHIFT    24
+#define TX_DTYP_CONTEXT  (0 << 20)
+#define TX_DTYP_DATA     (1 << 20)
+#define TX_LEN_MASK      0xFFFFF     // PAYLEN / DTALEN are 20 bits wide
+
+// Data descriptor packet options
+#define TX_POPTS_IXSM    1           // Insert IP Checksum
+#define TX_POPTS_TXSM    (1 << 1)    // Insert TCP/UDP Checksum
+
+// Header sizes used to fill in the TSO context
+#define ETH_HDR_LEN      14
+#define ETH_TYPE_IP      0x0800
+#define IP_PROTO_TCP     6
+#define IP_CHKSUM_OFF    10
+#define TCP_CHKSUM_OFF   16
 
 // Interrupt Mask
 #define INT_TXDW        1           // Transmit Descriptor Written Back
@@ -187,195 +165,404 @@ struct e1000_regs {
     ADD_REG(rah0, E1000_RAH0, E1000_RAH0 + sizeof(reg_t))
 } __attribute__ ((packed));
 
-struct tx_desc
+// TCP/IP context descriptor, describes the headers of the packet
+// the following data descriptors belong to.
+// overlays a struct tx_desc in the transmission ring.
+struct tx_ctx_desc
 {
-        uint64_t addr;
-        uint16_t length;
-        uint8_t cso;
-        uint8_t cmd;
+        uint8_t ipcss;
+        uint8_t ipcso;
+        uint16_t ipcse;
+        uint8_t tucss;
+        uint8_t tucso;
+        uint16_t tucse;
+        uint32_t cmd_and_length;
         uint8_t status;
-        uint8_t css;
-        uint16_t special;
+        uint8_t hdr_len;
+        uint16_t mss;
 } __attribute__ ((packed));
 
-struct rx_desc
+// TCP/IP data descriptor, the extended version of struct tx_desc
+struct tx_data_desc
 {
         uint64_t addr;
-        uint16_t length;
-        uint16_t packet_checksum;
+        uint32_t cmd_and_length;
         uint8_t status;
-        uint8_t errors;
+        uint8_t popts;
         uint16_t special;
 } __attribute__ ((packed));
 
-volatile struct e1000_regs *e1000_reg_mem;
-int irq_line;
-
-struct tx_desc tx_desc_list[TX_DESC_COUNT];
-struct PageInfo *tx_pages[TX_DESC_COUNT] = {};
-
-struct rx_desc rx_desc_list[RX_DESC_COUNT];
-struct PageInfo *rx_pages[RX_DESC_COUNT];
-
-uint16_t read_eeprom(uint8_t addr) {
-    e1000_reg_mem->eerd = EERD_START | (addr << EERD_ADDR_SHIFT);
+// most e1000 cards driven at once
+#define E1000_MAX NETDEV_MAX
+
+// driver state of a single card
+struct e1000 {
+    volatile struct e1000_regs *regs;
+    physaddr_t reg_pa;
+    size_t reg_size;
+    int irq_line;
+
+    // env driving the card itself, see e1000_bypass. 0 if the kernel drives it
+    envid_t bypass_envid;
+    // where the card is mapped in that env
+    uintptr_t bypass_va;
+
+    struct tx_desc tx_desc_list[TX_DESC_COUNT] __attribute__ ((aligned (16)));
+    struct PageInfo *tx_pages[TX_DESC_COUNT];
+
+    // set on the last descriptor of packets whose completion is reported
+    // back to the sender, see tx_reclaim
+    bool tx_tracked[TX_DESC_COUNT];
+    // next descriptor tx_reclaim checks, and the number of tracked packets
+    // it found completed since tx_take_completed was last called
+    size_t tx_clean;
+    size_t tx_completed;
+
+    struct rx_desc rx_desc_list[RX_DESC_COUNT] __attribute__ ((aligned (16)));
+    struct PageInfo *rx_pages[RX_DESC_COUNT];
+
+    // rings and buffers given to the bypass env, held until the card is
+    // taken back from it, see e1000_release
+    struct PageInfo *bypass_pages[2 + TX_DESC_COUNT + RX_DESC_COUNT];
+    size_t bypass_npages;
+};
+
+static struct e1000 e1000s[E1000_MAX];
+static size_t e1000_count = 0;
+
+static uint16_t read_eeprom(struct e1000 *dev, uint8_t addr) {
+    dev->regs->eerd = EERD_START | (addr << EERD_ADDR_SHIFT);
     uint32_t result = 0;
-    while (!((result = e1000_reg_mem->eerd) & EERD_DONE));
+    while (!((result = dev->regs->eerd) & EERD_DONE));
     return (result >> EERD_DATA_SHIFT) & EERD_DATA_MASK;
 }
 
-void read_mac_address(uint32_t *addr_low, uint32_t *addr_high) {
-    *addr_low = read_eeprom(0);
-    *addr_low |= read_eeprom(1) << 16;
-    *addr_high = read_eeprom(2);
+static void read_mac_address(struct e1000 *dev, uint32_t *addr_low, uint32_t *addr_high) {
+    *addr_low = read_eeprom(dev, 0);
+    *addr_low |= read_eeprom(dev, 1) << 16;
+    *addr_high = read_eeprom(dev, 2);
 }
 
-void setup_transmission() {
+static void setup_transmission(struct e1000 *dev) {
     // setup transmission ring buffer
-    e1000_reg_mem->tdbal = (reg_t)va2pa(kern_pgdir, tx_desc_list);
-    e1000_reg_mem->tdbah = 0;
-    e1000_reg_mem->tdlen = TX_DESC_COUNT * sizeof(struct tx_desc);
-    e1000_reg_mem->tdh = 0;
-    e1000_reg_mem->tdt = 0;
+    dev->regs->tdbal = (reg_t)va2pa(kern_pgdir, dev->tx_desc_list);
+    dev->regs->tdbah = 0;
+    dev->regs->tdlen = TX_DESC_COUNT * sizeof(struct tx_desc);
+    dev->regs->tdh = 0;
+    dev->regs->tdt = 0;
 
     // setup transmission settings
-    e1000_reg_mem->tctl |= TCTL_EN;
-    e1000_reg_mem->tctl |= TCTL_PSP;
-    e1000_reg_mem->tctl |= TCTL_CT;
-    e1000_reg_mem->tctl |= TCTL_COLD;
+    dev->regs->tctl |= TCTL_EN;
+    dev->regs->tctl |= TCTL_PSP;
+    dev->regs->tctl |= TCTL_CT;
+    dev->regs->tctl |= TCTL_COLD;
 
     // setup transmission IPG time
-    e1000_reg_mem->tipg |= TIPG_IPGT;
-    e1000_reg_mem->tipg |= TIPG_IPGR1;
-    e1000_reg_mem->tipg |= TIPG_IPGR2;
+    dev->regs->tipg |= TIPG_IPGT;
+    dev->regs->tipg |= TIPG_IPGR1;
+    dev->regs->tipg |= TIPG_IPGR2;
 
     // setup transmission interrupt timer
-    e1000_reg_mem->tidv = 10;
+    dev->regs->tidv = 10;
 
     int i;
     // mark transmission descriptors as available
     for (i=0; i < TX_DESC_COUNT; i++) {
-        tx_desc_list[i].status = TX_STATUS_DD;
-        tx_desc_list[i].addr = 0;
-        tx_desc_list[i].cmd = 0;
+        dev->tx_desc_list[i].status = TX_STATUS_DD;
+        dev->tx_desc_list[i].addr = 0;
+        dev->tx_desc_list[i].cmd = 0;
     }
 }
 
-void setup_reception() {
+static void setup_reception(struct e1000 *dev) {
     // setup receive MAC address
     uint32_t mac_low = 0;
     uint32_t mac_high = 0;
-    read_mac_address(&mac_low, &mac_high);
-    e1000_reg_mem->ral0 = mac_low;
-    e1000_reg_mem->rah0 &= ~RA_HIGH_MASK;
-    e1000_reg_mem->rah0 |= RA_HIGH_MASK & mac_high;
-    e1000_reg_mem->rah0 |= RA_HIGH_AV;
+    read_mac_address(dev, &mac_low, &mac_high);
+    dev->regs->ral0 = mac_low;
+    dev->regs->rah0 &= ~RA_HIGH_MASK;
+    dev->regs->rah0 |= RA_HIGH_MASK & mac_high;
+    dev->regs->rah0 |= RA_HIGH_AV;
 
     // setup Multicast Table Array
-    e1000_reg_mem->mta = 0;
+    dev->regs->mta = 0;
 
      
     // setup Interrupt Mask Set/Read to enable interrupts
-    e1000_reg_mem->ims |= ICR_RXT0;
+    dev->regs->ims |= ICR_RXT0;
 
     // setup reception ring buffer
-    e1000_reg_mem->rdbal = (reg_t)va2pa(kern_pgdir, rx_desc_list);
-    e1000_reg_mem->rdbah = 0;
-    e1000_reg_mem->rdlen = RX_DESC_COUNT * sizeof(struct rx_desc);
-    e1000_reg_mem->rdh = 0;
-    e1000_reg_mem->rdt = RX_DESC_COUNT - 1;
+    dev->regs->rdbal = (reg_t)va2pa(kern_pgdir, dev->rx_desc_list);
+    dev->regs->rdbah = 0;
+    dev->regs->rdlen = RX_DESC_COUNT * sizeof(struct rx_desc);
+    dev->regs->rdh = 0;
+    dev->regs->rdt = RX_DESC_COUNT - 1;
 
     // preallocate pages for storing reception data
     int i;
     for (i = 0; i < RX_DESC_COUNT; i++) {
-        rx_pages[i] = page_alloc(ALLOC_ZERO);
-        if (rx_pages[i] == NULL) {
+        dev->rx_pages[i] = page_alloc(ALLOC_ZERO);
+        if (dev->rx_pages[i] == NULL) {
             panic("unable to allocate pages for network reception");
         }
-        rx_pages[i]->pp_ref += 1;
+        dev->rx_pages[i]->pp_ref += 1;
     }
 
     // initialize reception descriptors
     for (i=0; i < RX_DESC_COUNT; i++) {
         //write data after a place for length as in pkt DS
-        rx_desc_list[i].addr = (uint64_t)((page2pa(rx_pages[i]))+sizeof(int));
-        rx_desc_list[i].length = 0;
-        rx_desc_list[i].status = 0;
-        rx_desc_list[i].errors = 0;
+        dev->rx_desc_list[i].addr = (uint64_t)((page2pa(dev->rx_pages[i]))+sizeof(int));
+        dev->rx_desc_list[i].length = 0;
+        dev->rx_desc_list[i].status = 0;
+        dev->rx_desc_list[i].errors = 0;
     }
 
     // setup reception settings
-    e1000_reg_mem->rctl |= RCTL_EN;
-    e1000_reg_mem->rctl |= RCTL_BAM;
+    dev->regs->rctl |= RCTL_EN;
+    dev->regs->rctl |= RCTL_BAM;
     // strip ethernet CRC
-    e1000_reg_mem->rctl |= RCTL_SECRC;
+    dev->regs->rctl |= RCTL_SECRC;
 }
 
-// LAB 6: Your driver code here
-int e1000_attach(struct pci_func *pcif) {
-    pci_func_enable(pcif);
-
-    // map network card registores to memory
-    e1000_reg_mem = mmio_map_region(pcif->reg_base[0], pcif->reg_size[0]);
+// holds the user page containing addr in the given transmission slot,
+// until the slot gets reused.
+// passing a NULL addr only releases the page previously held by the slot.
+// returns the physical address matching addr.
+static physaddr_t hold_tx_page(struct e1000 *dev, size_t index, void *addr) {
+    // replace existing page in the current slot with the new one
+    if (dev->tx_pages[index] != NULL) {
+        // ensure the page gets recycpled if every env unmapped it
+        page_decref(dev->tx_pages[index]);
+        dev->tx_pages[index] = NULL;
+    }
+    if (addr == NULL) {
+        return 0;
+    }
+    dev->tx_pages[index] = page_lookup(curenv->env_pgdir, addr, NULL);
+    // ensure page doesn't get recycled when unmapped in userspace
+    dev->tx_pages[index]->pp_ref += 1;
 
-    setup_transmission();
-    setup_reception();
+    // read the packet starting from the correct offset into the page
+    size_t offset = addr - ROUNDDOWN(addr, PGSIZE);
+    return page2pa(dev->tx_pages[index]) + offset;
+}
 
-    // setup interrupts
-    irq_setmask_8259A(irq_mask_8259A & ~(1 << pcif->irq_line));
-    int i = e1000_reg_mem->icr;
-    e1000_reg_mem->ims |= INT_TXDW;
+// walks over the descriptors the card is done with,
+// counting the tracked packets among them.
+// must run before any descriptor is reused, so none is missed.
+static void tx_reclaim(struct e1000 *dev) {
+    size_t tail = dev->regs->tdt;
+    while (dev->tx_clean != tail && (dev->tx_desc_list[dev->tx_clean].status & TX_STATUS_DD)) {
+        if (dev->tx_tracked[dev->tx_clean]) {
+            dev->tx_tracked[dev->tx_clean] = false;
+            dev->tx_completed++;
+        }
+        dev->tx_clean = (dev->tx_clean + 1) % TX_DESC_COUNT;
+    }
+}
 
-    irq_line = pcif->irq_line;
+// returns the number of tracked packets the card finished sending
+// since the last call.
+static size_t tx_take_completed(void *arg) {
+    struct e1000 *dev = arg;
+    tx_reclaim(dev);
+    size_t completed = dev->tx_completed;
+    dev->tx_completed = 0;
+    return completed;
+}
 
+// checks whether the count descriptors starting at the tail are free,
+// if not the env is put to sleep untill the card frees some.
+static bool tx_ring_has_room(struct e1000 *dev, size_t count) {
+    size_t i;
+    size_t tail = dev->regs->tdt;
+    tx_reclaim(dev);
+    for (i = 0; i < count; i++) {
+        if (!(dev->tx_desc_list[(tail + i) % TX_DESC_COUNT].status & TX_STATUS_DD)) {
+            curenv->env_waits_for_output = true;
+            curenv->env_status = ENV_WAITING_FOR_IO;
+            return false;
+        }
+    }
     return true;
 }
 
 // takes an address to the packet data, and transmits it over the network.
-// returns 0 on success, -E__NO_MEM if the transmit queue is full.
-int transmit_packet(void *addr, size_t length, bool isEOP) {
-    size_t cur_index = e1000_reg_mem->tdt;
-    struct tx_desc *tail = &tx_desc_list[cur_index];
-    if (tail->status & TX_STATUS_DD) {
-
-        // replace existing page in the current slot with the new one
-        if (tx_pages[cur_index] != NULL) {
-            // ensure the page gets recycpled if every env unmapped it
-            page_decref(tx_pages[cur_index]);
-        }
-        tx_pages[cur_index] = page_lookup(curenv->env_pgdir, addr, NULL);
-        // ensure page doesn't get recycled when unmapped in userspace
-        tx_pages[cur_index]->pp_ref += 1;
-
-        // read the packet starting from the correct offset into the page
-        size_t offset = addr - ROUNDDOWN(addr, PGSIZE);
+// returns 0 on success, -E_RX_FULL if the transmit queue is full.
+static int transmit_packet(struct e1000 *dev, void *addr, size_t length, bool isEOP) {
+    if (dev->bypass_envid != 0) {
+        return -E_INVAL;
+    }
+    size_t cur_index = dev->regs->tdt;
+    struct tx_desc *tail = &dev->tx_desc_list[cur_index];
+    if (tx_ring_has_room(dev, 1)) {
+        physaddr_t pa = hold_tx_page(dev, cur_index, addr);
 
-        tail->cmd |= TX_CMD_RS;
+        tail->cmd = TX_CMD_RS;
         if (isEOP){
             tail->cmd |= TX_CMD_EOP;
         }
         tail->cmd |= TX_CMD_IDE;
+        // the slot may have last held an extended descriptor
+        tail->cso = 0;
+        tail->css = 0;
+        tail->special = 0;
         tail->status = 0;
-        tail->addr = (uint64_t)(page2pa(tx_pages[cur_index]) + offset);
+        tail->addr = (uint64_t)pa;
         tail->length = (uint16_t)length;
-        e1000_reg_mem->tdt = (cur_index + 1) % TX_DESC_COUNT;
+        dev->regs->tdt = (cur_index + 1) % TX_DESC_COUNT;
         return 0;
     } else {
-        curenv->env_waits_for_output = true;
-        curenv->env_status = ENV_WAITING_FOR_IO;
         return -E_RX_FULL;
     }
 }
 
+// fills in a context descriptor at index, for the TCP/IPv4 segment of the
+// given length whose headers are at the start of the frame.
+// returns 0 on success, -E_INVAL if the frame isn't a TCP/IPv4 segment.
+static int setup_tso_context(struct e1000 *dev, size_t index, uint8_t *frame, size_t hdr_avail,
+                             size_t length, uint16_t mss) {
+    if (hdr_avail < ETH_HDR_LEN + 20 + 20 || mss == 0) {
+        return -E_INVAL;
+    }
+    if (((frame[12] << 8) | frame[13]) != ETH_TYPE_IP) {
+        return -E_INVAL;
+    }
+    uint8_t *ip = frame + ETH_HDR_LEN;
+    size_t ip_len = (ip[0] & 0xF) * 4;
+    if ((ip[0] >> 4) != 4 || ip_len < 20 || ip[9] != IP_PROTO_TCP) {
+        return -E_INVAL;
+    }
+    if (hdr_avail < ETH_HDR_LEN + ip_len + 20) {
+        return -E_INVAL;
+    }
+    uint8_t *tcp = ip + ip_len;
+    size_t hdr_len = ETH_HDR_LEN + ip_len + (tcp[12] >> 4) * 4;
+    if (hdr_len > hdr_avail || hdr_len > 0xFF || length - hdr_len > TX_LEN_MASK) {
+        return -E_INVAL;
+    }
+
+    struct tx_ctx_desc *ctx = (struct tx_ctx_desc *)&dev->tx_desc_list[index];
+    hold_tx_page(dev, index, NULL);
+    ctx->ipcss = ETH_HDR_LEN;
+    ctx->ipcso = ETH_HDR_LEN + IP_CHKSUM_OFF;
+    ctx->ipcse = ETH_HDR_LEN + ip_len - 1;
+    ctx->tucss = ETH_HDR_LEN + ip_len;
+    ctx->tucso = ETH_HDR_LEN + ip_len + TCP_CHKSUM_OFF;
+    // checksum the TCP segment up to the end of the packet
+    ctx->tucse = 0;
+    ctx->cmd_and_length = (length - hdr_len) | TX_DTYP_CONTEXT |
+        ((TX_XCMD_TCP | TX_XCMD_IP | TX_XCMD_TSE | TX_XCMD_RS |
+          TX_XCMD_DEXT | TX_XCMD_IDE) << TX_XCMD_SHIFT);
+    ctx->status = 0;
+    ctx->hdr_len = hdr_len;
+    ctx->mss = mss;
+    return 0;
+}
+
+// transmits a single packet gathered from the nsg buffers in sg,
+// using a descriptor for each page the buffers touch, so the buffers
+// may span multiple pages.
+// if mss is non zero, the packet must be an ethernet frame holding a
+// TCP/IPv4 segment whose headers are all in the first buffer, and the
+// card cuts it into frames of at most mss bytes of payload, computing
+// the IP and TCP checksums of each. the IP checksum must then be zero,
+// and the TCP checksum hold the sum of the pseudo header without the
+// length, as the card adds the rest.
+// if track is set, the completion of the packet is counted by
+// tx_take_completed.
+// returns 0 on success, -E_RX_FULL if the transmit queue is full,
+// -E_INVAL if the packet is malformed or uses too many descriptors.
+static int transmit_sg(void *arg, const struct jif_sg *sg, size_t nsg,
+                       uint16_t mss, bool track) {
+    struct e1000 *dev = arg;
+    size_t i;
+    size_t length = 0;
+    size_t desc_count = mss ? 1 : 0;
+    if (dev->bypass_envid != 0) {
+        return -E_INVAL;
+    }
+    for (i = 0; i < nsg; i++) {
+        uintptr_t start = (uintptr_t)sg[i].sg_addr;
+        uintptr_t end = start + sg[i].sg_len;
+        if (sg[i].sg_len == 0) {
+            continue;
+        }
+        desc_count += (ROUNDUP(end, PGSIZE) - ROUNDDOWN(start, PGSIZE)) / PGSIZE;
+        length += sg[i].sg_len;
+    }
+    if (desc_count == 0 || desc_count > TX_DESC_COUNT - 1) {
+        return -E_INVAL;
+    }
+    if (!tx_ring_has_room(dev, desc_count)) {
+        return -E_RX_FULL;
+    }
+
+    size_t cur_index = dev->regs->tdt;
+    if (mss) {
+        int r = setup_tso_context(dev, cur_index, sg[0].sg_addr, sg[0].sg_len,
+                                  length, mss);
+        if (r < 0) {
+            return r;
+        }
+        cur_index = (cur_index + 1) % TX_DESC_COUNT;
+    }
+
+    size_t last_index = cur_index;
+    for (i = 0; i < nsg; i++) {
+        uintptr_t va = (uintptr_t)sg[i].sg_addr;
+        uintptr_t end = va + sg[i].sg_len;
+        while (va < end) {
+            size_t chunk = MIN(end, ROUNDDOWN(va, PGSIZE) + PGSIZE) - va;
+            physaddr_t pa = hold_tx_page(dev, cur_index, (void *)va);
+            if (mss) {
+                struct tx_data_desc *data =
+                    (struct tx_data_desc *)&dev->tx_desc_list[cur_index];
+                data->addr = (uint64_t)pa;
+                data->cmd_and_length = chunk | TX_DTYP_DATA |
+                    ((TX_XCMD_IFCS | TX_XCMD_TSE | TX_XCMD_RS |
+                      TX_XCMD_DEXT | TX_XCMD_IDE) << TX_XCMD_SHIFT);
+                data->status = 0;
+                data->popts = TX_POPTS_IXSM | TX_POPTS_TXSM;
+                data->special = 0;
+            } else {
+                struct tx_desc *data = &dev->tx_desc_list[cur_index];
+                data->addr = (uint64_t)pa;
+                data->length = (uint16_t)chunk;
+                data->cso = 0;
+                data->cmd = TX_CMD_RS | TX_CMD_IDE;
+                data->status = 0;
+                data->css = 0;
+                data->special = 0;
+            }
+            last_index = cur_index;
+            cur_index = (cur_index + 1) % TX_DESC_COUNT;
+            va += chunk;
+        }
+    }
+
+    // EOP sits in the same bit for both descriptor formats
+    dev->tx_desc_list[last_index].cmd |= TX_CMD_EOP;
+    dev->tx_tracked[last_index] = track;
+
+    // hand all the descriptors to the card at once
+    dev->regs->tdt = cur_index;
+    return 0;
+}
+
 // takes an address to copy the received data to.
 // receives over the network the next packet and copies it to the addr.
 // updates pkt_size to the size received if pkt_size != NULL.
 // returns 0 on success, -E_RX_EMPTY if there is no packet is available.
 // returns -E_NO_MEM on allocation failure
-int receive_packet(void *addr) {
+static int receive_packet(void *arg, void *addr) {
+    struct e1000 *dev = arg;
     int r;
-    size_t cur_index = (e1000_reg_mem->rdt + 1) % RX_DESC_COUNT;
-    struct rx_desc *tail = &rx_desc_list[cur_index];
+    if (dev->bypass_envid != 0) {
+        return -E_INVAL;
+    }
+    size_t cur_index = (dev->regs->rdt + 1) % RX_DESC_COUNT;
+    struct rx_desc *tail = &dev->rx_desc_list[cur_index];
 
     if (!(tail->status & RX_STATUS_DD)) {
         // no packets to receive
@@ -387,7 +574,7 @@ int receive_packet(void *addr) {
 
     // there is a packet to receive
     // write length to the beggining of page
-    int *pkt_size = (int *)page2kva(rx_pages[cur_index]);
+    int *pkt_size = (int *)page2kva(dev->rx_pages[cur_index]);
     *pkt_size = (int)tail->length;
 
     // allocate new page instead the one received
@@ -397,42 +584,219 @@ int receive_packet(void *addr) {
     }
 
     //map physical page to user space at supplied addr
-    //TODO: maybe write also?
-    if ((r = page_insert(curenv->env_pgdir, rx_pages[cur_index], addr,
-                         PTE_U | PTE_P) < 0)) {
+    //writable, so the network stack can parse the packet in place
+    if ((r = page_insert(curenv->env_pgdir, dev->rx_pages[cur_index], addr,
+                         PTE_U | PTE_P | PTE_W) < 0)) {
         return -E_NO_MEM;
     }
 
     // decrease ref so when user unmaps it, page is recycled
-    page_decref(rx_pages[cur_index]);
+    page_decref(dev->rx_pages[cur_index]);
 
-    rx_pages[cur_index] = replacement_page;
+    dev->rx_pages[cur_index] = replacement_page;
 
     // update new address
-    tail->addr = (uint64_t)((page2pa(rx_pages[cur_index])) + sizeof(int));
-    rx_pages[cur_index]->pp_ref += 1;
+    tail->addr = (uint64_t)((page2pa(dev->rx_pages[cur_index])) + sizeof(int));
+    dev->rx_pages[cur_index]->pp_ref += 1;
     tail->status &= ~RX_STATUS_DD;
-    e1000_reg_mem->rdt = cur_index;
+    dev->regs->rdt = cur_index;
+    return 0;
+}
+
+// allocates a page for the card to DMA to or from, and maps it in env at va.
+// the page is held by the card as well, so it outlives env until the card
+// is taken back, see bypass_put_pages.
+// returns the physical address of the page, or 0 on allocation failure.
+static physaddr_t bypass_page(struct e1000 *dev, struct Env *env, void *va) {
+    struct PageInfo *page = page_alloc(ALLOC_ZERO);
+    if (page == NULL) {
+        return 0;
+    }
+    page->pp_ref += 1;
+    if (page_insert(env->env_pgdir, page, va, PTE_P | PTE_U | PTE_W) < 0) {
+        page_decref(page);
+        return 0;
+    }
+    dev->bypass_pages[dev->bypass_npages++] = page;
+    return page2pa(page);
+}
+
+// releases the pages bypass_page gave out. the card must not use them anymore.
+static void bypass_put_pages(struct e1000 *dev) {
+    while (dev->bypass_npages > 0) {
+        page_decref(dev->bypass_pages[--dev->bypass_npages]);
+    }
+}
+
+// unmaps the registers of the card from env, mapped at base
+static void bypass_unmap_regs(struct e1000 *dev, struct Env *env, uintptr_t base) {
+    size_t i;
+    for (i = 0; i < ROUNDUP(dev->reg_size, PGSIZE); i += PGSIZE) {
+        page_remove(env->env_pgdir, (void *)(base + E1000_MAP_REGS + i));
+    }
+}
+
+// undoes a partly done e1000_bypass: unmaps the registers from env,
+// and releases the pages given to it, which env keeps until it unmaps them.
+// returns -E_NO_MEM, the reason the handing over failed.
+static int bypass_fail(struct e1000 *dev, struct Env *env, uintptr_t base) {
+    bypass_unmap_regs(dev, env, base);
+    bypass_put_pages(dev);
+    return -E_NO_MEM;
+}
+
+// hands the card over to env, which drives it from userspace.
+// maps the registers, new transmission and reception rings, and a buffer
+// for each descriptor at va, as laid out in inc/e1000.h, and points the card
+// at the new rings. interrupts of the card are then delivered to env
+// as NSREQ_INTERRUPT notifications.
+// the kernel transmission and reception functions can't be used afterwards.
+// returns 0 on success, -E_INVAL if the card was already handed over,
+// the mapping doesn't fit, or env already has pages where the registers go,
+// -E_NO_MEM on allocation failure.
+static int e1000_bypass(void *arg, struct Env *env, void *va) {
+    struct e1000 *dev = arg;
+    size_t i;
+    uintptr_t base = (uintptr_t)va;
+    if (dev->bypass_envid != 0 || dev->regs == NULL) {
+        return -E_INVAL;
+    }
+    if (base % PGSIZE != 0 || base + E1000_MAP_SIZE > UTOP || base + E1000_MAP_SIZE < base
+        || dev->reg_size > E1000_MAP_REGS_SIZE) {
+        return -E_INVAL;
+    }
+
+    // the registers are written straight into the page table, as they have
+    // no PageInfo, so they can't replace whatever env has mapped there
+    for (i = 0; i < ROUNDUP(dev->reg_size, PGSIZE); i += PGSIZE) {
+        pte_t *pte = pgdir_walk(env->env_pgdir, (void *)(base + E1000_MAP_REGS + i), false);
+        if (pte != NULL && (*pte & PTE_P)) {
+            return -E_INVAL;
+        }
+    }
+
+    // map the registers uncached, like mmio_map_region does
+    for (i = 0; i < ROUNDUP(dev->reg_size, PGSIZE); i += PGSIZE) {
+        void *reg_va = (void *)(base + E1000_MAP_REGS + i);
+        pte_t *pte = pgdir_walk(env->env_pgdir, reg_va, true);
+        if (pte == NULL) {
+            return bypass_fail(dev, env, base);
+        }
+        *pte = (dev->reg_pa + i) | PTE_P | PTE_U | PTE_W | PTE_PCD | PTE_PWT;
+        tlb_invalidate(env->env_pgdir, reg_va);
+    }
+
+    physaddr_t tx_ring = bypass_page(dev, env, (void *)(base + E1000_MAP_TX_RING));
+    physaddr_t rx_ring = bypass_page(dev, env, (void *)(base + E1000_MAP_RX_RING));
+    if (tx_ring == 0 || rx_ring == 0) {
+        return bypass_fail(dev, env, base);
+    }
+    struct tx_desc *tx = KADDR(tx_ring);
+    struct rx_desc *rx = KADDR(rx_ring);
+    for (i = 0; i < TX_DESC_COUNT; i++) {
+        physaddr_t buf = bypass_page(dev, env, (void *)(base + E1000_MAP_TX_BUF(i)));
+        if (buf == 0) {
+            return bypass_fail(dev, env, base);
+        }
+        tx[i].addr = buf;
+        tx[i].status = TX_STATUS_DD;
+    }
+    for (i = 0; i < RX_DESC_COUNT; i++) {
+        physaddr_t buf = bypass_page(dev, env, (void *)(base + E1000_MAP_RX_BUF(i)));
+        if (buf == 0) {
+            return bypass_fail(dev, env, base);
+        }
+        rx[i].addr = buf;
+    }
+
+    // switch the card over to the new rings
+    dev->regs->tctl &= ~TCTL_EN;
+    dev->regs->rctl &= ~RCTL_EN;
+    dev->regs->tdbal = tx_ring;
+    dev->regs->tdbah = 0;
+    dev->regs->tdh = 0;
+    dev->regs->tdt = 0;
+    dev->regs->rdbal = rx_ring;
+    dev->regs->rdbah = 0;
+    dev->regs->rdh = 0;
+    dev->regs->rdt = RX_DESC_COUNT - 1;
+    dev->regs->rctl |= RCTL_EN;
+    dev->regs->tctl |= TCTL_EN;
+
+    dev->bypass_envid = env->env_id;
+    dev->bypass_va = base;
     return 0;
 }
 
+// takes the card back from env, which is being freed, if env drives it.
+// points the card at the kernel's rings again, emptied, so the kernel
+// transmission and reception functions work as before the handing over.
+static void e1000_release(void *arg, struct Env *env) {
+    struct e1000 *dev = arg;
+    size_t i;
+    if (dev->bypass_envid == 0 || dev->bypass_envid != env->env_id) {
+        return;
+    }
+
+    // threads of env may outlive it, but must not reach the card anymore
+    bypass_unmap_regs(dev, env, dev->bypass_va);
+
+    dev->regs->tctl &= ~TCTL_EN;
+    dev->regs->rctl &= ~RCTL_EN;
+    for (i = 0; i < TX_DESC_COUNT; i++) {
+        hold_tx_page(dev, i, NULL);
+        dev->tx_tracked[i] = false;
+        dev->tx_desc_list[i].status = TX_STATUS_DD;
+    }
+    dev->tx_clean = 0;
+    dev->tx_completed = 0;
+    for (i = 0; i < RX_DESC_COUNT; i++) {
+        dev->rx_desc_list[i].status = 0;
+    }
+    dev->regs->tdbal = (reg_t)va2pa(kern_pgdir, dev->tx_desc_list);
+    dev->regs->tdbah = 0;
+    dev->regs->tdh = 0;
+    dev->regs->tdt = 0;
+    dev->regs->rdbal = (reg_t)va2pa(kern_pgdir, dev->rx_desc_list);
+    dev->regs->rdbah = 0;
+    dev->regs->rdh = 0;
+    dev->regs->rdt = RX_DESC_COUNT - 1;
+    // env may have masked the interrupts the kernel relies on
+    dev->regs->ims |= ICR_RXT0 | INT_TXDW;
+    dev->regs->rctl |= RCTL_EN;
+    dev->regs->tctl |= TCTL_EN;
+
+    // the card is done with env's rings and buffers
+    bypass_put_pages(dev);
+    dev->bypass_envid = 0;
+}
+
 // handles a trap originatng from the e1000 network card
 // ignores other types of traps
 // returns true if the trap was handled
-bool e1000_handler(int trapno) {
+static bool e1000_handler(void *arg, int trapno) {
+    struct e1000 *dev = arg;
     int i;
-    if (trapno != IRQ_OFFSET + irq_line) {
+    if (trapno != IRQ_OFFSET + dev->irq_line) {
         return false;
     }
 
-    reg_t cause = e1000_reg_mem->icr;
+    reg_t cause = dev->regs->icr;
+
+    if (dev->bypass_envid != 0) {
+        struct Env *env;
+        if (envid2env(dev->bypass_envid, &env, false) == 0) {
+            env_notify(env, NSREQ_INTERRUPT);
+        }
+        return true;
+    }
 
     if (cause & ICR_RXT0){
         for (i = 0; i < NENV; i++) {
             struct Env *env = &envs[i];
             if (env->env_status == ENV_WAITING_FOR_IO && env->env_waits_for_input) {
                 env->env_waits_for_input = false;
-                env->env_status = ENV_RUNNABLE;
+                sched_wakeup(env);
             }
         }
     }
@@ -442,10 +806,60 @@ bool e1000_handler(int trapno) {
             struct Env *env = &envs[i];
             if (env->env_status == ENV_WAITING_FOR_IO && env->env_waits_for_output) {
                 env->env_waits_for_output = false;
-                env->env_status = ENV_RUNNABLE;
+                sched_wakeup(env);
             }
         }
     }
     
     return true;
-}
\ No newline at end of file
+}
+
+// the card is told of every packet by moving its tail, more is ignored
+static int e1000_transmit(void *arg, void *addr, size_t length, bool more) {
+    return transmit_packet(arg, addr, length, true);
+}
+
+static void e1000_read_mac(void *arg, uint8_t *mac) {
+    uint32_t mac_words[2];
+    read_mac_address(arg, &mac_words[0], &mac_words[1]);
+    memcpy(mac, mac_words, 6);
+}
+
+static const struct netdev_ops e1000_ops = {
+    .nd_name = "e1000",
+    .nd_transmit = e1000_transmit,
+    .nd_transmit_sg = transmit_sg,
+    .nd_take_completed = tx_take_completed,
+    .nd_receive = receive_packet,
+    .nd_read_mac = e1000_read_mac,
+    .nd_bypass = e1000_bypass,
+    .nd_release = e1000_release,
+    .nd_handler = e1000_handler,
+};
+
+// LAB 6: Your driver code here
+int e1000_attach(struct pci_func *pcif) {
+    if (e1000_count == E1000_MAX) {
+        return 0;
+    }
+    struct e1000 *dev = &e1000s[e1000_count++];
+    pci_func_enable(pcif);
+
+    // map network card registores to memory
+    dev->regs = mmio_map_region(pcif->reg_base[0], pcif->reg_size[0]);
+    dev->reg_pa = pcif->reg_base[0];
+    dev->reg_size = pcif->reg_size[0];
+
+    setup_transmission(dev);
+    setup_reception(dev);
+
+    // setup interrupts
+    irq_enable(pcif->irq_line);
+    int i = dev->regs->icr;
+    dev->regs->ims |= INT_TXDW;
+
+    dev->irq_line = pcif->irq_line;
+
+    netdev_register(dev, &e1000_ops);
+    return true;
+}
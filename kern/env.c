@@ -14,6 +14,10 @@
 #include <kern/sched.h>
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
+#include <kern/futex.h>
+#include <kern/trace.h>
+#include <kern/boottime.h>
+#include <kern/netdev.h>
 
 struct Env *envs = NULL;		// All environments
 static struct Env *env_free_list;	// Free environment list
@@ -203,6 +207,9 @@ env_setup_vm(struct Env *e)
 	return 0;
 }
 
+static int env_alloc_vm(struct Env **newenv_store, envid_t parent_id,
+			pde_t *pgdir);
+
 //
 // Allocates and initializes a new environment.
 // On success, the new environment is stored in *newenv_store.
@@ -213,6 +220,24 @@ env_setup_vm(struct Env *e)
 //
 int
 env_alloc(struct Env **newenv_store, envid_t parent_id)
+{
+	return env_alloc_vm(newenv_store, parent_id, NULL);
+}
+
+//
+// Like env_alloc, but the new environment is a thread that runs in the
+// address space 'pgdir' of an existing environment rather than in a
+// fresh one.  The page directory's pp_ref counts the environments
+// using it, so the address space lives until the last of them is freed.
+//
+int
+env_alloc_thread(struct Env **newenv_store, envid_t parent_id, pde_t *pgdir)
+{
+	return env_alloc_vm(newenv_store, parent_id, pgdir);
+}
+
+static int
+env_alloc_vm(struct Env **newenv_store, envid_t parent_id, pde_t *pgdir)
 {
 	int32_t generation;
 	int r;
@@ -221,8 +246,12 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 	if (!(e = env_free_list))
 		return -E_NO_FREE_ENV;
 
-	// Allocate and set up the page directory for this environment.
-	if ((r = env_setup_vm(e)) < 0)
+	// Allocate and set up the page directory for this environment,
+	// or share the given one.
+	if (pgdir) {
+		pa2page(PADDR(pgdir))->pp_ref++;
+		e->env_pgdir = pgdir;
+	} else if ((r = env_setup_vm(e)) < 0)
 		return r;
 
 	// Generate an env_id for this environment.
@@ -236,6 +265,7 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 	e->env_type = ENV_TYPE_USER;
 	e->env_status = ENV_RUNNABLE;
 	e->env_runs = 0;
+	memset(&e->env_stat, 0, sizeof(e->env_stat));
 
 	// Clear out all the saved register state,
 	// to prevent the register values
@@ -273,6 +303,23 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 
 	e->env_waits_for_output = false;
 
+	// no kernel notifications yet
+	e->env_notify_pending = false;
+
+	// exception stack at the usual place, no thread-local data
+	e->env_xstacktop = UXSTACKTOP;
+	e->env_tls = NULL;
+
+	// may run anywhere, and has no cache to go back to yet
+	e->env_affinity = ENV_AFFINITY_ALL;
+	e->env_pref_cpu = -1;
+	e->env_priority = e->env_level = ENV_PRIO_NORMAL;
+	e->env_slice_used = 0;
+
+	// not waiting on any futex
+	e->env_futex_addr = 0;
+	e->env_futex_link = NULL;
+
 	// commit the allocation
 	env_free_list = e->env_link;
 	*newenv_store = e;
@@ -428,6 +475,11 @@ env_create(uint8_t *binary, enum EnvType type)
 
     newEnv->env_type = type;
 
+    // servers, and the helpers they fork, go ahead of client work
+    if (type != ENV_TYPE_USER) {
+        newEnv->env_priority = newEnv->env_level = ENV_PRIO_HIGH;
+    }
+
 	// If this is the file server (type == ENV_TYPE_FS) give it I/O privileges.
 	// LAB 5: Your code here.
     if (type == ENV_TYPE_FS) {
@@ -451,30 +503,40 @@ env_free(struct Env *e)
 	if (e == curenv)
 		lcr3(PADDR(kern_pgdir));
 
+	// A waiter destroyed while blocked must leave its futex queue.
+	futex_cancel(e);
+
+	// A network card it drove goes back to the kernel.
+	netdev_env_free(e);
+
 	// Note the environment's demise.
 	// cprintf("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
 
-	// Flush all mapped pages in the user portion of the address space
+	// Flush all mapped pages in the user portion of the address space,
+	// unless other threads still run in it (see env_alloc_thread).
 	static_assert(UTOP % PTSIZE == 0);
-	for (pdeno = 0; pdeno < PDX(UTOP); pdeno++) {
-
-		// only look at mapped page tables
-		if (!(e->env_pgdir[pdeno] & PTE_P))
-			continue;
-
-		// find the pa and va of the page table
-		pa = PTE_ADDR(e->env_pgdir[pdeno]);
-		pt = (pte_t*) KADDR(pa);
-
-		// unmap all PTEs in this page table
-		for (pteno = 0; pteno <= PTX(~0); pteno++) {
-			if (pt[pteno] & PTE_P)
-				page_remove(e->env_pgdir, PGADDR(pdeno, pteno, 0));
+	if (pa2page(PADDR(e->env_pgdir))->pp_ref == 1) {
+		for (pdeno = 0; pdeno < PDX(UTOP); pdeno++) {
+
+			// only look at mapped page tables
+			if (!(e->env_pgdir[pdeno] & PTE_P))
+				continue;
+
+			// find the pa and va of the page table
+			pa = PTE_ADDR(e->env_pgdir[pdeno]);
+			pt = (pte_t*) KADDR(pa);
+
+			// unmap all PTEs in this page table
+			// device memory (see e1000_bypass) has no PageInfo to release
+			for (pteno = 0; pteno <= PTX(~0); pteno++) {
+				if ((pt[pteno] & PTE_P) && PGNUM(pt[pteno]) < npages)
+					page_remove(e->env_pgdir, PGADDR(pdeno, pteno, 0));
+			}
+
+			// free the page table itself
+			e->env_pgdir[pdeno] = 0;
+			page_decref(pa2page(pa));
 		}
-
-		// free the page table itself
-		e->env_pgdir[pdeno] = 0;
-		page_decref(pa2page(pa));
 	}
 
 	// free the page directory
@@ -486,6 +548,9 @@ env_free(struct Env *e)
 	e->env_status = ENV_FREE;
 	e->env_link = env_free_list;
 	env_free_list = e;
+
+	// let wait() in other envs know, through the envs[] page at UENVS
+	futex_wake(PADDR(&e->env_status), NENV);
 }
 
 //
@@ -512,6 +577,50 @@ env_destroy(struct Env *e)
 	}
 }
 
+//
+// Destroys e along with every other thread sharing its address space
+// (see env_alloc_thread), the way a whole program ends.
+// Does not return if one of them is the current env.
+//
+void
+env_destroy_threads(struct Env *e)
+{
+	pde_t *pgdir = e->env_pgdir;
+	int i;
+
+	// the current env goes last, as destroying it does not return
+	for (i = 0; i < NENV; i++)
+		if (envs[i].env_pgdir == pgdir && &envs[i] != curenv &&
+		    envs[i].env_status != ENV_FREE &&
+		    envs[i].env_status != ENV_DYING)
+			env_destroy(&envs[i]);
+	if (curenv && curenv->env_pgdir == pgdir)
+		env_destroy(curenv);
+}
+
+// Delivers value to e as an IPC without a page from the kernel (envid 0).
+// If e isn't blocked in sys_ipc_recv, the value is delivered by its next
+// sys_ipc_recv instead. Notifications not yet received are merged, only
+// the latest value is kept.
+void
+env_notify(struct Env *e, uint32_t value)
+{
+	if (!e->env_ipc_recving) {
+		e->env_notify_pending = true;
+		e->env_notify_value = value;
+		return;
+	}
+
+	e->env_ipc_recving = false;
+	e->env_ipc_value = value;
+	e->env_ipc_from = 0;
+	e->env_ipc_perm = 0;
+	e->env_stat.es_ipc_recvs++;
+	// set the return value of recv to 0 for success
+	e->env_tf.tf_regs.reg_eax = 0;
+	sched_wakeup(e);
+}
+
 
 //
 // Restores the register values in the Trapframe with the 'iret' instruction.
@@ -535,6 +644,31 @@ env_pop_tf(struct Trapframe *tf)
 	panic("iret failed");  /* mostly to placate the compiler */
 }
 
+//
+// Charge the TSC cycles since this CPU last charged an env to curenv,
+// as user time if user is true and as kernel time otherwise.  Time
+// with no env (halted, or after curenv was freed) is charged to no one.
+//
+void
+env_charge(bool user)
+{
+	env_charge_until(user, read_tsc());
+}
+
+//
+// Like env_charge, but only up to the TSC value now, for time that is
+// known to have ended earlier.
+//
+void
+env_charge_until(bool user, uint64_t now)
+{
+	if (curenv && user)
+		curenv->env_stat.es_utime += now - thiscpu->cpu_tsc_mark;
+	else if (curenv)
+		curenv->env_stat.es_stime += now - thiscpu->cpu_tsc_mark;
+	thiscpu->cpu_tsc_mark = now;
+}
+
 //
 // Context switch from curenv to env e.
 // Note: if this is the first call to env_run, curenv is NULL.
@@ -562,6 +696,16 @@ env_run(struct Env *e)
 	//	e->env_tf to sensible values.
 
 	// LAB 3: Your code here.
+	tlb_shootdown_flush();
+	env_charge(false);
+	TRACE(TRACE_ENV_RUN, e->env_id, e->env_runs);
+	sched_handoff(e);
+	if (!boot_done) {
+		boot_done = true;
+		boottime_mark("first env_run");
+	}
+	if (e != curenv)
+		thiscpu->cpu_stat->cs_switches++;
 	if (e!=curenv && curenv!=NULL){
 		if (curenv->env_status==ENV_RUNNING){
 			curenv->env_status=ENV_RUNNABLE;
@@ -569,8 +713,11 @@ env_run(struct Env *e)
 	}
 	curenv=e;
 	curenv->env_status=ENV_RUNNING;
+	curenv->env_pref_cpu=cpunum();
 	curenv->env_runs++;
 	lcr3(PADDR(curenv->env_pgdir));
+	env_charge(false);
+	TRACE(TRACE_TRAP_RET, 0, 0);
 
     unlock_kernel();
 
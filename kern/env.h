@@ -13,9 +13,14 @@ extern struct Segdesc gdt[];
 void	env_init(void);
 void	env_init_percpu(void);
 int	env_alloc(struct Env **e, envid_t parent_id);
+int	env_alloc_thread(struct Env **e, envid_t parent_id, pde_t *pgdir);
 void	env_free(struct Env *e);
 void	env_create(uint8_t *binary, enum EnvType type);
 void	env_destroy(struct Env *e);	// Does not return if e == curenv
+void	env_destroy_threads(struct Env *e);
+void	env_notify(struct Env *e, uint32_t value);
+void	env_charge(bool user);
+void	env_charge_until(bool user, uint64_t now);
 
 int	envid2env(envid_t envid, struct Env **env_store, bool checkperm);
 // The following two functions do not return
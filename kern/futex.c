@@ -0,0 +1,170 @@
+// Futexes: blocking on a word of user memory until another env changes
+// it and wakes us.
+//
+// A futex is named by the physical address of the word, so envs that
+// map the same page (PTE_SHARE pages, or the read-only envs[] array at
+// UENVS) can wait and wake on it whatever virtual address they use.
+// Waiters are kept in FIFO lists hashed by physical page.  Everything
+// here runs under the big kernel lock.
+
+#include <inc/error.h>
+#include <inc/env.h>
+#include <inc/memlayout.h>
+
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/sched.h>
+#include <kern/time.h>
+#include <kern/futex.h>
+
+#define FUTEX_NBUCKET	64
+
+static struct Env *futex_buckets[FUTEX_NBUCKET];
+
+static struct Env **
+futex_bucket(physaddr_t pa)
+{
+	return &futex_buckets[PGNUM(pa) % FUTEX_NBUCKET];
+}
+
+// Translate va in e's address space to the futex key, the physical
+// address of the word.
+static int
+futex_key(struct Env *e, const void *va, physaddr_t *pa_store)
+{
+	struct PageInfo *pp;
+	pte_t *pte;
+
+	if ((uintptr_t) va >= UTOP || (uintptr_t) va % sizeof(uint32_t))
+		return -E_INVAL;
+	pp = page_lookup(e->env_pgdir, (void *) va, &pte);
+	if (pp == NULL || !(*pte & PTE_U))
+		return -E_INVAL;
+	*pa_store = page2pa(pp) + PGOFF(va);
+	return 0;
+}
+
+// Take e off its wait list and make it runnable, with 'ret' as the
+// return value of its sys_futex_wait.
+static void
+futex_unblock(struct Env *e, int ret)
+{
+	futex_cancel(e);
+	e->env_tf.tf_regs.reg_eax = ret;
+	sched_wakeup(e);
+}
+
+// Block e until the word at va is woken, unless it no longer holds
+// 'expected'.  A timeout_ms of 0, or of 2^31 or more, waits forever.
+// Returns
+// -E_AGAIN if the word changed, or < 0 if va is not a valid user
+// address; otherwise e is blocked, and its sys_futex_wait returns 0
+// when woken or -E_TIMEOUT when the time runs out.
+int
+futex_wait(struct Env *e, const void *va, uint32_t expected,
+	   uint32_t timeout_ms)
+{
+	struct Env **pp;
+	physaddr_t pa;
+	int r;
+
+	if ((r = futex_key(e, va, &pa)) < 0)
+		return r;
+	// Nothing can change the word while we hold the kernel lock, so
+	// a wakeup cannot slip in between this check and blocking.
+	if (*(volatile uint32_t *) KADDR(pa) != expected)
+		return -E_AGAIN;
+
+	e->env_futex_addr = pa;
+	e->env_futex_deadline = 0;
+	if (timeout_ms && (int32_t) timeout_ms > 0)
+		e->env_futex_deadline = (time_msec() + timeout_ms) ?: 1;
+	e->env_futex_link = NULL;
+	for (pp = futex_bucket(pa); *pp; pp = &(*pp)->env_futex_link)
+		;
+	*pp = e;
+
+	e->env_tf.tf_regs.reg_eax = 0;
+	e->env_status = ENV_NOT_RUNNABLE;
+	return 0;
+}
+
+// Wake up to n envs waiting on the word at physical address pa, oldest
+// first.  Returns the number of envs woken.
+int
+futex_wake(physaddr_t pa, int n)
+{
+	struct Env *e, *next;
+	int woken = 0;
+
+	for (e = *futex_bucket(pa); e && woken < n; e = next) {
+		next = e->env_futex_link;
+		if (e->env_futex_addr == pa) {
+			futex_unblock(e, 0);
+			woken++;
+		}
+	}
+	return woken;
+}
+
+// Like futex_wake, for the word at va in e's address space.
+int
+futex_wake_va(struct Env *e, const void *va, int n)
+{
+	physaddr_t pa;
+	int r;
+
+	if ((r = futex_key(e, va, &pa)) < 0)
+		return r;
+	return futex_wake(pa, n);
+}
+
+// Wake every env waiting on a word in the page at pa.  Called when a
+// mapping of the page goes away, since waiters often sleep until the
+// other side of a shared page has gone (see lib/pipe.c).
+void
+futex_wake_page(physaddr_t pa)
+{
+	struct Env *e, *next;
+
+	for (e = *futex_bucket(pa); e; e = next) {
+		next = e->env_futex_link;
+		if (PGNUM(e->env_futex_addr) == PGNUM(pa))
+			futex_unblock(e, 0);
+	}
+}
+
+// Forget e's wait, if any, because e is going away.
+void
+futex_cancel(struct Env *e)
+{
+	struct Env **pp;
+
+	if (!e->env_futex_addr)
+		return;
+	for (pp = futex_bucket(e->env_futex_addr); *pp; pp = &(*pp)->env_futex_link)
+		if (*pp == e) {
+			*pp = e->env_futex_link;
+			break;
+		}
+	e->env_futex_addr = 0;
+	e->env_futex_link = NULL;
+}
+
+// Time out the waiters whose deadline has passed.  Called on every
+// timer tick of the boot CPU.
+void
+futex_expire(void)
+{
+	struct Env *e, *next;
+	unsigned now = time_msec();
+	int i;
+
+	for (i = 0; i < FUTEX_NBUCKET; i++)
+		for (e = futex_buckets[i]; e; e = next) {
+			next = e->env_futex_link;
+			if (e->env_futex_deadline &&
+			    (int32_t) (now - e->env_futex_deadline) >= 0)
+				futex_unblock(e, -E_TIMEOUT);
+		}
+}
@@ -0,0 +1,21 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_FUTEX_H
+#define JOS_KERN_FUTEX_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+struct Env;
+
+int futex_wait(struct Env *e, const void *va, uint32_t expected,
+	       uint32_t timeout_ms);
+int futex_wake(physaddr_t pa, int n);
+int futex_wake_va(struct Env *e, const void *va, int n);
+void futex_wake_page(physaddr_t pa);
+void futex_cancel(struct Env *e);
+void futex_expire(void);
+
+#endif	// !JOS_KERN_FUTEX_H
@@ -0,0 +1,257 @@
+// Bus-master DMA for the primary channel of a PIIX IDE controller.
+//
+// The file server still decides what to read and write, but rather than
+// copying every sector through the data port it queues transfers with
+// sys_ide_dma.  The kernel pins the buffer pages and the request's
+// status word (ide_req_pin), and starts the transfers one at a time, in
+// the order they were queued, by pointing the controller at a PRD table
+// for the buffer and issuing a READ/WRITE DMA command.  The completion
+// interrupt (IRQ 14) stores the result in the request, wakes futex
+// waiters on it, notifies the submitter if asked (ide_req_done), and
+// starts the next transfer, so a queue of transfers runs without the
+// file server's help while it serves other requests.  The virtio-blk
+// driver takes the same requests, when there is such a disk.
+//
+// Everything here runs under the big kernel lock.
+
+#include <inc/x86.h>
+#include <inc/error.h>
+#include <inc/fs.h>
+#include <inc/ide.h>
+
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/picirq.h>
+#include <kern/futex.h>
+#include <kern/ide.h>
+
+#define SECTSIZE	512
+
+// Primary channel task file
+#define ATA_NSECT	0x1F2
+#define ATA_LBA0	0x1F3
+#define ATA_LBA1	0x1F4
+#define ATA_LBA2	0x1F5
+#define ATA_DRIVE	0x1F6
+#define ATA_STATUS	0x1F7		// Read
+#define ATA_CMD		0x1F7		// Write
+
+#define ATA_BSY		0x80
+#define ATA_DF		0x20
+#define ATA_ERR		0x01
+
+#define ATA_CMD_READ_DMA	0xC8
+#define ATA_CMD_WRITE_DMA	0xCA
+
+// Bus-master registers of the primary channel, at BAR 4
+#define BM_CMD		0
+#define BM_STATUS	2
+#define BM_PRDT		4
+
+#define BM_CMD_START	0x01
+#define BM_CMD_READ	0x08		// Device to memory
+#define BM_STATUS_ERR	0x02
+#define BM_STATUS_INTR	0x04
+
+// Physical region descriptor: one page of the buffer
+struct IdePrd {
+	uint32_t prd_addr;
+	uint16_t prd_len;
+	uint16_t prd_flags;
+};
+#define PRD_EOT		0x8000		// Last entry of the table
+
+static struct IdeReq ide_queue[IDE_DMA_NREQ];
+static uint32_t ide_head;		// Next to finish
+static uint32_t ide_tail;		// Next free entry
+static bool ide_busy;			// ide_queue[ide_head] is running
+static uint16_t ide_bmbase;		// 0 until a controller attaches
+
+// The table must not cross a 64KB boundary
+static struct IdePrd ide_prd[IDE_MAXPAGES] __attribute__((aligned(512)));
+
+int
+ide_dma_attach(struct pci_func *pcif)
+{
+	pci_func_enable(pcif);
+	// The bus-master registers are I/O ports at BAR 4
+	if (!pcif->reg_base[4] || pcif->reg_size[4] < 8)
+		return 0;
+	ide_bmbase = pcif->reg_base[4];
+	irq_enable(IRQ_IDE);
+	cprintf("ide: bus-master DMA at port 0x%x\n", ide_bmbase);
+	return 1;
+}
+
+// Program the controller for the transfer at the head of the queue.
+static void
+ide_start(void)
+{
+	struct IdeReq *ir = &ide_queue[ide_head % IDE_DMA_NREQ];
+	uint32_t len = ir->ir_nsecs * SECTSIZE;
+	int i;
+
+	for (i = 0; len > 0; i++) {
+		ide_prd[i].prd_addr = page2pa(ir->ir_pages[i]);
+		ide_prd[i].prd_len = MIN(len, PGSIZE);
+		ide_prd[i].prd_flags = 0;
+		len -= ide_prd[i].prd_len;
+	}
+	ide_prd[i - 1].prd_flags = PRD_EOT;
+
+	while (inb(ATA_STATUS) & ATA_BSY)
+		/* do nothing */;
+	outb(ide_bmbase + BM_CMD, 0);
+	outl(ide_bmbase + BM_PRDT, PADDR(ide_prd));
+	// The status bits are cleared by writing 1s
+	outb(ide_bmbase + BM_STATUS, BM_STATUS_ERR | BM_STATUS_INTR);
+
+	outb(ATA_NSECT, ir->ir_nsecs & 0xFF);	// 256 is 0
+	outb(ATA_LBA0, ir->ir_secno & 0xFF);
+	outb(ATA_LBA1, (ir->ir_secno >> 8) & 0xFF);
+	outb(ATA_LBA2, (ir->ir_secno >> 16) & 0xFF);
+	outb(ATA_DRIVE, 0xE0 | (ir->ir_diskno << 4)
+	     | ((ir->ir_secno >> 24) & 0x0F));
+	if (ir->ir_flags & IDE_DMA_WRITE) {
+		outb(ATA_CMD, ATA_CMD_WRITE_DMA);
+		outb(ide_bmbase + BM_CMD, BM_CMD_START);
+	} else {
+		outb(ATA_CMD, ATA_CMD_READ_DMA);
+		outb(ide_bmbase + BM_CMD, BM_CMD_START | BM_CMD_READ);
+	}
+	ide_busy = true;
+}
+
+// Drop the references a queued transfer holds to the first npages
+// pages of its buffer, and to its status word.
+static void
+ide_unpin(struct IdeReq *ir, int npages)
+{
+	int i;
+
+	for (i = 0; i < npages; i++)
+		page_decref(ir->ir_pages[i]);
+	if (ir->ir_status_page)
+		page_decref(ir->ir_status_page);
+}
+
+// Check the transfer described by req, in e's address space, and fill
+// in ir with it, taking references to the buffer pages and the status
+// word so that they stay put until ide_req_done.  The buffer must be
+// mapped user-accessible for its whole length, and writable for a read
+// from disk.  Sets req->id_status to IDE_DMA_BUSY.
+//
+// Returns 0 on success, -E_INVAL if req is malformed or not mapped as
+// it must be.
+int
+ide_req_pin(struct Env *e, struct IdeDma *req, struct IdeReq *ir)
+{
+	struct PageInfo *pp;
+	uint32_t va, nsecs;
+	int i, npages;
+	pte_t *pte;
+
+	if ((uint32_t) req % 4
+	    || user_mem_check(e, req, sizeof(*req), PTE_U | PTE_W) < 0)
+		return -E_INVAL;
+
+	va = (uint32_t) req->id_va;
+	nsecs = req->id_nsecs;
+	npages = ROUNDUP(nsecs * SECTSIZE, PGSIZE) / PGSIZE;
+	if (nsecs == 0 || nsecs > IDE_DMA_MAXSECS || req->id_diskno > 1
+	    || va % PGSIZE || va >= UTOP || UTOP - va < npages * PGSIZE)
+		return -E_INVAL;
+
+	ir->ir_status_page = NULL;
+	for (i = 0; i < npages; i++) {
+		pp = page_lookup(e->env_pgdir, (void *) (va + i * PGSIZE), &pte);
+		if (!pp || !(*pte & PTE_U) || (!(req->id_flags & IDE_DMA_WRITE)
+					       && !(*pte & PTE_W))) {
+			ide_unpin(ir, i);
+			return -E_INVAL;
+		}
+		pp->pp_ref++;
+		ir->ir_pages[i] = pp;
+	}
+	// Pin the status word too, so that the interrupt can set it and
+	// wake its waiters by physical address
+	pp = page_lookup(e->env_pgdir, (void *) &req->id_status, 0);
+	pp->pp_ref++;
+	ir->ir_status_page = pp;
+	ir->ir_status_pa = page2pa(pp) + PGOFF(&req->id_status);
+
+	ir->ir_env = e->env_id;
+	ir->ir_secno = req->id_secno;
+	ir->ir_nsecs = nsecs;
+	ir->ir_diskno = req->id_diskno;
+	ir->ir_flags = req->id_flags;
+	req->id_status = IDE_DMA_BUSY;
+	return 0;
+}
+
+// Finish the transfer ir with the given status, 0 or < 0: store it in
+// the request, wake its waiters, notify the submitter if it asked, and
+// drop the references ide_req_pin took.
+void
+ide_req_done(struct IdeReq *ir, int status)
+{
+	struct Env *e;
+
+	*(int32_t *) (page2kva(ir->ir_status_page) + PGOFF(ir->ir_status_pa)) =
+		status;
+	futex_wake(ir->ir_status_pa, NENV);
+	if ((ir->ir_flags & IDE_DMA_NOTIFY) && envid2env(ir->ir_env, &e, 0) == 0)
+		env_notify(e, FSREQ_INTERRUPT);
+	ide_unpin(ir, ROUNDUP(ir->ir_nsecs * SECTSIZE, PGSIZE) / PGSIZE);
+}
+
+// Queue the transfer described by req, in e's address space, and start
+// it if the channel is idle.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_NOT_SUPP if there is no bus-master IDE controller.
+//	-E_NO_MEM if IDE_DMA_NREQ transfers are queued already.
+//	-E_INVAL if req is malformed or not mapped as it must be.
+int
+ide_dma_submit(struct Env *e, struct IdeDma *req)
+{
+	int r;
+
+	if (!ide_bmbase)
+		return -E_NOT_SUPP;
+	if (ide_tail - ide_head == IDE_DMA_NREQ)
+		return -E_NO_MEM;
+	if ((r = ide_req_pin(e, req, &ide_queue[ide_tail % IDE_DMA_NREQ])) < 0)
+		return r;
+	ide_tail++;
+	if (!ide_busy)
+		ide_start();
+	return 0;
+}
+
+// Handle IRQ 14: finish the transfer in progress and start the next.
+void
+ide_dma_intr(void)
+{
+	uint8_t bmstatus, status;
+
+	if (!ide_bmbase)
+		return;
+	bmstatus = inb(ide_bmbase + BM_STATUS);
+	// Reading the status register acknowledges the drive's interrupt,
+	// which may also come from a PIO command
+	status = inb(ATA_STATUS);
+	if (!ide_busy || !(bmstatus & BM_STATUS_INTR))
+		return;
+
+	outb(ide_bmbase + BM_CMD, 0);
+	outb(ide_bmbase + BM_STATUS, BM_STATUS_ERR | BM_STATUS_INTR);
+	ide_busy = false;
+
+	ide_req_done(&ide_queue[ide_head++ % IDE_DMA_NREQ],
+		     (bmstatus & BM_STATUS_ERR) || (status & (ATA_DF | ATA_ERR))
+		     ? -E_UNSPECIFIED : 0);
+
+	if (ide_head != ide_tail)
+		ide_start();
+}
@@ -0,0 +1,36 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_IDE_H
+#define JOS_KERN_IDE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/ide.h>
+#include <inc/env.h>
+#include <kern/pci.h>
+
+struct Env;
+
+#define IDE_MAXPAGES	(IDE_DMA_MAXSECS * 512 / PGSIZE)
+
+// A transfer queued or in progress, holding references to its pages
+struct IdeReq {
+	envid_t ir_env;
+	uint32_t ir_secno;
+	uint16_t ir_nsecs;
+	uint8_t ir_diskno;
+	uint8_t ir_flags;
+	struct PageInfo *ir_pages[IDE_MAXPAGES];
+	struct PageInfo *ir_status_page;
+	physaddr_t ir_status_pa;
+};
+
+int ide_req_pin(struct Env *e, struct IdeDma *req, struct IdeReq *ir);
+void ide_req_done(struct IdeReq *ir, int status);
+
+int ide_dma_attach(struct pci_func *pcif);
+int ide_dma_submit(struct Env *e, struct IdeDma *req);
+void ide_dma_intr(void);
+
+#endif	// !JOS_KERN_IDE_H
@@ -12,10 +12,12 @@
 #include <kern/trap.h>
 #include <kern/sched.h>
 #include <kern/picirq.h>
+#include <kern/ioapic.h>
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
 #include <kern/time.h>
 #include <kern/pci.h>
+#include <kern/boottime.h>
 
 static void boot_aps(void);
 
@@ -29,30 +31,40 @@ i386_init(void)
 	// Clear the uninitialized global data (BSS) section of our program.
 	// This ensures that all static/global variables start out zero.
 	memset(edata, 0, end - edata);
+	// Collect the boot loader's timestamps before low memory is reused
+	boottime_init();
 
 	// Initialize the console.
 	// Can't call cprintf until after we do this!
 	cons_init();
+	boottime_mark("cons_init");
 
 	cprintf("6828 decimal is %o octal!\n", 6828);
 
 	// Lab 2 memory management initialization functions
 	mem_init();
+	boottime_mark("mem_init");
 
 	// Lab 3 user environment initialization functions
 	env_init();
 	trap_init();
+	boottime_mark("env/trap_init");
 
 	// Lab 4 multiprocessor initialization functions
 	mp_init();
 	lapic_init();
+	boottime_mark("mp_init");
 
 	// Lab 4 multitasking initialization functions
 	pic_init();
+	ioapic_init();
+	boottime_mark("pic_init");
 
 	// Lab 6 hardware initialization functions
 	time_init();
+	boottime_mark("time_init");
 	pci_init();
+	boottime_mark("pci_init");
 
 	// Acquire the big kernel lock before waking up APs
 	// Your code here:
@@ -60,6 +72,9 @@ i386_init(void)
 
 	// Starting non-boot CPUs
 	boot_aps();
+	// Spread device interrupts over them
+	ioapic_balance();
+	boottime_mark("boot_aps");
 
 	// Start fs.
 	ENV_CREATE(fs_fs, ENV_TYPE_FS);
@@ -77,6 +92,8 @@ i386_init(void)
 	ENV_CREATE(user_icode, ENV_TYPE_USER);
 #endif // TEST*
 
+	boottime_mark("env_create");
+
 	// Should not be necessary - drains keyboard because interrupt has given up.
 	kbd_intr();
 
@@ -0,0 +1,223 @@
+// The I/O APIC routes device interrupts to the local APICs of the CPUs.
+// See the Intel 82093AA I/O APIC datasheet, and Chapter 3 of the
+// MultiProcessor Specification for how the MP tables describe it.
+
+#include <inc/types.h>
+#include <inc/trap.h>
+#include <inc/error.h>
+#include <inc/stdio.h>
+#include <kern/pmap.h>
+#include <kern/cpu.h>
+#include <kern/ioapic.h>
+
+// Memory mapped registers, as uint32_t[] indices.
+#define IOREGSEL	(0x00/4)	// Register select
+#define IOWIN		(0x10/4)	// Register data
+
+// Registers selected through IOREGSEL
+#define REG_ID		0x00	// ID
+#define REG_VER		0x01	// Version, and number of pins
+#define REG_TABLE	0x10	// Redirection table, two registers per pin
+
+// Redirection table entry, low half
+#define INT_DISABLED	0x00010000	// Interrupt masked
+#define INT_LEVEL	0x00008000	// Level (vs edge) triggered
+#define INT_ACTIVELOW	0x00002000	// Active low (vs high)
+#define INT_LOGICAL	0x00000800	// Logical (vs physical) destination
+// Redirection table entry, high half
+#define INT_DEST_SHIFT	24		// APIC ID of the destination CPU
+
+physaddr_t ioapicaddr;		// Initialized in mpconfig.c
+uint8_t ioapicid;		// Initialized in mpconfig.c
+struct IrqRoute irq_routes[MAX_IRQS];	// Initialized in mpconfig.c
+
+static volatile uint32_t *ioapic;
+static int ioapic_npins;
+
+// The CPU each IRQ is delivered to, -1 while the IRQ is disabled.
+static int irq_cpu[MAX_IRQS];
+// Set once the non-boot CPUs run, and ioapic_balance applied the policy.
+static bool balanced;
+
+static uint32_t
+ioapic_read(int reg)
+{
+	ioapic[IOREGSEL] = reg;
+	return ioapic[IOWIN];
+}
+
+static void
+ioapic_write(int reg, uint32_t data)
+{
+	ioapic[IOREGSEL] = reg;
+	ioapic[IOWIN] = data;
+}
+
+// The IOAPIC pin the IRQ comes in on, with its trigger mode and polarity.
+// Without an MP table entry, ISA IRQs are wired to the pin of the same
+// number, edge triggered and active high.
+static uint32_t
+irq_entry(int irq, int *pin)
+{
+	struct IrqRoute *r = &irq_routes[irq];
+	uint32_t entry = IRQ_OFFSET + irq;
+
+	*pin = irq;
+	if (!r->ir_valid)
+		return entry;
+	*pin = r->ir_pin;
+	if (r->ir_level)
+		entry |= INT_LEVEL;
+	if (r->ir_low)
+		entry |= INT_ACTIVELOW;
+	return entry;
+}
+
+// Points the IRQ at the given CPU, or masks it if cpu is -1.
+static void
+ioapic_program(int irq, int cpu)
+{
+	int pin;
+	uint32_t entry = irq_entry(irq, &pin);
+
+	if (pin >= ioapic_npins) {
+		cprintf("IOAPIC: IRQ %d is wired to missing pin %d\n", irq, pin);
+		return;
+	}
+	if (cpu < 0) {
+		ioapic_write(REG_TABLE + 2 * pin, entry | INT_DISABLED);
+		ioapic_write(REG_TABLE + 2 * pin + 1, 0);
+		return;
+	}
+	// write the destination first, so the entry is never live
+	// with a stale one
+	ioapic_write(REG_TABLE + 2 * pin, entry | INT_DISABLED);
+	ioapic_write(REG_TABLE + 2 * pin + 1, cpus[cpu].cpu_id << INT_DEST_SHIFT);
+	ioapic_write(REG_TABLE + 2 * pin, entry);
+}
+
+// The CPU the policy places the n-th enabled IRQ on.
+static int
+policy_cpu(int n)
+{
+	if (ncpu == 1)
+		return bootcpu->cpu_id;
+	switch (IRQ_POLICY) {
+	case IRQ_POLICY_SPREAD:
+		// leave the boot CPU, which keeps the time, to the timer
+		n %= ncpu - 1;
+		return n < bootcpu->cpu_id ? n : n + 1;
+	case IRQ_POLICY_PIN:
+		if (IRQ_PIN_CPU < ncpu)
+			return IRQ_PIN_CPU;
+		return bootcpu->cpu_id;
+	default:
+		return bootcpu->cpu_id;
+	}
+}
+
+// Maps the IOAPIC, masks all its pins, and moves the IRQs enabled so far
+// in the 8259A over to it. From then on the 8259A stays masked.
+// Without an IOAPIC, IRQs keep going through the 8259A, to the boot CPU.
+void
+ioapic_init(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_IRQS; i++)
+		irq_cpu[i] = -1;
+	if (!ioapicaddr)
+		return;
+
+	ioapic = mmio_map_region(ioapicaddr, PGSIZE);
+	ioapic_npins = ((ioapic_read(REG_VER) >> 16) & 0xFF) + 1;
+	if (((ioapic_read(REG_ID) >> 24) & 0xF) != (ioapicid & 0xF))
+		cprintf("IOAPIC: ID %d differs from the MP table\n",
+			(ioapic_read(REG_ID) >> 24) & 0xF);
+
+	for (i = 0; i < ioapic_npins; i++) {
+		ioapic_write(REG_TABLE + 2 * i, INT_DISABLED | (IRQ_OFFSET + i));
+		ioapic_write(REG_TABLE + 2 * i + 1, 0);
+	}
+
+	// the cascade line means nothing to the IOAPIC
+	for (i = 0; i < MAX_IRQS; i++)
+		if (i != IRQ_SLAVE && !(irq_mask_8259A & (1 << i)))
+			ioapic_enable(i);
+	// masks the 8259A, now that ioapic_active
+	irq_setmask_8259A(irq_mask_8259A);
+	cprintf("IOAPIC: %d pins, routing device interrupts\n", ioapic_npins);
+}
+
+// Whether device interrupts go through the IOAPIC
+bool
+ioapic_active(void)
+{
+	return ioapic != NULL;
+}
+
+// Unmasks the IRQ in the IOAPIC, if there is one.
+// Before ioapic_balance ran, the IRQ goes to the boot CPU.
+void
+ioapic_enable(int irq)
+{
+	int i, n = 0;
+
+	if (!ioapic || irq < 0 || irq >= MAX_IRQS || irq_cpu[irq] >= 0)
+		return;
+	if (!balanced) {
+		irq_cpu[irq] = bootcpu->cpu_id;
+	} else {
+		for (i = 0; i < MAX_IRQS; i++)
+			if (irq_cpu[i] >= 0)
+				n++;
+		irq_cpu[irq] = policy_cpu(n);
+	}
+	ioapic_program(irq, irq_cpu[irq]);
+}
+
+// Distributes the enabled IRQs over the CPUs following IRQ_POLICY.
+// Must run once all CPUs are started, as interrupts sent to a CPU
+// that waits for its startup IPI are lost.
+void
+ioapic_balance(void)
+{
+	int irq, n = 0;
+
+	if (!ioapic)
+		return;
+	balanced = 1;
+	for (irq = 0; irq < MAX_IRQS; irq++) {
+		if (irq_cpu[irq] < 0)
+			continue;
+		irq_cpu[irq] = policy_cpu(n++);
+		ioapic_program(irq, irq_cpu[irq]);
+	}
+}
+
+// Pins an enabled IRQ to the given CPU, overriding the policy.
+// Returns 0 on success, -E_INVAL if the IRQ isn't enabled, the CPU
+// isn't running, or there is no IOAPIC.
+int
+ioapic_route(int irq, int cpu)
+{
+	if (!ioapic || irq < 0 || irq >= MAX_IRQS || irq_cpu[irq] < 0)
+		return -E_INVAL;
+	if (cpu < 0 || cpu >= ncpu || cpus[cpu].cpu_status == CPU_UNUSED)
+		return -E_INVAL;
+	irq_cpu[irq] = cpu;
+	ioapic_program(irq, cpu);
+	return 0;
+}
+
+// Returns the CPU the IRQ is delivered to, or -1 if it's disabled.
+// Without an IOAPIC, enabled IRQs all go to the boot CPU.
+int
+ioapic_irq_cpu(int irq)
+{
+	if (irq < 0 || irq >= MAX_IRQS)
+		return -1;
+	if (!ioapic)
+		return (irq_mask_8259A & (1 << irq)) ? -1 : bootcpu->cpu_id;
+	return irq_cpu[irq];
+}
@@ -0,0 +1,45 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_IOAPIC_H
+#define JOS_KERN_IOAPIC_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <kern/picirq.h>
+
+// Policies for assigning device IRQs to CPUs (see ioapic_balance)
+#define IRQ_POLICY_BOOT		0	// every IRQ on the boot CPU
+#define IRQ_POLICY_SPREAD	1	// round robin over the non-boot CPUs
+#define IRQ_POLICY_PIN		2	// every IRQ on CPU IRQ_PIN_CPU
+
+#ifndef IRQ_POLICY
+# define IRQ_POLICY		IRQ_POLICY_SPREAD
+#endif
+#ifndef IRQ_PIN_CPU
+# define IRQ_PIN_CPU		1
+#endif
+
+// Where an ISA IRQ enters the IOAPIC, as described by the MP tables.
+struct IrqRoute {
+	bool ir_valid;
+	bool ir_pci;		// the line is shared by PCI devices
+	uint8_t ir_pin;		// IOAPIC input pin
+	bool ir_level;		// level (vs edge) triggered
+	bool ir_low;		// active low (vs high)
+};
+
+// Initialized in mpconfig.c
+extern physaddr_t ioapicaddr;
+extern uint8_t ioapicid;
+extern struct IrqRoute irq_routes[MAX_IRQS];
+
+void ioapic_init(void);
+bool ioapic_active(void);
+void ioapic_enable(int irq);
+void ioapic_balance(void);
+int ioapic_route(int irq, int cpu);
+int ioapic_irq_cpu(int irq);
+
+#endif // !JOS_KERN_IOAPIC_H
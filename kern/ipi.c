@@ -0,0 +1,131 @@
+// Inter-processor interrupts: waking halted CPUs and running
+// functions on other CPUs.
+
+#include <inc/types.h>
+#include <inc/x86.h>
+#include <inc/trap.h>
+
+#include <kern/cpu.h>
+#include <kern/ipi.h>
+
+// Send a wakeup IPI to c if it is halted and has not been kicked yet.
+static bool
+ipi_kick(struct CpuInfo *c)
+{
+	if (c == thiscpu || c->cpu_status != CPU_HALTED || c->cpu_ipi_kicked)
+		return false;
+	c->cpu_ipi_kicked = true;
+	lapic_ipi_cpu(c->cpu_id, IRQ_OFFSET + IRQ_IPI_WAKEUP);
+	return true;
+}
+
+// Kick a halted CPU out of sched_halt() so that it picks up an env
+// that just became runnable, instead of waiting for its next timer
+// tick.  cpus[prefer] is tried first, then any CPU in 'mask' (bit i
+// is cpus[i]).  Does nothing if none of them is halted, or if they
+// have all been kicked already.  Returns whether a CPU was kicked.
+// The caller must hold the big kernel lock.
+bool
+ipi_wake_idle(int prefer, uint32_t mask)
+{
+	struct CpuInfo *c;
+
+	if (prefer >= 0 && prefer < ncpu && (mask & (1 << prefer)) &&
+	    ipi_kick(&cpus[prefer]))
+		return true;
+	for (c = cpus; c < cpus + ncpu; c++)
+		if ((mask & (1 << (c - cpus))) && ipi_kick(c))
+			return true;
+	return false;
+}
+
+// Make a running CPU reschedule now rather than at its next timer
+// tick, because something more urgent than its env became runnable.
+void
+ipi_preempt(int cpu)
+{
+	if (&cpus[cpu] != thiscpu)
+		lapic_ipi_cpu(cpus[cpu].cpu_id, IRQ_OFFSET + IRQ_IPI_WAKEUP);
+}
+
+// Post 'call' to CPU c and interrupt it.
+static void
+ipi_post(struct CpuInfo *c, struct IpiCall *call)
+{
+	c->cpu_ipi_call = call;
+	lapic_ipi_cpu(c->cpu_id, IRQ_OFFSET + IRQ_IPI_CALL);
+}
+
+static void
+ipi_wait(struct IpiCall *call)
+{
+	while (call->ic_pending > 0)
+		asm volatile("pause");
+}
+
+// Run func(arg) on CPU 'cpu' and wait for it to return.
+//
+// The target runs func from its interrupt handler without taking the
+// big kernel lock, so func must only touch per-CPU state (the TLB, the
+// local APIC, ...) or data the caller keeps stable while waiting.
+// The caller must hold the big kernel lock; that serializes calls and
+// CPUs spinning for the lock serve their mailbox (see spin_lock).
+void
+ipi_call(int cpu, void (*func)(void *), void *arg)
+{
+	struct IpiCall call = { func, arg, 1 };
+
+	if (&cpus[cpu] == thiscpu) {
+		func(arg);
+		return;
+	}
+	if (cpus[cpu].cpu_status == CPU_UNUSED)
+		return;
+	ipi_post(&cpus[cpu], &call);
+	ipi_wait(&call);
+}
+
+// Run func(arg) on every started CPU in 'mask' (bit i is cpus[i])
+// other than this one, and wait until all of them have returned.  The
+// targets are interrupted together, with one IPI each.  The same rules
+// as ipi_call apply.
+void
+ipi_call_cpus(uint32_t mask, void (*func)(void *), void *arg)
+{
+	struct IpiCall call = { func, arg, 0 };
+	struct CpuInfo *c;
+
+	mask &= ~(1 << cpunum());
+	for (c = cpus; c < cpus + ncpu; c++)
+		if (c->cpu_status == CPU_UNUSED)
+			mask &= ~(1 << (c - cpus));
+	for (c = cpus; c < cpus + ncpu; c++)
+		if (mask & (1 << (c - cpus)))
+			call.ic_pending++;
+	for (c = cpus; c < cpus + ncpu; c++)
+		if (mask & (1 << (c - cpus)))
+			ipi_post(c, &call);
+	ipi_wait(&call);
+}
+
+// Run func(arg) on every other started CPU and wait until all of them
+// have returned.
+void
+ipi_call_others(void (*func)(void *), void *arg)
+{
+	ipi_call_cpus(~0, func, arg);
+}
+
+// Run the call posted to this CPU, if there is one.
+void
+ipi_poll(void)
+{
+	struct CpuInfo *c = thiscpu;
+	struct IpiCall *call = c->cpu_ipi_call;
+
+	if (call == NULL)
+		return;
+	c->cpu_ipi_call = NULL;
+	call->ic_func(call->ic_arg);
+	__sync_fetch_and_sub(&call->ic_pending, 1);
+}
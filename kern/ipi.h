@@ -0,0 +1,26 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_IPI_H
+#define JOS_KERN_IPI_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// A function call posted to other CPUs' mailboxes.  The caller waits
+// until every target has run it.
+struct IpiCall {
+	void (*ic_func)(void *arg);
+	void *ic_arg;
+	volatile int ic_pending;	// Targets that have not run it yet
+};
+
+bool ipi_wake_idle(int prefer, uint32_t mask);
+void ipi_preempt(int cpu);
+void ipi_call(int cpu, void (*func)(void *), void *arg);
+void ipi_call_cpus(uint32_t mask, void (*func)(void *), void *arg);
+void ipi_call_others(void (*func)(void *), void *arg);
+void ipi_poll(void);
+
+#endif	// !JOS_KERN_IPI_H
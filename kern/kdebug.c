@@ -112,6 +112,17 @@ stab_binsearch(const struct Stab *stabs, int *region_left, int *region_right,
 //
 int
 debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
+{
+	return debuginfo_env_eip(curenv, addr, info);
+}
+
+// debuginfo_env_eip(env, addr, info)
+//
+//	Like debuginfo_eip, but looks up user addresses in 'env', whose
+//	address space must be the one currently loaded.
+//
+int
+debuginfo_env_eip(struct Env *env, uintptr_t addr, struct Eipdebuginfo *info)
 {
 	const struct Stab *stabs, *stab_end;
 	const char *stabstr, *stabstr_end;
@@ -142,7 +153,7 @@ debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
 		// Make sure this memory is valid.
 		// Return -1 if it is not.  Hint: Call user_mem_check.
 		// LAB 3: Your code here.
-		if(user_mem_check(curenv, (void*)usd, sizeof(struct UserStabData), 0)<0){
+		if(user_mem_check(env, (void*)usd, sizeof(struct UserStabData), 0)<0){
 			return -1;
 		}
 
@@ -153,10 +164,10 @@ debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
 
 		// Make sure the STABS and string table memory is valid.
 		// LAB 3: Your code here.
-		if (user_mem_check(curenv, (void*)stabs, (char*)stab_end-(char*)stabs, 0)) {
+		if (user_mem_check(env, (void*)stabs, (char*)stab_end-(char*)stabs, 0)) {
 			return -1;
 		}
-		if (user_mem_check(curenv, (void*)stabstr, stabstr_end-stabstr, 0)) {
+		if (user_mem_check(env, (void*)stabstr, stabstr_end-stabstr, 0)) {
 			return -1;
 		}
 	}
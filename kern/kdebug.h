@@ -3,6 +3,8 @@
 
 #include <inc/types.h>
 
+struct Env;
+
 // Debug information about a particular instruction pointer
 struct Eipdebuginfo {
 	const char *eip_file;		// Source code filename for EIP
@@ -16,5 +18,7 @@ struct Eipdebuginfo {
 };
 
 int debuginfo_eip(uintptr_t eip, struct Eipdebuginfo *info);
+int debuginfo_env_eip(struct Env *env, uintptr_t eip,
+		      struct Eipdebuginfo *info);
 
 #endif
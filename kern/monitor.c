@@ -5,6 +5,7 @@
 #include <inc/string.h>
 #include <inc/memlayout.h>
 #include <inc/assert.h>
+#include <inc/syscall.h>
 #include <inc/x86.h>
 
 #include <kern/console.h>
@@ -12,6 +13,10 @@
 #include <kern/kdebug.h>
 #include <kern/trap.h>
 #include <kern/pmap.h>
+#include <kern/ioapic.h>
+#include <kern/prof.h>
+#include <kern/trace.h>
+#include <kern/boottime.h>
 
 #define CMDBUF_SIZE	80	// enough for one VGA text line
 
@@ -40,6 +45,25 @@ show {vstart} {vend} - show the mapping and permissions\n\
 dump [v/p] {start} {end}- dump the contents of the addresses start-end\n\
     those are interpreted as virtual with 'v' or physical with 'p'",
 mon_vmmap },
+	{ "irqroute",
+"Show the CPU each enabled IRQ is delivered to,\n\
+or pin an IRQ to a CPU with: irqroute {irq} {cpu}",
+mon_irqroute },
+	{ "prof",
+"Control the sampling profiler:\n\
+start / stop - start or stop taking samples\n\
+reset - discard the samples taken so far\n\
+flat [n] - show the n functions with the most samples\n\
+graph [n] - show the n functions with the most samples\n\
+    including their callees, with their callers and callees",
+mon_prof },
+	{ "trace",
+"Control kernel event tracing:\n\
+start - discard old events and start tracing\n\
+stop - stop tracing\n\
+dump - stop tracing and print the events for trace2json.py",
+mon_trace },
+	{ "boottime", "Show how long each step of booting took", mon_boottime },
 };
 
 #define NCOMMANDS (sizeof(commands)/sizeof(commands[0]))
@@ -252,6 +276,97 @@ mon_vmmap(int argc, char **argv, struct Trapframe *tf) {
 	return 0;
 }
 
+int
+mon_irqroute(int argc, char **argv, struct Trapframe *tf) {
+	int irq;
+	if (argc == 3) {
+		char *endptr;
+		irq = strtol(argv[1], &endptr, 0);
+		if (*endptr != '\0') {
+			cprintf("got invalid irq \"%s\"\n", argv[1]);
+			return 0;
+		}
+		int cpu = strtol(argv[2], &endptr, 0);
+		if (*endptr != '\0') {
+			cprintf("got invalid cpu \"%s\"\n", argv[2]);
+			return 0;
+		}
+		if (ioapic_route(irq, cpu) < 0) {
+			cprintf("can't route irq %d to cpu %d\n", irq, cpu);
+			return 0;
+		}
+	} else if (argc != 1) {
+		cprintf("usage: irqroute [{irq} {cpu}]\n");
+		return 0;
+	}
+
+	if (!ioapic_active()) {
+		cprintf("no IOAPIC, interrupts go through the 8259A\n");
+	}
+	for (irq = 0; irq < MAX_IRQS; irq++) {
+		int cpu = ioapic_irq_cpu(irq);
+		if (cpu >= 0 && irq != IRQ_SLAVE) {
+			cprintf("irq %2d -> cpu %d\n", irq, cpu);
+		}
+	}
+	return 0;
+}
+
+static const char *prof_ops[] = {
+	[PROF_START] = "start",
+	[PROF_STOP] = "stop",
+	[PROF_RESET] = "reset",
+	[PROF_FLAT] = "flat",
+	[PROF_GRAPH] = "graph",
+};
+
+#define NPROFOPS (sizeof(prof_ops)/sizeof(prof_ops[0]))
+
+int
+mon_prof(int argc, char **argv, struct Trapframe *tf) {
+	int op, n = 0;
+
+	if (argc >= 2 && argc <= 3) {
+		for (op = 0; op < NPROFOPS; op++) {
+			if (strcmp(argv[1], prof_ops[op]) == 0)
+				break;
+		}
+		if (argc == 3) {
+			char *endptr;
+			n = strtol(argv[2], &endptr, 0);
+			if (*endptr != '\0') {
+				cprintf("got invalid count \"%s\"\n", argv[2]);
+				return 0;
+			}
+		}
+		if (op < NPROFOPS && prof_ctl(op, n) == 0)
+			return 0;
+	}
+	cprintf("usage: prof {start|stop|reset|flat [n]|graph [n]}\n");
+	return 0;
+}
+
+int
+mon_trace(int argc, char **argv, struct Trapframe *tf) {
+	if (argc == 2 && strcmp(argv[1], "start") == 0) {
+		if (trace_start() < 0)
+			cprintf("no memory for the trace buffers\n");
+	} else if (argc == 2 && strcmp(argv[1], "stop") == 0) {
+		trace_stop();
+	} else if (argc == 2 && strcmp(argv[1], "dump") == 0) {
+		trace_dump();
+	} else {
+		cprintf("usage: trace {start|stop|dump}\n");
+	}
+	return 0;
+}
+
+int
+mon_boottime(int argc, char **argv, struct Trapframe *tf) {
+	boottime_print();
+	return 0;
+}
+
 /***** Kernel monitor command interpreter *****/
 
 #define WHITESPACE "\t\r\n "
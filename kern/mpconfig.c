@@ -9,8 +9,12 @@
 #include <inc/env.h>
 #include <kern/cpu.h>
 #include <kern/pmap.h>
+#include <kern/ioapic.h>
 
 struct CpuInfo cpus[NCPU];
+// Sized to fill its page, which users see, so the spare entries stay 0
+struct CpuStat cpu_stats[PGSIZE / sizeof(struct CpuStat)]
+	__attribute__((aligned(PGSIZE)));
 struct CpuInfo *bootcpu;
 int ismp;
 int ncpu;
@@ -62,6 +66,45 @@ struct mpproc {         // processor table entry [MP 4.3.1]
 // mpproc flags
 #define MPPROC_BOOT 0x02                // This mpproc is the bootstrap processor
 
+struct mpbus {          // bus table entry [MP 4.3.2]
+	uint8_t type;                   // entry type (1)
+	uint8_t busid;                  // bus id
+	uint8_t bustype[6];             // bus type string, blank padded
+} __attribute__((__packed__));
+
+struct mpioapic {       // I/O APIC table entry [MP 4.3.3]
+	uint8_t type;                   // entry type (2)
+	uint8_t apicno;                 // I/O APIC id
+	uint8_t version;                // I/O APIC version
+	uint8_t flags;                  // I/O APIC flags
+	physaddr_t addr;                // I/O APIC address
+} __attribute__((__packed__));
+
+// mpioapic flags
+#define MPIOAPIC_EN 0x01                // This I/O APIC is usable
+
+struct mpiointr {       // I/O interrupt assignment entry [MP 4.3.4]
+	uint8_t type;                   // entry type (3)
+	uint8_t irqtype;                // interrupt type
+	uint16_t flags;                 // polarity and trigger mode
+	uint8_t srcbus;                 // source bus id
+	uint8_t srcbusirq;              // source bus irq
+	uint8_t dstapic;                // destination I/O APIC id
+	uint8_t dstirq;                 // destination I/O APIC pin
+} __attribute__((__packed__));
+
+// mpiointr interrupt types
+#define MPINTR_INT  0x00                // vectored interrupt
+// mpiointr flags
+#define MPINTR_POL_MASK   0x03          // polarity
+#define MPINTR_POL_HIGH   0x01
+#define MPINTR_POL_LOW    0x03
+#define MPINTR_TRIG_MASK  0x0C          // trigger mode
+#define MPINTR_TRIG_EDGE  0x04
+#define MPINTR_TRIG_LEVEL 0x0C
+
+#define MAXBUS 256
+
 // Table entry types
 #define MPPROC    0x00  // One per processor
 #define MPBUS     0x01  // One per bus
@@ -80,6 +123,39 @@ sum(void *addr, int len)
 	return sum;
 }
 
+// Record where an interrupt of the source bus enters the I/O APIC.
+// ISA IRQs are identified by their number; PCI interrupts by the pin
+// they arrive on, which the BIOS also routes to the 8259A line of the
+// same number, the one PCI config space reports.  Lines that PCI
+// devices use keep the PCI trigger mode and polarity.
+static void
+mpiointr(struct mpiointr *intr, bool buspci)
+{
+	struct IrqRoute *r;
+	int irq = buspci ? intr->dstirq : intr->srcbusirq;
+
+	if (intr->irqtype != MPINTR_INT || intr->dstapic != ioapicid ||
+	    irq >= MAX_IRQS)
+		return;
+	r = &irq_routes[irq];
+	if (r->ir_valid && r->ir_pci && !buspci)
+		return;
+	r->ir_valid = 1;
+	r->ir_pci = buspci;
+	r->ir_pin = intr->dstirq;
+	// "conforms to the bus" means edge/high for ISA, level/low for PCI
+	switch (intr->flags & MPINTR_TRIG_MASK) {
+	case MPINTR_TRIG_EDGE:  r->ir_level = 0; break;
+	case MPINTR_TRIG_LEVEL: r->ir_level = 1; break;
+	default:                r->ir_level = buspci;
+	}
+	switch (intr->flags & MPINTR_POL_MASK) {
+	case MPINTR_POL_HIGH: r->ir_low = 0; break;
+	case MPINTR_POL_LOW:  r->ir_low = 1; break;
+	default:              r->ir_low = buspci;
+	}
+}
+
 // Look for an MP structure in the len bytes at physical address addr.
 static struct mp *
 mpsearch1(physaddr_t a, int len)
@@ -168,10 +244,14 @@ mp_init(void)
 	struct mp *mp;
 	struct mpconf *conf;
 	struct mpproc *proc;
+	struct mpbus *bus;
+	struct mpioapic *ioa;
+	bool buspci[MAXBUS];
 	uint8_t *p;
 	unsigned int i;
 
 	bootcpu = &cpus[0];
+	memset(buspci, 0, sizeof(buspci));
 	if ((conf = mpconfig(&mp)) == 0)
 		return;
 	ismp = 1;
@@ -193,8 +273,25 @@ mp_init(void)
 			p += sizeof(struct mpproc);
 			continue;
 		case MPBUS:
+			bus = (struct mpbus *)p;
+			buspci[bus->busid] = memcmp(bus->bustype, "PCI", 3) == 0;
+			p += 8;
+			continue;
 		case MPIOAPIC:
+			ioa = (struct mpioapic *)p;
+			// use the first usable one, which has the ISA IRQs
+			if ((ioa->flags & MPIOAPIC_EN) && !ioapicaddr) {
+				ioapicaddr = ioa->addr;
+				ioapicid = ioa->apicno;
+			}
+			p += 8;
+			continue;
 		case MPIOINTR:
+			// [MP 4.3] bus and I/O APIC entries come first
+			mpiointr((struct mpiointr *)p,
+				 buspci[((struct mpiointr *)p)->srcbus]);
+			p += 8;
+			continue;
 		case MPLINTR:
 			p += 8;
 			continue;
@@ -210,6 +307,7 @@ mp_init(void)
 		// Didn't like what we found; fall back to no MP.
 		ncpu = 1;
 		lapicaddr = 0;
+		ioapicaddr = 0;
 		cprintf("SMP: configuration not found, SMP disabled\n");
 		return;
 	}
@@ -0,0 +1,55 @@
+#include <inc/error.h>
+#include <inc/stdio.h>
+#include <kern/netdev.h>
+
+// network cards in the order they were attached,
+// which is the device index the net syscalls take
+static struct netdev netdevs[NETDEV_MAX];
+static int netdev_count = 0;
+
+// adds a card to the table, given its driver state and operations.
+// returns the device index of the card,
+// -E_NO_MEM if there are too many cards.
+int netdev_register(void *dev, const struct netdev_ops *ops) {
+    if (netdev_count == NETDEV_MAX) {
+        cprintf("netdev: ignoring %s, too many network cards\n", ops->nd_name);
+        return -E_NO_MEM;
+    }
+    netdevs[netdev_count].nd_dev = dev;
+    netdevs[netdev_count].nd_ops = ops;
+    cprintf("netdev: %s attached as device %d\n", ops->nd_name, netdev_count);
+    return netdev_count++;
+}
+
+// returns the card with the given device index, or NULL if there is none
+struct netdev *netdev_lookup(int index) {
+    if (index < 0 || index >= netdev_count) {
+        return NULL;
+    }
+    return &netdevs[index];
+}
+
+// passes the trap to every card, as several may share an IRQ line.
+// returns true if any of them handled it.
+bool netdev_handler(int trapno) {
+    int i;
+    bool handled = false;
+    for (i = 0; i < netdev_count; i++) {
+        struct netdev *nd = &netdevs[i];
+        if (nd->nd_ops->nd_handler(nd->nd_dev, trapno)) {
+            handled = true;
+        }
+    }
+    return handled;
+}
+
+// takes back the cards env was driving, as env is being freed
+void netdev_env_free(struct Env *env) {
+    int i;
+    for (i = 0; i < netdev_count; i++) {
+        struct netdev *nd = &netdevs[i];
+        if (nd->nd_ops->nd_release != NULL) {
+            nd->nd_ops->nd_release(nd->nd_dev, env);
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef JOS_KERN_NETDEV_H
+#define JOS_KERN_NETDEV_H
+
+#include <inc/env.h>
+#include <inc/ns.h>
+
+// most network cards the kernel drives at once
+#define NETDEV_MAX 4
+
+// operations of a network card driver, each given the driver state
+// of the card it was registered with
+struct netdev_ops {
+    const char *nd_name;
+    // transmits length bytes at addr, which must not cross a page.
+    // with more set the card may be told of the packet along with the next.
+    // returns 0 on success, -E_RX_FULL if the transmit queue is full.
+    int (*nd_transmit)(void *dev, void *addr, size_t length, bool more);
+    // transmits a packet gathered from nsg buffers, see sys_net_try_send_sg.
+    // NULL if the card can't gather packets or split TCP segments
+    int (*nd_transmit_sg)(void *dev, const struct jif_sg *sg, size_t nsg,
+                          uint16_t mss, bool track);
+    // returns the number of tracked packets the card finished sending
+    size_t (*nd_take_completed)(void *dev);
+    // maps the next received packet at addr, as a struct jif_pkt.
+    // returns 0 on success, -E_RX_EMPTY if no packet is available.
+    int (*nd_receive)(void *dev, void *addr);
+    void (*nd_read_mac)(void *dev, uint8_t *mac);
+    // hands the card over to env, see sys_net_bypass.
+    // NULL if the card can't be driven from userspace
+    int (*nd_bypass)(void *dev, struct Env *env, void *va);
+    // takes the card back from env, which is being freed, if it was
+    // handed over to env. NULL if nd_bypass is
+    void (*nd_release)(void *dev, struct Env *env);
+    // returns true if the trap was raised by the card, and handled
+    bool (*nd_handler)(void *dev, int trapno);
+};
+
+struct netdev {
+    void *nd_dev;
+    const struct netdev_ops *nd_ops;
+};
+
+int netdev_register(void *dev, const struct netdev_ops *ops);
+struct netdev *netdev_lookup(int index);
+bool netdev_handler(int trapno);
+void netdev_env_free(struct Env *env);
+
+#endif	// JOS_KERN_NETDEV_H
@@ -4,6 +4,9 @@
 #include <kern/pci.h>
 #include <kern/pcireg.h>
 #include <kern/e1000.h>
+#include <kern/virtio_net.h>
+#include <kern/virtio_blk.h>
+#include <kern/ide.h>
 
 // Flag to do "lspci" at bootup
 static int pci_show_devs = 1;
@@ -25,6 +28,7 @@ struct pci_driver {
 // pci_attach_class matches the class and subclass of a PCI device
 struct pci_driver pci_attach_class[] = {
 	{ PCI_CLASS_BRIDGE, PCI_SUBCLASS_BRIDGE_PCI, &pci_bridge_attach },
+	{ PCI_CLASS_MASS_STORAGE, PCI_SUBCLASS_MASS_STORAGE_IDE, &ide_dma_attach },
 	{ 0, 0, 0 },
 };
 
@@ -32,6 +36,8 @@ struct pci_driver pci_attach_class[] = {
 // and key2 should be the vendor ID and device ID respectively
 struct pci_driver pci_attach_vendor[] = {
     { E1000_VENDOR_ID, E1000_PRODUCT_ID, e1000_attach },
+    { VIRTIO_VENDOR_ID, VIRTIO_NET_PRODUCT_ID, virtio_net_attach },
+    { VIRTIO_VENDOR_ID, VIRTIO_BLK_PRODUCT_ID, virtio_blk_attach },
 	{ 0, 0, 0 },
 };
 
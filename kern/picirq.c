@@ -4,6 +4,7 @@
 #include <inc/trap.h>
 
 #include <kern/picirq.h>
+#include <kern/ioapic.h>
 
 
 // Current IRQ mask.
@@ -75,8 +76,15 @@ irq_setmask_8259A(uint16_t mask)
 	irq_mask_8259A = mask;
 	if (!didinit)
 		return;
-	outb(IO_PIC1+1, (char)mask);
-	outb(IO_PIC2+1, (char)(mask >> 8));
+	// with an IOAPIC, the mask only records the enabled IRQs,
+	// and the 8259A itself stays silent
+	if (ioapic_active()) {
+		outb(IO_PIC1+1, 0xFF);
+		outb(IO_PIC2+1, 0xFF);
+	} else {
+		outb(IO_PIC1+1, (char)mask);
+		outb(IO_PIC2+1, (char)(mask >> 8));
+	}
 	cprintf("enabled interrupts:");
 	for (i = 0; i < 16; i++)
 		if (~mask & (1<<i))
@@ -84,6 +92,15 @@ irq_setmask_8259A(uint16_t mask)
 	cprintf("\n");
 }
 
+// Enable the given IRQ, through the IOAPIC if there is one,
+// and the 8259A otherwise.
+void
+irq_enable(int irq)
+{
+	irq_setmask_8259A(irq_mask_8259A & ~(1 << irq));
+	ioapic_enable(irq);
+}
+
 void
 irq_eoi(void)
 {
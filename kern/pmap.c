@@ -10,6 +10,8 @@
 #include <kern/kclock.h>
 #include <kern/env.h>
 #include <kern/cpu.h>
+#include <kern/ipi.h>
+#include <kern/futex.h>
 
 // These variables are set by i386_detect_memory()
 size_t npages;			// Amount of physical memory (in pages)
@@ -202,6 +204,12 @@ mem_init(void)
 	boot_map_region(kern_pgdir, UENVS, envs_size, PADDR(envs), PTE_U | PTE_P);
 	boot_map_region(kern_pgdir, (uintptr_t)envs, envs_size, PADDR(envs), PTE_W | PTE_P);
 
+	// Map the per-CPU statistics read-only by the user at UCPUSTAT,
+	// just above the envs.
+	static_assert(NCPU * sizeof(struct CpuStat) <= PGSIZE);
+	assert(UENVS + envs_size <= UCPUSTAT);
+	boot_map_region(kern_pgdir, UCPUSTAT, PGSIZE, PADDR(cpu_stats), PTE_U | PTE_P);
+
 	//////////////////////////////////////////////////////////////////////
 	// Use the physical memory that 'bootstack' refers to as the kernel
 	// stack.  The kernel stack grows down from virtual address KSTACKTOP.
@@ -523,7 +531,8 @@ page_insert(pde_t *pgdir, struct PageInfo *pp, void *va, int perm)
 // can be used to verify page permissions for syscall arguments,
 // but should not be used by most callers.
 //
-// Return NULL if there is no page mapped at va.
+// Return NULL if there is no page mapped at va, or if va maps device
+// memory (see e1000_bypass), which has no PageInfo.
 //
 // Hint: the TA solution uses pgdir_walk and pa2page.
 //
@@ -538,6 +547,9 @@ page_lookup(pde_t *pgdir, void *va, pte_t **pte_store)
 	if ((*page_table_entry & PTE_P) == 0) {
 		return NULL;
 	}
+	if (PGNUM(*page_table_entry) >= npages) {
+		return NULL;
+	}
 	if (pte_store != NULL) {
 		*pte_store = page_table_entry;
 	}
@@ -567,23 +579,97 @@ page_remove(pde_t *pgdir, void *va)
 	pte_t *page_table_entry;
 	struct PageInfo *page = page_lookup(pgdir, va, &page_table_entry);
 	if (page == NULL) {
+		// device memory is unmapped too, but has no page to release
+		page_table_entry = pgdir_walk(pgdir, va, false);
+		if (page_table_entry != NULL && (*page_table_entry & PTE_P)) {
+			tlb_invalidate(pgdir, va);
+			*page_table_entry = 0;
+		}
 		return;
 	}
 	tlb_invalidate(pgdir, va);
 	memset(page_table_entry, 0, sizeof(pte_t));
+	futex_wake_page(page2pa(page));
 	page_decref(page);
 }
 
+// Invalidations still owed by CPUs that have another CPU's pgdir
+// loaded.  They are queued by tlb_invalidate and sent out together by
+// tlb_shootdown_flush, so that a syscall that edits many pages of a
+// shared address space costs one IPI per CPU, not one per page.
+// Protected by the big kernel lock.
+#define TLB_BATCH_MAX	16
+
+static struct {
+	pde_t *pgdir;
+	uint32_t cpus;		// Bit i set if cpus[i] must invalidate
+	int n;			// > TLB_BATCH_MAX means flush the whole TLB
+	void *va[TLB_BATCH_MAX];
+} tlb_batch;
+
 //
 // Invalidate a TLB entry, but only if the page tables being
 // edited are the ones currently in use by the processor.
+// Other CPUs running on the same page tables are queued an
+// invalidation; see tlb_shootdown_flush.
 //
 void
 tlb_invalidate(pde_t *pgdir, void *va)
 {
+	struct CpuInfo *c;
+	uint32_t mask = 0;
+
 	// Flush the entry only if we're modifying the current address space.
 	if (!curenv || curenv->env_pgdir == pgdir)
 		invlpg(va);
+
+	for (c = cpus; c < cpus + ncpu; c++)
+		if (c != thiscpu && c->cpu_env && c->cpu_env->env_pgdir == pgdir)
+			mask |= 1 << (c - cpus);
+	if (!mask)
+		return;
+
+	if (tlb_batch.n && tlb_batch.pgdir != pgdir)
+		tlb_shootdown_flush();
+	tlb_batch.pgdir = pgdir;
+	tlb_batch.cpus |= mask;
+	if (tlb_batch.n < TLB_BATCH_MAX)
+		tlb_batch.va[tlb_batch.n] = va;
+	if (tlb_batch.n <= TLB_BATCH_MAX)
+		tlb_batch.n++;
+}
+
+// Run on each target of a shootdown.  A CPU that has switched to other
+// page tables since it was queued already lost the stale entries.
+static void
+tlb_shootdown_cpu(void *arg)
+{
+	int i;
+
+	if (rcr3() != PADDR(tlb_batch.pgdir))
+		return;
+	if (tlb_batch.n > TLB_BATCH_MAX) {
+		tlbflush();
+		return;
+	}
+	for (i = 0; i < tlb_batch.n; i++)
+		invlpg(tlb_batch.va[i]);
+}
+
+//
+// Send the queued invalidations to the other CPUs and wait for them
+// to be done.  Called before this CPU leaves the kernel, so that every
+// syscall's page table changes are visible everywhere once it returns.
+//
+void
+tlb_shootdown_flush(void)
+{
+	if (!tlb_batch.n)
+		return;
+	ipi_call_cpus(tlb_batch.cpus, tlb_shootdown_cpu, NULL);
+	tlb_batch.pgdir = NULL;
+	tlb_batch.cpus = 0;
+	tlb_batch.n = 0;
 }
 
 //
@@ -646,6 +732,9 @@ static uintptr_t user_mem_check_addr;
 // If there is an error, set the 'user_mem_check_addr' variable to the first
 // erroneous virtual address.
 //
+// Device memory mapped in the env (see e1000_bypass) is refused, as the
+// kernel takes the pages of the ranges it checks with page_lookup.
+//
 // Returns 0 if the user program can access this range of addresses,
 // and -E_FAULT otherwise.
 //
@@ -666,7 +755,7 @@ user_mem_check(struct Env *env, const void *va, size_t len, int perm)
             return -E_FAULT;
         }
         pte_t *pte = pgdir_walk(env->env_pgdir, (void*)page_addr, false);
-        if (pte == NULL || (*pte | perm | PTE_P) != *pte) {
+        if (pte == NULL || (*pte | perm | PTE_P) != *pte || PGNUM(*pte) >= npages) {
 			if (page_addr<(uintptr_t)va){
 				user_mem_check_addr = (uintptr_t)va;
 			}
@@ -697,6 +786,27 @@ user_mem_assert(struct Env *env, const void *va, size_t len, int perm)
 	}
 }
 
+//
+// Count the pages mapped below UTOP in pgdir.
+//
+size_t
+user_page_count(pde_t *pgdir)
+{
+	size_t n = 0;
+	pte_t *pt;
+	int i, j;
+
+	for (i = 0; i < PDX(UTOP); i++) {
+		if (!(pgdir[i] & PTE_P))
+			continue;
+		pt = (pte_t *) KADDR(PTE_ADDR(pgdir[i]));
+		for (j = 0; j < NPTENTRIES; j++)
+			if (pt[j] & PTE_P)
+				n++;
+	}
+	return n;
+}
+
 // changes the permissions of all pages mapped to the given virtual address range
 void change_page_perm(MemoryRange range, int perm) {
 	assert(range.type == VIRTUAL);
@@ -1019,6 +1129,7 @@ check_kern_pgdir(void)
 	n = ROUNDUP(NENV*sizeof(struct Env), PGSIZE);
 	for (i = 0; i < n; i += PGSIZE)
 		assert(check_va2pa(pgdir, UENVS + i) == PADDR(envs) + i);
+	assert(check_va2pa(pgdir, UCPUSTAT) == PADDR(cpu_stats));
 
 	// check phys mem
 	for (i = 0; i < npages * PGSIZE; i += PGSIZE)
@@ -74,11 +74,13 @@ struct PageInfo *page_lookup(pde_t *pgdir, void *va, pte_t **pte_store);
 void	page_decref(struct PageInfo *pp);
 
 void	tlb_invalidate(pde_t *pgdir, void *va);
+void	tlb_shootdown_flush(void);
 
 void *	mmio_map_region(physaddr_t pa, size_t size);
 
 int	user_mem_check(struct Env *env, const void *va, size_t len, int perm);
 void	user_mem_assert(struct Env *env, const void *va, size_t len, int perm);
+size_t	user_page_count(pde_t *pgdir);
 void    change_page_perm(MemoryRange range, int perm);
 void    show_pages(MemoryRange range);
 void    dump_range(MemoryRange range);
@@ -0,0 +1,388 @@
+// Sampling profiler.
+//
+// While profiling is on, every LAPIC timer interrupt records where the
+// CPU was: the interrupted EIP, the env and mode it was running in, and
+// the first few return addresses found by following the saved %ebp
+// chain.  Samples go into a ring per CPU, so CPUs never contend for a
+// slot and the newest PROF_NSAMPLE samples of each CPU are kept.
+//
+// The kernel runs with interrupts off, so kernel-mode samples only come
+// from CPUs halted in sched_halt; they measure idle time.
+//
+// Reports symbolize samples with the stabs of the kernel or of the
+// sampled env's binary (see debuginfo_env_eip), so user samples can be
+// named only while their env is still alive.  Everything here runs
+// under the big kernel lock.
+
+#include <inc/error.h>
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/syscall.h>
+#include <inc/memlayout.h>
+#include <inc/x86.h>
+
+#include <kern/cpu.h>
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/trap.h>
+#include <kern/kdebug.h>
+#include <kern/prof.h>
+
+#define PROF_NSAMPLE	512	// Samples kept per CPU
+#define PROF_DEPTH	4	// Callers kept per sample
+#define PROF_NFN	256	// Distinct functions in one report
+#define PROF_NARC	512	// Distinct caller->callee arcs in one report
+#define PROF_NAMELEN	24
+
+struct ProfSample {
+	envid_t ps_env;			// Sampled env, 0 in the kernel
+	bool ps_user;			// Sampled in user mode
+	uintptr_t ps_pc[1 + PROF_DEPTH]; // EIP, then return addresses;
+					 //  0 after the last one
+};
+
+static struct ProfRing {
+	struct ProfSample pr_samples[PROF_NSAMPLE];
+	uint32_t pr_next;		// Samples taken since the last reset
+} prof_rings[NCPU];
+
+static volatile bool prof_on;
+
+// Report tables, rebuilt from the rings by each report
+struct ProfFn {
+	envid_t pf_env;
+	uintptr_t pf_addr;		// Start of the function
+	uint32_t pf_self;		// Samples in the function itself
+	uint32_t pf_total;		// Samples in it or its callees
+	char pf_name[PROF_NAMELEN];
+};
+
+struct ProfArc {
+	envid_t pa_env;
+	uintptr_t pa_from, pa_to;	// Caller and callee starts
+	uint32_t pa_count;
+};
+
+static struct ProfFn prof_fns[PROF_NFN];
+static struct ProfArc prof_arcs[PROF_NARC];
+static int prof_nfn, prof_narc;
+static uint32_t prof_lost;		// Samples that did not fit
+
+// Is fp a frame pointer we can follow in the sampled context?
+static bool
+prof_frame_ok(const uint32_t *fp, bool user)
+{
+	extern char end[];
+	uintptr_t top;
+
+	if (fp == NULL || (uintptr_t) fp % sizeof(uint32_t))
+		return false;
+	if (user)
+		return user_mem_check(curenv, fp, 2 * sizeof(uint32_t),
+				      PTE_U) == 0;
+	// Kernel frames live on this CPU's kernel stack, or on the boot
+	// stack in the kernel image.
+	top = KSTACKTOP - cpunum() * (KSTKSIZE + KSTKGAP);
+	if ((uintptr_t) fp >= top - KSTKSIZE
+	    && (uintptr_t) fp + 2 * sizeof(uint32_t) <= top)
+		return true;
+	return (uintptr_t) fp >= KERNBASE
+		&& (uintptr_t) fp + 2 * sizeof(uint32_t) <= (uintptr_t) end;
+}
+
+// Record a sample of the context in tf.  Called on every LAPIC timer
+// interrupt.
+void
+prof_sample(struct Trapframe *tf)
+{
+	struct ProfRing *pr = &prof_rings[cpunum()];
+	struct ProfSample *ps;
+	const uint32_t *fp;
+	int n;
+
+	if (!prof_on)
+		return;
+
+	ps = &pr->pr_samples[pr->pr_next++ % PROF_NSAMPLE];
+	ps->ps_user = (tf->tf_cs & 3) == 3;
+	ps->ps_env = ps->ps_user ? curenv->env_id : 0;
+	ps->ps_pc[0] = tf->tf_eip;
+
+	n = 1;
+	fp = (const uint32_t *) tf->tf_regs.reg_ebp;
+	while (n <= PROF_DEPTH && prof_frame_ok(fp, ps->ps_user)
+	       && fp[1] != 0) {
+		ps->ps_pc[n++] = fp[1];
+		// frames move up the stack; anything else is garbage
+		if ((const uint32_t *) fp[0] <= fp)
+			break;
+		fp = (const uint32_t *) fp[0];
+	}
+	for (; n <= PROF_DEPTH; n++)
+		ps->ps_pc[n] = 0;
+}
+
+// Find or add the report entry for the function containing pc.  The
+// address space of env_id must be loaded if pc is a user address.
+static struct ProfFn *
+prof_fn(struct Env *e, envid_t env_id, uintptr_t pc)
+{
+	struct Eipdebuginfo info;
+	struct ProfFn *pf;
+	int i, len;
+
+	if (e || pc >= ULIM)
+		debuginfo_env_eip(e, pc, &info);
+	else {
+		// the env is gone, and its symbols with it
+		info.eip_fn_addr = pc;
+		info.eip_fn_name = "?";
+		info.eip_fn_namelen = 1;
+	}
+
+	for (i = 0; i < prof_nfn; i++)
+		if (prof_fns[i].pf_env == env_id
+		    && prof_fns[i].pf_addr == info.eip_fn_addr)
+			return &prof_fns[i];
+	if (prof_nfn == PROF_NFN)
+		return NULL;
+
+	pf = &prof_fns[prof_nfn++];
+	pf->pf_env = env_id;
+	pf->pf_addr = info.eip_fn_addr;
+	pf->pf_self = pf->pf_total = 0;
+	len = MIN(info.eip_fn_namelen, PROF_NAMELEN - 1);
+	memmove(pf->pf_name, info.eip_fn_name, len);
+	pf->pf_name[len] = '\0';
+	return pf;
+}
+
+static void
+prof_arc(envid_t env_id, uintptr_t from, uintptr_t to)
+{
+	int i;
+
+	for (i = 0; i < prof_narc; i++)
+		if (prof_arcs[i].pa_env == env_id
+		    && prof_arcs[i].pa_from == from
+		    && prof_arcs[i].pa_to == to) {
+			prof_arcs[i].pa_count++;
+			return;
+		}
+	if (prof_narc < PROF_NARC) {
+		prof_arcs[prof_narc].pa_env = env_id;
+		prof_arcs[prof_narc].pa_from = from;
+		prof_arcs[prof_narc].pa_to = to;
+		prof_arcs[prof_narc].pa_count = 1;
+		prof_narc++;
+	}
+}
+
+// Charge one sample to its functions and arcs.
+static void
+prof_account(struct Env *e, struct ProfSample *ps)
+{
+	struct ProfFn *fns[1 + PROF_DEPTH];
+	uintptr_t pc;
+	int n, i;
+
+	for (n = 0; n <= PROF_DEPTH && ps->ps_pc[n]; n++) {
+		// a return address may be just past the end of the
+		// calling function, so look up the call instruction
+		pc = n == 0 ? ps->ps_pc[n] : ps->ps_pc[n] - 1;
+		if (!(fns[n] = prof_fn(e, ps->ps_env, pc))) {
+			prof_lost++;
+			return;
+		}
+	}
+
+	fns[0]->pf_self++;
+	for (n = 0; n <= PROF_DEPTH && ps->ps_pc[n]; n++) {
+		// count recursive functions once per sample
+		for (i = 0; i < n && fns[i] != fns[n]; i++)
+			;
+		if (i == n)
+			fns[n]->pf_total++;
+		if (n > 0)
+			prof_arc(ps->ps_env, fns[n]->pf_addr,
+				 fns[n - 1]->pf_addr);
+	}
+}
+
+// Build the report tables from every CPU's ring.  Returns the number of
+// samples.
+static uint32_t
+prof_collect(void)
+{
+	struct ProfSample *ps;
+	struct Env *e, *loaded;
+	uint32_t nsamples = 0;
+	int cpu, i, n;
+
+	prof_nfn = prof_narc = 0;
+	prof_lost = 0;
+	loaded = curenv;
+	for (cpu = 0; cpu < ncpu; cpu++) {
+		n = MIN(prof_rings[cpu].pr_next, PROF_NSAMPLE);
+		for (i = 0; i < n; i++) {
+			ps = &prof_rings[cpu].pr_samples[i];
+			e = NULL;
+			if (ps->ps_user
+			    && envid2env(ps->ps_env, &e, 0) == 0
+			    && e != loaded) {
+				// symbolize against the env's own binary
+				lcr3(PADDR(e->env_pgdir));
+				loaded = e;
+			}
+			prof_account(e, ps);
+			nsamples++;
+		}
+	}
+	if (loaded != curenv)
+		lcr3(PADDR(curenv ? curenv->env_pgdir : kern_pgdir));
+	return nsamples;
+}
+
+static void
+prof_sort(bool by_total)
+{
+	struct ProfFn tmp;
+	int i, j;
+
+	for (i = 1; i < prof_nfn; i++) {
+		tmp = prof_fns[i];
+		for (j = i; j > 0; j--) {
+			if (by_total ? prof_fns[j - 1].pf_total >= tmp.pf_total
+			    : prof_fns[j - 1].pf_self >= tmp.pf_self)
+				break;
+			prof_fns[j] = prof_fns[j - 1];
+		}
+		prof_fns[j] = tmp;
+	}
+}
+
+static const char *
+prof_env_name(envid_t env_id)
+{
+	static char buf[16];
+
+	if (env_id == 0)
+		return "kernel";
+	snprintf(buf, sizeof(buf), "%08x", env_id);
+	return buf;
+}
+
+static const char *
+prof_fn_name(envid_t env_id, uintptr_t addr)
+{
+	int i;
+
+	for (i = 0; i < prof_nfn; i++)
+		if (prof_fns[i].pf_env == env_id && prof_fns[i].pf_addr == addr)
+			return prof_fns[i].pf_name;
+	return "?";
+}
+
+static uint32_t
+prof_header(void)
+{
+	uint32_t nsamples = prof_collect();
+
+	cprintf("%u samples, %d functions", nsamples, prof_nfn);
+	if (prof_lost)
+		cprintf(", %u samples not charged", prof_lost);
+	cprintf("\n");
+	return nsamples;
+}
+
+// Print up to top functions by the samples spent in them.
+static void
+prof_flat(int top)
+{
+	uint32_t nsamples = prof_header();
+	struct ProfFn *pf;
+	int i;
+
+	if (nsamples == 0)
+		return;
+	prof_sort(false);
+	cprintf("   self      total  env       function\n");
+	for (i = 0; i < prof_nfn && i < top; i++) {
+		pf = &prof_fns[i];
+		if (pf->pf_self == 0)
+			break;
+		cprintf("%5u %3u%%  %5u  %-8s  %s [%08x]\n",
+			pf->pf_self, pf->pf_self * 100 / nsamples,
+			pf->pf_total, prof_env_name(pf->pf_env),
+			pf->pf_name, pf->pf_addr);
+	}
+}
+
+// Print up to top functions by the samples spent in them and their
+// callees, each followed by its callers (<-) and callees (->).
+static void
+prof_graph(int top)
+{
+	uint32_t nsamples = prof_header();
+	struct ProfFn *pf;
+	struct ProfArc *pa;
+	int i, j;
+
+	if (nsamples == 0)
+		return;
+	prof_sort(true);
+	cprintf("  total      self  env       function\n");
+	for (i = 0; i < prof_nfn && i < top; i++) {
+		pf = &prof_fns[i];
+		cprintf("%5u %3u%%  %5u  %-8s  %s [%08x]\n",
+			pf->pf_total, pf->pf_total * 100 / nsamples,
+			pf->pf_self, prof_env_name(pf->pf_env),
+			pf->pf_name, pf->pf_addr);
+		for (j = 0; j < prof_narc; j++) {
+			pa = &prof_arcs[j];
+			if (pa->pa_env == pf->pf_env && pa->pa_to == pf->pf_addr)
+				cprintf("                  <- %5u  %s\n",
+					pa->pa_count,
+					prof_fn_name(pa->pa_env, pa->pa_from));
+		}
+		for (j = 0; j < prof_narc; j++) {
+			pa = &prof_arcs[j];
+			if (pa->pa_env == pf->pf_env && pa->pa_from == pf->pf_addr)
+				cprintf("                  -> %5u  %s\n",
+					pa->pa_count,
+					prof_fn_name(pa->pa_env, pa->pa_to));
+		}
+	}
+}
+
+// Control the profiler; op is one of the PROF_* operations in
+// inc/syscall.h.  The reports print at most arg functions, or 20 if arg
+// is not positive.  Returns 0 on success, -E_INVAL for an unknown op.
+int
+prof_ctl(int op, int arg)
+{
+	int cpu;
+
+	if (arg <= 0)
+		arg = 20;
+	switch (op) {
+	case PROF_START:
+		prof_on = true;
+		return 0;
+	case PROF_STOP:
+		prof_on = false;
+		return 0;
+	case PROF_RESET:
+		for (cpu = 0; cpu < NCPU; cpu++)
+			prof_rings[cpu].pr_next = 0;
+		return 0;
+	case PROF_FLAT:
+		prof_flat(arg);
+		return 0;
+	case PROF_GRAPH:
+		prof_graph(arg);
+		return 0;
+	default:
+		return -E_INVAL;
+	}
+}
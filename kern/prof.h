@@ -0,0 +1,16 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_PROF_H
+#define JOS_KERN_PROF_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+struct Trapframe;
+
+void prof_sample(struct Trapframe *tf);
+int prof_ctl(int op, int arg);
+
+#endif	// !JOS_KERN_PROF_H
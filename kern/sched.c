@@ -4,16 +4,164 @@
 #include <kern/env.h>
 #include <kern/pmap.h>
 #include <kern/monitor.h>
+#include <kern/ipi.h>
+#include <kern/cpu.h>
+#include <kern/trace.h>
 
+void sched_yield(void);
 void sched_halt(void);
 
+// Whether e's affinity lets it run on cpus[cpu].
+static bool
+sched_allowed(struct Env *e, int cpu)
+{
+	return e->env_affinity & (1 << cpu);
+}
+
+// Ticks in a time slice at each priority level.  Urgent levels get
+// short slices so that a CPU-bound env drops down quickly.
+#define SCHED_SLICE(level)	(1 << (level))
+
+// Every SCHED_BOOST_TICKS ticks every env goes back to its base
+// priority, so that low levels are not starved forever.
+#define SCHED_BOOST_TICKS	100
+
+// Make e runnable and get a CPU to run it without waiting for the next
+// timer tick.  An env that blocked gets its base priority back, so
+// servers that wait on IPC or I/O stay ahead of CPU hogs.
+//
+// The CPU it last ran on, or was placed on, is kicked if it is halted.
+// If that is this CPU, the kick waits for sched_handoff: e is usually
+// the partner of the env running here, and if that one blocks next,
+// running e here keeps their shared data in this CPU's cache.
+// Otherwise any halted CPU that e may run on is kicked, and failing
+// that, its preferred CPU is preempted if it is running something less
+// urgent than e.
+void
+sched_wakeup(struct Env *e)
+{
+	struct Env *running;
+
+	e->env_status = ENV_RUNNABLE;
+	e->env_level = e->env_priority;
+	e->env_slice_used = 0;
+	if (e->env_pref_cpu == cpunum() && sched_allowed(e, cpunum())) {
+		thiscpu->cpu_handoff = e;
+		return;
+	}
+	if (ipi_wake_idle(e->env_pref_cpu, e->env_affinity))
+		return;
+	if (e->env_pref_cpu < 0 || !sched_allowed(e, e->env_pref_cpu))
+		return;
+	running = cpus[e->env_pref_cpu].cpu_env;
+	if (running && running->env_level > e->env_level)
+		ipi_preempt(e->env_pref_cpu);
+}
+
+// Called by env_run before this CPU goes back to user mode in next.
+// If that is not the env sched_wakeup left for this CPU, because the
+// waker kept running instead of blocking, or something more urgent
+// came first, any halted CPU e may run on is kicked after all.
+void
+sched_handoff(struct Env *next)
+{
+	struct Env *e = thiscpu->cpu_handoff;
+
+	thiscpu->cpu_handoff = NULL;
+	if (e && e != next && e->env_status == ENV_RUNNABLE)
+		ipi_wake_idle(-1, e->env_affinity);
+}
+
+// Place e next to the current env, which just handed it work, when
+// e may run on this CPU.
+void
+sched_place_near(struct Env *e)
+{
+	if (sched_allowed(e, cpunum()))
+		e->env_pref_cpu = cpunum();
+}
+
+// Find the runnable env this CPU should run next, other than curenv:
+// the most urgent one, preferring envs whose caches and TLB entries
+// are on this CPU, and going round robin among equals.
+static struct Env *
+sched_pick(int cpu)
+{
+	struct Env *best = NULL;
+	int best_score = 0;
+	envid_t env_id;
+	int i;
+
+	if (curenv == NULL) {
+		// start from the begining
+		env_id = 0;
+	} else {
+		// start from the next entry in env, after the one that just ran
+		env_id = curenv->env_id + 1;
+	}
+
+	for (i = 0; i < NENV; i++) {
+		struct Env *env = &envs[(env_id + i) % NENV];
+		int score;
+
+		if (env->env_status != ENV_RUNNABLE || !sched_allowed(env, cpu))
+			continue;
+		score = env->env_level * 2 + (env->env_pref_cpu != cpu);
+		if (best == NULL || score < best_score) {
+			best = env;
+			best_score = score;
+			if (score == 0)
+				break;
+		}
+	}
+	return best;
+}
+
+// Account a timer tick to the env running on this CPU and reschedule.
+// An env that used up its time slice moves down a priority level; one
+// that did not keeps the CPU unless something more urgent is waiting.
+void
+sched_tick(void)
+{
+	static unsigned boost_ticks;
+	struct Env *e = curenv;
+	struct Env *next;
+	int i;
+
+	if (cpunum() == bootcpu->cpu_id && ++boost_ticks >= SCHED_BOOST_TICKS) {
+		boost_ticks = 0;
+		for (i = 0; i < NENV; i++) {
+			envs[i].env_level = envs[i].env_priority;
+			envs[i].env_slice_used = 0;
+		}
+	}
+
+	if (e != NULL && e->env_status == ENV_RUNNING) {
+		if (++e->env_slice_used >= SCHED_SLICE(e->env_level)) {
+			e->env_slice_used = 0;
+			if (e->env_level < ENV_NPRIO - 1)
+				e->env_level++;
+		} else if (sched_allowed(e, cpunum())) {
+			next = sched_pick(cpunum());
+			if (next == NULL || next->env_level >= e->env_level)
+				env_run(e);
+		}
+	}
+	sched_yield();
+}
+
 // Choose a user environment to run and run it.
 void
 sched_yield(void)
 {
 	struct Env *idle;
 
-	// Implement simple round-robin scheduling.
+	TRACE(TRACE_SCHED_YIELD, 0, 0);
+
+	// Pick the most urgent runnable env (see sched_pick), going
+	// round robin among envs of the same priority level.
+	//
+	// Originally: implement simple round-robin scheduling.
 	//
 	// Search through 'envs' for an ENV_RUNNABLE environment in
 	// circular fashion starting just after the env this CPU was
@@ -29,28 +177,22 @@ sched_yield(void)
 	// below to halt the cpu.
 
 	// LAB 4: Your code here.
-    envid_t env_id;
-
-    if (curenv == NULL) {
-        // start from the begining
-        env_id = 0;
-    } else {
-        // start from the next entry in env, after the one that just ran
-        env_id = curenv->env_id + 1;
-    }
+    int cpu = cpunum();
+    struct Env *next = sched_pick(cpu);
 
-    int i;
-    for (i = 0; i < NENV; i++) {
-        struct Env *env = &envs[(env_id + i) % NENV];
-        if (env->env_status == ENV_RUNNABLE) {
-            // running first available env
-            env_run(env);
+    if (curenv != NULL && curenv->env_status == ENV_RUNNING) {
+        if (!sched_allowed(curenv, cpu)) {
+            // its affinity no longer includes this cpu, hand it over
+            curenv->env_pref_cpu = -1;
+            sched_wakeup(curenv);
+        } else if (next == NULL || next->env_level > curenv->env_level) {
+            // nothing as urgent can run, continueing curenv
+            env_run(curenv);
         }
     }
 
-    if (curenv != NULL && curenv->env_status == ENV_RUNNING) {
-        // no other env can run, continueing curenv
-        env_run(curenv);
+    if (next != NULL) {
+        env_run(next);
     }
 
 	// sched_halt never returns
@@ -58,7 +200,7 @@ sched_yield(void)
 }
 
 // Halt this CPU when there is nothing to do. Wait until the
-// timer interrupt wakes it up. This function never returns.
+// timer interrupt or a wakeup IPI wakes it up. This function never returns.
 //
 void
 sched_halt(void)
@@ -82,12 +224,18 @@ sched_halt(void)
 	}
 
 	// Mark that no environment is running on this CPU
+	tlb_shootdown_flush();
+	env_charge(false);
+	TRACE(TRACE_SCHED_HALT, 0, 0);
+	thiscpu->cpu_stat->cs_halts++;
 	curenv = NULL;
 	lcr3(PADDR(kern_pgdir));
 
 	// Mark that this CPU is in the HALT state, so that when
 	// timer interupts come in, we know we should re-acquire the
 	// big kernel lock
+	thiscpu->cpu_ipi_kicked = false;
+	thiscpu->cpu_halt_tsc = read_tsc();
 	xchg(&thiscpu->cpu_status, CPU_HALTED);
 
 	// Release the big kernel lock as if we were "leaving" the kernel
@@ -6,7 +6,13 @@
 # error "This is a JOS kernel header; user programs should not #include it"
 #endif
 
-// This function does not return.
+struct Env;
+
+// These functions do not return.
 void sched_yield(void) __attribute__((noreturn));
+void sched_tick(void) __attribute__((noreturn));
+void sched_wakeup(struct Env *e);
+void sched_place_near(struct Env *e);
+void sched_handoff(struct Env *next);
 
 #endif	// !JOS_KERN_SCHED_H
@@ -8,6 +8,7 @@
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
 #include <kern/kdebug.h>
+#include <kern/ipi.h>
 
 // The big kernel lock
 struct spinlock kernel_lock = {
@@ -68,8 +69,12 @@ spin_lock(struct spinlock *lk)
 	// The xchg is atomic.
 	// It also serializes, so that reads after acquire are not
 	// reordered before it. 
-	while (xchg(&lk->locked, 1) != 0)
+	// Interrupts are off while spinning, so serve cross-CPU calls
+	// here: the lock holder may be waiting on one of them.
+	while (xchg(&lk->locked, 1) != 0) {
+		ipi_poll();
 		asm volatile ("pause");
+	}
 
 	// Record info about lock acquisition for debugging.
 #ifdef DEBUG_SPINLOCK
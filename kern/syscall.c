@@ -12,7 +12,12 @@
 #include <kern/console.h>
 #include <kern/sched.h>
 #include <kern/time.h>
-#include <kern/e1000.h>
+#include <kern/netdev.h>
+#include <kern/futex.h>
+#include <kern/prof.h>
+#include <kern/trace.h>
+#include <kern/ide.h>
+#include <kern/virtio_blk.h>
 
 // returns true if the given address
 // can be mapped to in user mode
@@ -42,7 +47,11 @@ static bool is_valid_perm(int perm) {
 // Print a string to the system console.
 // The string is exactly 'len' characters long.
 // Destroys the environment on memory errors.
-static void
+//
+// Returns the number of characters printed without waiting for the
+// serial port.  If that is none, the console is backed up and the env
+// sleeps until it drains; call again for the rest.
+static int
 sys_cputs(const char *s, size_t len)
 {
 	// Check that the user has permission to read memory [s, s+len).
@@ -52,7 +61,12 @@ sys_cputs(const char *s, size_t len)
 	user_mem_assert(curenv, (void*)s, len, PTE_U);
 
 	// Print the string supplied by the user.
-	cprintf("%.*s", len, s);
+	size_t n = cons_write(s, len);
+	if (n == 0 && len > 0) {
+		curenv->env_waits_for_output = true;
+		curenv->env_status = ENV_WAITING_FOR_IO;
+	}
+	return n;
 }
 
 // Read a character from the system console without blocking.
@@ -70,7 +84,9 @@ sys_getenvid(void)
 	return curenv->env_id;
 }
 
-// Destroy a given environment (possibly the currently running environment).
+// Destroy a given environment (possibly the currently running environment),
+// along with every thread sharing its address space: this ends a program.
+// See sys_thread_exit to end a single thread.
 //
 // Returns 0 on success, < 0 on error.  Errors are:
 //	-E_BAD_ENV if environment envid doesn't currently exist,
@@ -83,7 +99,7 @@ sys_env_destroy(envid_t envid)
 
 	if ((r = envid2env(envid, &e, 1)) < 0)
 		return r;
-	env_destroy(e);
+	env_destroy_threads(e);
 	return 0;
 }
 
@@ -115,6 +131,8 @@ sys_exofork(void)
     }
 
     new_env->env_status = ENV_NOT_RUNNABLE;
+    new_env->env_affinity = curenv->env_affinity;
+    new_env->env_priority = new_env->env_level = curenv->env_priority;
     new_env->env_tf = curenv->env_tf;
     new_env->env_tf.tf_regs.reg_eax = 0;
 
@@ -148,8 +166,126 @@ sys_env_set_status(envid_t envid, int status)
         return -E_INVAL;
     }
 
-    env->env_status = status;
+    if (status == ENV_RUNNABLE) {
+        sched_wakeup(env);
+    } else {
+        env->env_status = status;
+    }
+
+    return 0;
+}
+
+// Restrict envid to the CPUs in 'mask', where bit i stands for the
+// CPU whose thisenv->env_cpunum is i.  Bits for CPUs that do not exist
+// are ignored.  Children created with sys_exofork inherit the mask.
+// If the caller excludes the CPU it is running on, it moves at once.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if mask contains no existing CPU.
+static int
+sys_env_set_affinity(envid_t envid, uint32_t mask)
+{
+    struct Env *env;
+    int r = envid2env(envid, &env, true);
+    if (r < 0) {
+        return r;
+    }
+
+    mask &= (1 << ncpu) - 1;
+    if (mask == 0) {
+        return -E_INVAL;
+    }
+
+    env->env_affinity = mask;
+    if (env->env_pref_cpu >= 0 && !(mask & (1 << env->env_pref_cpu))) {
+        env->env_pref_cpu = -1;
+    }
+
+    if (env == curenv && !(mask & (1 << cpunum()))) {
+        curenv->env_tf.tf_regs.reg_eax = 0;
+        sched_yield();
+    }
+    return 0;
+}
+
+// Create a thread: a new environment that shares the caller's address
+// space, starting at eip with stack pointer esp.  Its user exception
+// stack is the page below xstacktop, and tls is stored in its env_tls
+// for the user library.  It inherits the caller's page fault upcall,
+// affinity and priority, and is runnable at once.
+//
+// Returns envid of the new thread on success, < 0 on error.  Errors are:
+//	-E_INVAL if xstacktop is not a page-aligned user address.
+//	-E_NO_FREE_ENV if no free environment is available.
+static envid_t
+sys_thread_create(uintptr_t eip, uintptr_t esp, uintptr_t xstacktop, void *tls)
+{
+    struct Env *thread;
+    int r;
+
+    if (xstacktop % PGSIZE || xstacktop < PGSIZE || xstacktop > UTOP) {
+        return -E_INVAL;
+    }
+
+    r = env_alloc_thread(&thread, curenv->env_id, curenv->env_pgdir);
+    if (r < 0) {
+        return r;
+    }
+
+    thread->env_type = curenv->env_type;
+    thread->env_tf = curenv->env_tf;
+    thread->env_tf.tf_eip = eip;
+    thread->env_tf.tf_esp = esp;
+    thread->env_xstacktop = xstacktop;
+    thread->env_tls = tls;
+    thread->env_pgfault_upcall = curenv->env_pgfault_upcall;
+    thread->env_affinity = curenv->env_affinity;
+    thread->env_priority = thread->env_level = curenv->env_priority;
+
+    sched_wakeup(thread);
+    return thread->env_id;
+}
 
+// End the calling thread alone; the other threads of its program keep
+// running.  Does not return.
+static void
+sys_thread_exit(void)
+{
+    env_destroy(curenv);
+}
+
+// Set envid's base scheduling priority to one of the ENV_PRIO_* levels
+// (0 is the most urgent).  Children created with sys_exofork inherit
+// it.  A user environment may always be lowered, but raised no higher
+// than the caller's own priority, and never to ENV_PRIO_HIGH, which is
+// kept for the file and network servers.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if priority is not a valid priority,
+//		or envid may not be raised to it.
+static int
+sys_env_set_priority(envid_t envid, int priority)
+{
+    struct Env *env;
+    int r = envid2env(envid, &env, true);
+    if (r < 0) {
+        return r;
+    }
+
+    if (priority < 0 || priority >= ENV_NPRIO) {
+        return -E_INVAL;
+    }
+    if (env->env_type == ENV_TYPE_USER && priority < env->env_priority
+        && (priority == ENV_PRIO_HIGH || priority < curenv->env_priority)) {
+        return -E_INVAL;
+    }
+
+    env->env_priority = env->env_level = priority;
+    env->env_slice_used = 0;
     return 0;
 }
 
@@ -430,9 +566,14 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
     target_env->env_ipc_value = value;
     target_env->env_ipc_recving = false;
     target_env->env_ipc_from = curenv->env_id;
+    target_env->env_stat.es_ipc_recvs++;
+    curenv->env_stat.es_ipc_sends++;
+    TRACE(TRACE_IPC_SEND, target_env->env_id, value);
     // set the return value of recv to 0 for success
     target_env->env_tf.tf_regs.reg_eax = 0;
-    target_env->env_status = ENV_RUNNABLE;
+    // keep IPC partners on the same cpu
+    sched_place_near(target_env);
+    sched_wakeup(target_env);
     return 0;
 }
 
@@ -455,6 +596,16 @@ sys_ipc_recv(void *dstva)
         && ROUNDDOWN(dstva, PGSIZE) != dstva) {
         return -E_INVAL;
     }
+    TRACE(TRACE_IPC_RECV, !curenv->env_notify_pending, 0);
+    // a kernel notification is already waiting, see env_notify
+    if (curenv->env_notify_pending) {
+        curenv->env_notify_pending = false;
+        curenv->env_ipc_value = curenv->env_notify_value;
+        curenv->env_ipc_from = 0;
+        curenv->env_ipc_perm = 0;
+        curenv->env_stat.es_ipc_recvs++;
+        return 0;
+    }
     curenv->env_ipc_dstva = dstva;
     curenv->env_ipc_recving = true;
     curenv->env_status = ENV_NOT_RUNNABLE;
@@ -462,6 +613,124 @@ sys_ipc_recv(void *dstva)
 	return 0;
 }
 
+// Block until another env wakes the word at addr with sys_futex_wake,
+// unless it no longer holds 'expected'.  The word is named by its
+// physical address, so envs sharing the page can use it whatever their
+// mappings.  timeout_ms of 0 waits forever.
+//
+// Returns 0 when woken, < 0 on error.  Errors are:
+//	-E_AGAIN if *addr != expected, so the caller should look again.
+//	-E_TIMEOUT if nobody woke the caller within timeout_ms.
+//	-E_INVAL if addr is not a mapped, aligned user address.
+// A wakeup may be spurious, so callers must re-check their condition.
+static int
+sys_futex_wait(const void *addr, uint32_t expected, uint32_t timeout_ms)
+{
+    int r = futex_wait(curenv, addr, expected, timeout_ms);
+    if (r < 0) {
+        return r;
+    }
+    sched_yield();
+}
+
+// Wake up to n envs blocked in sys_futex_wait on the word at addr.
+// Returns the number of envs woken, or -E_INVAL if addr is not a
+// mapped, aligned user address.
+static int
+sys_futex_wake(const void *addr, int n)
+{
+    return futex_wake_va(curenv, addr, n);
+}
+
+// Copy the resources envid has used into *st (see struct EnvStat).
+// Any env may look at any other, as it can in envs[].
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist.
+static int
+sys_env_stat(envid_t envid, struct EnvStat *st)
+{
+    struct Env *env;
+    int r = envid2env(envid, &env, false);
+    if (r < 0) {
+        return r;
+    }
+    user_mem_assert(curenv, st, sizeof(*st), PTE_U | PTE_W);
+
+    *st = env->env_stat;
+    st->es_pages = user_page_count(env->env_pgdir);
+    return 0;
+}
+
+// Control event tracing: op is one of the TRACE_CTL_* operations in
+// inc/syscall.h.  Dumps go to the console (see trace_dump).
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_NO_MEM if there is no memory for the trace buffers.
+//	-E_INVAL if op is not a valid operation.
+static int
+sys_trace_ctl(int op)
+{
+    switch (op) {
+        case TRACE_CTL_START:
+            return trace_start();
+        case TRACE_CTL_STOP:
+            trace_stop();
+            return 0;
+        case TRACE_CTL_DUMP:
+            trace_dump();
+            return 0;
+        default:
+            return -E_INVAL;
+    }
+}
+
+// Queue the disk transfer described by *req with the virtio disk if
+// there is one (see kern/virtio_blk.c), and with the bus-master DMA
+// engine otherwise (see kern/ide.c).  The transfer finishes in the
+// background: req->id_status is IDE_DMA_BUSY until then, and is set to
+// 0 or an error, with futex waiters on it woken, when it is done.  With
+// IDE_DMA_NOTIFY the caller also gets FSREQ_INTERRUPT from envid 0.
+// req and the buffer must stay mapped until the transfer is done.
+// Transfers queued with IDE_DMA_MORE may wait for one without it, or
+// for a NULL req, before the device hears of them.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if the caller isn't the file server.
+//	-E_NOT_SUPP if there is no virtio disk or bus-master IDE controller.
+//	-E_NO_MEM if too many transfers are queued.
+//	-E_INVAL if req or its buffer isn't mapped as it must be, or req
+//		is malformed.
+static int
+sys_ide_dma(struct IdeDma *req)
+{
+    int r;
+
+    if (curenv->env_type != ENV_TYPE_FS) {
+        return -E_BAD_ENV;
+    }
+    if (req == NULL) {
+        virtio_blk_kick();
+        return 0;
+    }
+    if ((r = virtio_blk_submit(curenv, req)) != -E_NOT_SUPP) {
+        return r;
+    }
+    return ide_dma_submit(curenv, req);
+}
+
+// Control the sampling profiler: op is one of the PROF_* operations in
+// inc/syscall.h, and arg limits the functions the reports print.  The
+// reports go to the console.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if op is not a valid operation.
+static int
+sys_prof_ctl(int op, int arg)
+{
+    return prof_ctl(op, arg);
+}
+
 // Return the current time.
 static int
 sys_time_msec(void)
@@ -470,12 +739,20 @@ sys_time_msec(void)
     return time_msec();
 }
 
-// Sends the given number of bytes from a buffer over the network.
+// Sends the given number of bytes from a buffer over the network,
+// through the NIC with the given device index.
+// with NET_SEND_MORE in flags the NIC may not be told of the packet
+// until a later one is sent without it.
 // Return 0 on success, < 0 on error.  Errors are:
 //     -E_INVAL if the env doesn't have permission to read the memory,
-//              or the [va,va+length] doesnt fit a single page
-//     -E_NO_MEM if the transmission queue is full
-int32_t sys_net_try_send(void *va, size_t length) {
+//              the [va,va+length] doesnt fit a single page,
+//              or there is no NIC with that index
+//     -E_RX_FULL if the transmission queue is full
+int32_t sys_net_try_send(int dev, void *va, size_t length, int flags) {
+    struct netdev *nd = netdev_lookup(dev);
+    if (nd == NULL) {
+        return -E_INVAL;
+    }
     if (user_mem_check(curenv, va, length, PTE_P | PTE_U) != 0) {
         return -E_INVAL;
     }
@@ -485,16 +762,118 @@ int32_t sys_net_try_send(void *va, size_t length) {
         return -E_INVAL;
     }
 
-    int r = transmit_packet(va, length, true);
+    int r = nd->nd_ops->nd_transmit(nd->nd_dev, va, length, flags & NET_SEND_MORE);
     return r;
 }
 
-// receive a packet from the network.
+// Sends a TCP/IPv4 frame carrying more than mss bytes of payload over the
+// network, letting the NIC split it into frames of mss bytes each.
+// unlike sys_net_try_send the buffer may span multiple pages.
+// Return 0 on success, < 0 on error.  Errors are:
+//     -E_INVAL if the env doesn't have permission to read the memory,
+//              the frame is not a TCP/IPv4 segment the NIC can split,
+//              or there is no NIC with that index
+//     -E_RX_FULL if the transmission queue is full
+//     -E_NOT_SUPP if the NIC can't split frames
+int32_t sys_net_try_send_tso(int dev, void *va, size_t length, uint16_t mss) {
+    struct netdev *nd = netdev_lookup(dev);
+    if (nd == NULL) {
+        return -E_INVAL;
+    }
+    if (nd->nd_ops->nd_transmit_sg == NULL) {
+        return -E_NOT_SUPP;
+    }
+    if (user_mem_check(curenv, va, length, PTE_P | PTE_U) != 0) {
+        return -E_INVAL;
+    }
+    struct jif_sg sg = { va, length };
+    return nd->nd_ops->nd_transmit_sg(nd->nd_dev, &sg, 1, mss, false);
+}
+
+// Sends a single packet gathered from nsg buffers over the network,
+// filling a transmit descriptor per buffer page in one go.
+// if mss is non zero, the NIC splits the packet as in sys_net_try_send_tso,
+// and its headers must all be in the first buffer.
+// the buffers must not be changed untill the NIC is done with them,
+// which is reported by the return value of later calls on the same NIC.
+// Return the number of packets sent by earlier calls that the NIC has
+// since finished with on success, < 0 on error.  Errors are:
+//     -E_INVAL if the env doesn't have permission to read the memory,
+//              nsg is larger than JIF_SG_MAX,
+//              the NIC can't send the packet,
+//              or there is no NIC with that index
+//     -E_RX_FULL if the transmission queue is full
+//     -E_NOT_SUPP if the NIC can't gather packets
+// with nsg of 0 nothing is sent, which lets callers check for support.
+int32_t sys_net_try_send_sg(int dev, const struct jif_sg *sg, size_t nsg, uint16_t mss) {
+    struct jif_sg bufs[JIF_SG_MAX];
+    size_t i;
+    struct netdev *nd = netdev_lookup(dev);
+    if (nd == NULL) {
+        return -E_INVAL;
+    }
+    if (nd->nd_ops->nd_transmit_sg == NULL) {
+        return -E_NOT_SUPP;
+    }
+    if (nsg == 0) {
+        return nd->nd_ops->nd_take_completed(nd->nd_dev);
+    }
+    if (nsg > JIF_SG_MAX) {
+        return -E_INVAL;
+    }
+    if (user_mem_check(curenv, sg, nsg * sizeof(struct jif_sg), PTE_P | PTE_U) != 0) {
+        return -E_INVAL;
+    }
+    memcpy(bufs, sg, nsg * sizeof(struct jif_sg));
+    for (i = 0; i < nsg; i++) {
+        if (user_mem_check(curenv, bufs[i].sg_addr, bufs[i].sg_len, PTE_P | PTE_U) != 0) {
+            return -E_INVAL;
+        }
+    }
+    int r = nd->nd_ops->nd_transmit_sg(nd->nd_dev, bufs, nsg, mss, true);
+    if (r < 0) {
+        return r;
+    }
+    return nd->nd_ops->nd_take_completed(nd->nd_dev);
+}
+
+// Hands the NIC with the given device index over to the calling network
+// server, which then drives it directly through the registers, rings and
+// buffers mapped at va.
+// see e1000_bypass and the layout in inc/e1000.h.
+// Return 0 on success, < 0 on error.  Errors are:
+//     -E_BAD_ENV if the caller isn't the network server
+//     -E_INVAL if va isn't page aligned, the mapping doesn't fit below UTOP,
+//              the NIC was already handed over,
+//              or there is no NIC with that index
+//     -E_NO_MEM if there's no memory for the rings and buffers
+//     -E_NOT_SUPP if the NIC isn't an e1000
+int32_t sys_net_bypass(int dev, void *va) {
+    struct netdev *nd = netdev_lookup(dev);
+    if (curenv->env_type != ENV_TYPE_NS) {
+        return -E_BAD_ENV;
+    }
+    if (nd == NULL) {
+        return -E_INVAL;
+    }
+    if (nd->nd_ops->nd_bypass == NULL) {
+        return -E_NOT_SUPP;
+    }
+    return nd->nd_ops->nd_bypass(nd->nd_dev, curenv, va);
+}
+
+// receive a packet from the network, through the NIC with the given
+// device index.
 // sleeps until there is one to receive.
 // Return 0 on success, < 0 on error.  Errors are:
 //     -E_INVAL if the env doesn't have permission to read the memory,
-//              or the va isn't page aligned
-int32_t sys_net_recv(void *va) {
+//              the va isn't page aligned,
+//              or there is no NIC with that index
+int32_t sys_net_recv(int dev, void *va) {
+    struct netdev *nd = netdev_lookup(dev);
+    if (nd == NULL) {
+        return -E_INVAL;
+    }
     if (user_mem_check(curenv, va, PGSIZE, PTE_P | PTE_U) != 0) {
        return -E_INVAL;
     }
@@ -504,18 +883,25 @@ int32_t sys_net_recv(void *va) {
     if (page_start != (uintptr_t)va){
         return -E_INVAL;
     }*/
-    return receive_packet(va);
+    return nd->nd_ops->nd_receive(nd->nd_dev, va);
 }
 
-// writes the mac address of the NIC to the given address,
+// writes the mac address of the NIC with the given device index
+// to the given address. NICs are numbered from 0 in the order they
+// were found, so this can be used to count them.
 // Return 0 on success, < 0 on error.  Errors are:
-//     -E_INVAL if the env cant write to the given address
-int32_t sys_get_mac_addr(void *addr) {
+//     -E_INVAL if the env cant write to the given address,
+//              or there is no NIC with that index
+int32_t sys_get_mac_addr(int dev, void *addr) {
+    struct netdev *nd = netdev_lookup(dev);
+    if (nd == NULL) {
+        return -E_INVAL;
+    }
     if (user_mem_check(curenv, addr, 6, PTE_P | PTE_U | PTE_W)) {
         return -E_INVAL;
     }
-    uint8_t mac[sizeof(uint64_t)] = {};
-    read_mac_address((uint32_t*)&mac[0], (uint32_t*)&mac[4]);
+    uint8_t mac[6] = {};
+    nd->nd_ops->nd_read_mac(nd->nd_dev, mac);
     memcpy(addr, mac, 6);
     return 0;
 }
@@ -530,8 +916,7 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 
 	switch (syscallno) {
         case SYS_cputs:
-            sys_cputs((char *)a1, a2);
-            return 0;
+            return sys_cputs((char *)a1, a2);
         case SYS_cgetc:
             return sys_cgetc();
         case SYS_getenvid:
@@ -557,16 +942,43 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
             return sys_ipc_recv((void*)a1);
         case SYS_ipc_try_send:
             return sys_ipc_try_send(a1, a2, (void*)a3, a4);
+        case SYS_env_set_affinity:
+            return sys_env_set_affinity(a1, a2);
+        case SYS_env_set_priority:
+            return sys_env_set_priority(a1, a2);
+        case SYS_thread_create:
+            return sys_thread_create(a1, a2, a3, (void*)a4);
+        case SYS_thread_exit:
+            sys_thread_exit();
+            return 0;
+        case SYS_futex_wait:
+            return sys_futex_wait((const void*)a1, a2, a3);
+        case SYS_futex_wake:
+            return sys_futex_wake((const void*)a1, a2);
+        case SYS_prof_ctl:
+            return sys_prof_ctl(a1, a2);
+        case SYS_env_stat:
+            return sys_env_stat(a1, (struct EnvStat *)a2);
+        case SYS_trace_ctl:
+            return sys_trace_ctl(a1);
+        case SYS_ide_dma:
+            return sys_ide_dma((struct IdeDma *)a1);
         case SYS_env_set_trapframe:
             return sys_env_set_trapframe(a1, (struct Trapframe *)a2);
         case SYS_time_msec:
             return sys_time_msec();
         case SYS_net_try_send:
-            return sys_net_try_send((void*)a1, a2);
+            return sys_net_try_send(a1, (void*)a2, a3, a4);
         case SYS_net_recv:
-            return sys_net_recv((void*)a1);
+            return sys_net_recv(a1, (void*)a2);
         case SYS_get_mac_addr:
-            return sys_get_mac_addr((void*)a1);
+            return sys_get_mac_addr(a1, (void*)a2);
+        case SYS_net_try_send_tso:
+            return sys_net_try_send_tso(a1, (void*)a2, a3, (uint16_t)a4);
+        case SYS_net_try_send_sg:
+            return sys_net_try_send_sg(a1, (const struct jif_sg*)a2, a3, (uint16_t)a4);
+        case SYS_net_bypass:
+            return sys_net_bypass(a1, (void*)a2);
         default:
             return -E_INVAL;
 	}
@@ -0,0 +1,148 @@
+// Kernel event tracing.
+//
+// Tracepoints (TRACE() in kern/trace.h) append timestamped records to a
+// ring per CPU.  Only the owning CPU writes a ring, and always with
+// interrupts off, so recording needs no lock; it may even run before
+// the big kernel lock is taken, as on trap entry.  While tracing is
+// off a tracepoint costs one test of trace_on.
+//
+// The rings are built from pages taken when tracing first starts, so
+// they cost no memory in kernels that never trace.  trace_dump prints
+// them on the console, oldest record first, in a line format that
+// trace2json.py turns into Chrome/Perfetto trace JSON on the host.
+
+#include <inc/stdio.h>
+#include <inc/error.h>
+#include <inc/x86.h>
+
+#include <kern/cpu.h>
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/time.h>
+#include <kern/trace.h>
+
+struct TraceRec {
+	uint64_t tr_tsc;		// read_tsc() at the event
+	uint16_t tr_event;		// TRACE_*
+	uint16_t tr_pad;
+	envid_t tr_env;			// curenv's id, or 0
+	uint32_t tr_arg[2];
+};
+
+#define TRACE_PAGES	32	// Pages of records per CPU
+#define TRACE_PER_PAGE	(PGSIZE / sizeof(struct TraceRec))
+#define TRACE_NREC	(TRACE_PAGES * TRACE_PER_PAGE)
+
+static struct TraceRing {
+	struct TraceRec *tr_pages[TRACE_PAGES];
+	uint32_t tr_head;		// Records written since trace_start
+} trace_rings[NCPU];
+
+volatile bool trace_on;
+
+// When tracing started, to convert TSC cycles into time
+static uint64_t trace_tsc0;
+static unsigned trace_msec0;
+
+static const char *const trace_names[TRACE_NEVENT] = {
+	[TRACE_TRAP] = "trap",
+	[TRACE_TRAP_RET] = "trap_ret",
+	[TRACE_SYSCALL] = "syscall",
+	[TRACE_SYSCALL_RET] = "syscall_ret",
+	[TRACE_ENV_RUN] = "env_run",
+	[TRACE_SCHED_YIELD] = "sched_yield",
+	[TRACE_SCHED_HALT] = "sched_halt",
+	[TRACE_IPC_SEND] = "ipc_send",
+	[TRACE_IPC_RECV] = "ipc_recv",
+	[TRACE_IRQ] = "irq",
+};
+
+// Append an event to this CPU's ring.  Use TRACE() rather than calling
+// this directly.
+void
+trace_record(int ev, uint32_t a0, uint32_t a1)
+{
+	struct TraceRing *ring = &trace_rings[cpunum()];
+	uint32_t i = ring->tr_head % TRACE_NREC;
+	struct TraceRec *rec = &ring->tr_pages[i / TRACE_PER_PAGE][i % TRACE_PER_PAGE];
+
+	rec->tr_tsc = read_tsc();
+	rec->tr_event = ev;
+	rec->tr_env = curenv ? curenv->env_id : 0;
+	rec->tr_arg[0] = a0;
+	rec->tr_arg[1] = a1;
+	ring->tr_head++;
+}
+
+// Discard old records and start tracing, allocating the rings the
+// first time.  Returns 0 on success, -E_NO_MEM if the rings can't be
+// allocated.
+int
+trace_start(void)
+{
+	struct PageInfo *pp;
+	int cpu, i;
+
+	trace_on = false;
+	for (cpu = 0; cpu < ncpu; cpu++) {
+		for (i = 0; i < TRACE_PAGES; i++) {
+			if (trace_rings[cpu].tr_pages[i])
+				continue;
+			if (!(pp = page_alloc(0)))
+				return -E_NO_MEM;
+			pp->pp_ref++;
+			trace_rings[cpu].tr_pages[i] = page2kva(pp);
+		}
+		trace_rings[cpu].tr_head = 0;
+	}
+	trace_tsc0 = read_tsc();
+	trace_msec0 = time_msec();
+	trace_on = true;
+	return 0;
+}
+
+void
+trace_stop(void)
+{
+	trace_on = false;
+}
+
+// Stop tracing and print every CPU's records, framed by TRACE BEGIN
+// and TRACE END lines:
+//	TRACE BEGIN <ncpu> <TSC kHz, or 0 if unknown>
+//	<cpu> <tsc> <event> <envid> <arg0> <arg1>
+//	TRACE END <records lost to ring overflow>
+void
+trace_dump(void)
+{
+	struct TraceRing *ring;
+	struct TraceRec *rec;
+	uint64_t khz = 0;
+	unsigned msec;
+	uint32_t lost = 0, i, n;
+	int cpu;
+
+	trace_stop();
+	if (!trace_rings[0].tr_pages[0]) {
+		cprintf("trace: nothing traced\n");
+		return;
+	}
+
+	msec = time_msec() - trace_msec0;
+	if (msec > 0)
+		khz = (read_tsc() - trace_tsc0) / msec;
+	cprintf("TRACE BEGIN %d %llu\n", ncpu, khz);
+	for (cpu = 0; cpu < ncpu; cpu++) {
+		ring = &trace_rings[cpu];
+		n = MIN(ring->tr_head, TRACE_NREC);
+		lost += ring->tr_head - n;
+		for (i = ring->tr_head - n; i != ring->tr_head; i++) {
+			rec = &ring->tr_pages[(i % TRACE_NREC) / TRACE_PER_PAGE]
+				[(i % TRACE_NREC) % TRACE_PER_PAGE];
+			cprintf("%d %llx %s %x %x %x\n", cpu, rec->tr_tsc,
+				trace_names[rec->tr_event], rec->tr_env,
+				rec->tr_arg[0], rec->tr_arg[1]);
+		}
+	}
+	cprintf("TRACE END %u\n", lost);
+}
@@ -0,0 +1,41 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_TRACE_H
+#define JOS_KERN_TRACE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Tracepoints.  The names in trace_names[] (kern/trace.c) and the
+// host-side converter (trace2json.py) must follow this order.
+enum {
+	TRACE_TRAP = 0,		// Trap entry: trapno, eip
+	TRACE_TRAP_RET,		// Return from the trap
+	TRACE_SYSCALL,		// System call: number, first argument
+	TRACE_SYSCALL_RET,	// System call done: result
+	TRACE_ENV_RUN,		// Switch to an env: envid, its runs
+	TRACE_SCHED_YIELD,	// Scheduler entered
+	TRACE_SCHED_HALT,	// CPU going idle
+	TRACE_IPC_SEND,		// IPC delivered: target envid, value
+	TRACE_IPC_RECV,		// IPC receive: 1 if it blocks
+	TRACE_IRQ,		// Device interrupt: irq
+	TRACE_NEVENT
+};
+
+extern volatile bool trace_on;
+
+// Record an event; costs a single test and branch while tracing is off.
+#define TRACE(ev, a0, a1)						\
+	do {								\
+		if (__builtin_expect(trace_on, 0))			\
+			trace_record((ev), (uint32_t) (a0), (uint32_t) (a1)); \
+	} while (0)
+
+void trace_record(int ev, uint32_t a0, uint32_t a1);
+int trace_start(void);
+void trace_stop(void);
+void trace_dump(void);
+
+#endif	// !JOS_KERN_TRACE_H
@@ -14,7 +14,13 @@
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
 #include <kern/time.h>
-#include <kern/e1000.h>
+#include <kern/netdev.h>
+#include <kern/ipi.h>
+#include <kern/futex.h>
+#include <kern/prof.h>
+#include <kern/trace.h>
+#include <kern/ide.h>
+#include <kern/virtio_blk.h>
 
 static struct Taskstate ts;
 
@@ -64,6 +70,9 @@ static const char *trapname(int trapno)
 		return "System call";
 	if (trapno >= IRQ_OFFSET && trapno < IRQ_OFFSET + 16)
 		return "Hardware Interrupt";
+	if (trapno == IRQ_OFFSET + IRQ_IPI_WAKEUP ||
+	    trapno == IRQ_OFFSET + IRQ_IPI_CALL)
+		return "Inter-processor Interrupt";
 	return "(unknown trap)";
 }
 
@@ -125,6 +134,9 @@ trap_init_percpu(void)
 	thiscpu->cpu_ts.ts_esp0 = kstacktop;
 	thiscpu->cpu_ts.ts_ss0 = GD_KD;
 
+	thiscpu->cpu_stat = &cpu_stats[cpunum()];
+	thiscpu->cpu_stat->cs_online = 1;
+
 	// Initialize the TSS slot of the gdt.
 	gdt[(GD_TSS0 >> 3) + cpunum()] = SEG16(STS_T32A, (uint32_t) (&thiscpu->cpu_ts),
 					sizeof(struct Taskstate) - 1, 0);
@@ -195,6 +207,8 @@ trap_dispatch(struct Trapframe *tf)
         case T_BRKPT:
             return monitor(tf);
         case T_SYSCALL:
+            curenv->env_stat.es_syscalls++;
+            TRACE(TRACE_SYSCALL, tf->tf_regs.reg_eax, tf->tf_regs.reg_edx);
             tf->tf_regs.reg_eax =
                 syscall(tf->tf_regs.reg_eax,
                         tf->tf_regs.reg_edx,
@@ -202,6 +216,7 @@ trap_dispatch(struct Trapframe *tf)
                         tf->tf_regs.reg_ebx,
                         tf->tf_regs.reg_edi,
                         tf->tf_regs.reg_esi);
+            TRACE(TRACE_SYSCALL_RET, tf->tf_regs.reg_eax, 0);
             return;
         default:
             ; // fallthrough on unexpected trap
@@ -229,25 +244,56 @@ trap_dispatch(struct Trapframe *tf)
         // make the boot cpu solely responsible for the ticks
         if (cpunum() == bootcpu->cpu_id) {
             time_tick();
+            futex_expire();
         }
+        prof_sample(tf);
         lapic_eoi();
+		sched_tick();
+	}
+
+	// Another CPU made an env runnable while this one was halted
+	// (see ipi_wake_idle), or one more urgent than ours (ipi_preempt).
+	if (tf->tf_trapno == IRQ_OFFSET + IRQ_IPI_WAKEUP) {
+		lapic_eoi();
 		sched_yield();
 	}
 
 	// Handle keyboard and serial interrupts.
 	// LAB 5: Your code here.
 
+	// Interrupts coming through the IOAPIC must be acknowledged
+	// to the local APIC like the timer.
 	if (tf->tf_trapno == IRQ_OFFSET + IRQ_KBD){
+		TRACE(TRACE_IRQ, IRQ_KBD, 0);
 		kbd_intr();
+		lapic_eoi();
 		sched_yield();
 	}
 
 	if (tf->tf_trapno == IRQ_OFFSET + IRQ_SERIAL){
+		TRACE(TRACE_IRQ, IRQ_SERIAL, 0);
 		serial_intr();
+		lapic_eoi();
+		sched_yield();
+	}
+
+	if (tf->tf_trapno == IRQ_OFFSET + IRQ_IDE) {
+		TRACE(TRACE_IRQ, IRQ_IDE, 0);
+		ide_dma_intr();
+		irq_eoi();
+		lapic_eoi();
+		sched_yield();
+	}
+
+	if (virtio_blk_handler(tf->tf_trapno)) {
+		TRACE(TRACE_IRQ, tf->tf_trapno - IRQ_OFFSET, 0);
+		irq_eoi();
+		lapic_eoi();
 		sched_yield();
 	}
 
-    if (e1000_handler(tf->tf_trapno)) {
+    if (netdev_handler(tf->tf_trapno)) {
+        TRACE(TRACE_IRQ, tf->tf_trapno - IRQ_OFFSET, 0);
         irq_eoi();
         lapic_eoi();
         sched_yield();
@@ -263,9 +309,25 @@ trap_dispatch(struct Trapframe *tf)
 	}
 }
 
+// Return from a trap without touching any environment state.
+static void __attribute__((noreturn))
+trap_return(struct Trapframe *tf)
+{
+	asm volatile("movl %0,%%esp\n"
+		"\tpopal\n"
+		"\tpopl %%es\n"
+		"\tpopl %%ds\n"
+		"\taddl $0x8,%%esp\n" /* skip tf_trapno and tf_errcode */
+		"\tiret"
+		: : "g" (tf) : "memory");
+	panic("iret failed");
+}
+
 void
 trap(struct Trapframe *tf)
 {
+	uint64_t trap_tsc;
+
 	// The environment may have set DF and some versions
 	// of GCC rely on DF being clear
 	asm volatile("cld" ::: "cc");
@@ -275,10 +337,25 @@ trap(struct Trapframe *tf)
 	if (panicstr)
 		asm volatile("hlt");
 
+	TRACE(TRACE_TRAP, tf->tf_trapno, tf->tf_eip);
+	thiscpu->cpu_stat->cs_traps[MIN(tf->tf_trapno, CPUSTAT_NVEC - 1)]++;
+
+	// Serve cross-CPU calls without the big kernel lock, since the
+	// caller holds it while it waits, and return straight to
+	// whatever was interrupted.  A halted CPU stays halted.
+	if (tf->tf_trapno == IRQ_OFFSET + IRQ_IPI_CALL) {
+		ipi_poll();
+		lapic_eoi();
+		TRACE(TRACE_TRAP_RET, 0, 0);
+		trap_return(tf);
+	}
+
 	// Re-acqurie the big kernel lock if we were halted in
 	// sched_yield()
-	if (xchg(&thiscpu->cpu_status, CPU_STARTED) == CPU_HALTED)
+	if (xchg(&thiscpu->cpu_status, CPU_STARTED) == CPU_HALTED) {
+		thiscpu->cpu_stat->cs_idle_tsc += read_tsc() - thiscpu->cpu_halt_tsc;
 		lock_kernel();
+	}
 	// Check that interrupts are disabled.  If this assertion
 	// fails, DO NOT be tempted to fix it by inserting a "cli" in
 	// the interrupt path.
@@ -289,8 +366,12 @@ trap(struct Trapframe *tf)
 		// Acquire the big kernel lock before doing any
 		// serious kernel work.
 		// LAB 4: Your code here.
+		// User time ends at the trap; waiting for the lock is
+		// kernel time, charged from here on.
 		assert(curenv);
+		trap_tsc = read_tsc();
         lock_kernel();
+		env_charge_until(true, trap_tsc);
 
 		// Garbage collect if current enviroment is a zombie
 		if (curenv->env_status == ENV_DYING) {
@@ -341,6 +422,7 @@ page_fault_handler(struct Trapframe *tf)
 
 	// We've already handled kernel-mode exceptions, so if we get here,
 	// the page fault happened in user mode.
+	curenv->env_stat.es_pgfaults++;
 
 	// Call the environment's page fault upcall, if one exists.  Set up a
 	// page fault stack frame on the user exception stack (below
@@ -384,9 +466,12 @@ page_fault_handler(struct Trapframe *tf)
     //
     // without allowing exception_stack to be tf->tf_esp
     // when it is below the exception stack, overflow checks cant be made
-    uintptr_t exception_stack = tf->tf_esp < UXSTACKTOP
-                                && tf->tf_esp >= USTACKTOP ?
-                                tf->tf_esp : UXSTACKTOP;
+    //
+    // each thread has its own exception stack, see sys_thread_create
+    uintptr_t xstacktop = curenv->env_xstacktop;
+    uintptr_t exception_stack = tf->tf_esp < xstacktop
+                                && tf->tf_esp >= xstacktop - (UXSTACKTOP - USTACKTOP) ?
+                                tf->tf_esp : xstacktop;
 
     // ensures the exception stack has atleast enough space
     // for an empty word and the trapframe
@@ -0,0 +1,46 @@
+#include <inc/x86.h>
+#include <inc/string.h>
+#include <inc/error.h>
+#include <kern/pmap.h>
+#include <kern/virtio.h>
+
+// Virtqueues of legacy virtio PCI devices, shared by the virtio drivers
+
+// sets up the virtqueue with the given index of the device at io_base
+// to live in mem.
+// returns 0 on success, -E_INVAL if the device queue is too large.
+int virtq_setup(uint16_t io_base, struct virtq *vq, uint16_t index, uint8_t *mem) {
+    outw(io_base + VIRTIO_PCI_QUEUE_SEL, index);
+    uint16_t size = inw(io_base + VIRTIO_PCI_QUEUE_NUM);
+    if (size == 0 || size > VQ_MAX_SIZE) {
+        return -E_INVAL;
+    }
+
+    memset(mem, 0, VRING_SIZE(size));
+    vq->index = index;
+    vq->size = size;
+    vq->desc = (struct vring_desc *)mem;
+    vq->avail = (struct vring_avail *)(mem + 16 * size);
+    vq->used = (struct vring_used *)(mem + VRING_USED_OFFSET(size));
+    vq->last_used = 0;
+
+    outl(io_base + VIRTIO_PCI_QUEUE_PFN, PADDR(mem) >> VIRTIO_PCI_QUEUE_ADDR_SHIFT);
+    return 0;
+}
+
+// places the descriptor chain starting at head in the available ring.
+// the device isn't notified.
+void virtq_avail(struct virtq *vq, uint16_t head) {
+    vq->avail->ring[vq->avail->idx % vq->size] = head;
+    // the entry must be visible before the index moves past it
+    __sync_synchronize();
+    vq->avail->idx++;
+    __sync_synchronize();
+}
+
+// notifies the device of new available buffers, unless it asked not to be
+void virtq_kick(uint16_t io_base, struct virtq *vq) {
+    if (!(vq->used->flags & VRING_USED_F_NO_NOTIFY)) {
+        outw(io_base + VIRTIO_PCI_QUEUE_NOTIFY, vq->index);
+    }
+}
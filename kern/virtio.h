@@ -0,0 +1,90 @@
+#ifndef JOS_KERN_VIRTIO_H
+#define JOS_KERN_VIRTIO_H
+
+#include <inc/types.h>
+#include <inc/mmu.h>
+
+#define VIRTIO_VENDOR_ID 0x1AF4
+
+// Legacy virtio PCI registers, as offsets into the I/O region of BAR0
+#define VIRTIO_PCI_HOST_FEATURES    0x00
+#define VIRTIO_PCI_GUEST_FEATURES   0x04
+#define VIRTIO_PCI_QUEUE_PFN        0x08
+#define VIRTIO_PCI_QUEUE_NUM        0x0C
+#define VIRTIO_PCI_QUEUE_SEL        0x0E
+#define VIRTIO_PCI_QUEUE_NOTIFY     0x10
+#define VIRTIO_PCI_STATUS           0x12
+#define VIRTIO_PCI_ISR              0x13
+#define VIRTIO_PCI_CONFIG           0x14    // device specific configuration
+
+// Device Status
+#define VIRTIO_STATUS_ACKNOWLEDGE   1
+#define VIRTIO_STATUS_DRIVER        (1 << 1)
+#define VIRTIO_STATUS_DRIVER_OK     (1 << 2)
+#define VIRTIO_STATUS_FAILED        (1 << 7)
+
+// Features of every device type
+#define VIRTIO_RING_F_INDIRECT_DESC (1 << 28)   // descriptors may point at tables
+
+// legacy queues are page aligned, and given to the device by page number
+#define VIRTIO_PCI_QUEUE_ADDR_SHIFT 12
+#define VRING_ALIGN                 PGSIZE
+
+// Descriptor flags
+#define VRING_DESC_F_NEXT           1           // chained with the next field
+#define VRING_DESC_F_WRITE          (1 << 1)    // written by the device
+#define VRING_DESC_F_INDIRECT       (1 << 2)    // points at a table of descriptors
+
+// Ring flags
+#define VRING_AVAIL_F_NO_INTERRUPT  1           // driver doesn't want interrupts
+#define VRING_USED_F_NO_NOTIFY      1           // device doesn't want notifications
+
+// largest queue the driver supports, qemu uses 256
+#define VQ_MAX_SIZE                 256
+
+// memory taken by a legacy virtqueue of the given size, the used ring
+// starts on the first aligned address after the available ring.
+// a constant expression, unlike ROUNDUP, so arrays can be sized with it
+#define VRING_ALIGNED(x) (((x) + VRING_ALIGN - 1) & ~(VRING_ALIGN - 1))
+#define VRING_USED_OFFSET(n) VRING_ALIGNED(16 * (n) + 2 * (3 + (n)))
+#define VRING_SIZE(n) (VRING_USED_OFFSET(n) + VRING_ALIGNED(2 * 3 + 8 * (n)))
+
+struct vring_desc {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__ ((packed));
+
+struct vring_avail {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+} __attribute__ ((packed));
+
+struct vring_used_elem {
+    uint32_t id;
+    uint32_t len;
+} __attribute__ ((packed));
+
+struct vring_used {
+    uint16_t flags;
+    uint16_t idx;
+    struct vring_used_elem ring[];
+} __attribute__ ((packed));
+
+struct virtq {
+    uint16_t index;
+    uint16_t size;
+    volatile struct vring_desc *desc;
+    volatile struct vring_avail *avail;
+    volatile struct vring_used *used;
+    // next used ring entry to handle
+    uint16_t last_used;
+};
+
+int virtq_setup(uint16_t io_base, struct virtq *vq, uint16_t index, uint8_t *mem);
+void virtq_avail(struct virtq *vq, uint16_t head);
+void virtq_kick(uint16_t io_base, struct virtq *vq);
+
+#endif	// JOS_KERN_VIRTIO_H
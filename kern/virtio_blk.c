@@ -0,0 +1,284 @@
+#include <inc/x86.h>
+#include <inc/string.h>
+#include <inc/error.h>
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/picirq.h>
+#include <kern/ide.h>
+#include <kern/virtio_blk.h>
+
+// Driver of a legacy virtio block device, taking the file server's
+// disk transfers (struct IdeDma, see sys_ide_dma) in place of the IDE
+// controller.
+//
+// Unlike an IDE channel, the device works on many requests at once.
+// A request is a descriptor chain of a header, one descriptor for each
+// page of the buffer, which point straight at the file server's block
+// cache pages, and a status byte.  With indirect descriptors the chain
+// lives in a table of its own and takes a single entry of the ring, so
+// up to IDE_DMA_NREQ requests fit in any queue.  Requests submitted
+// with IDE_DMA_MORE are placed in the ring without notifying the
+// device, which is told about the whole batch at once.
+//
+// The device completes requests in any order, but the file server
+// counts on a read coming after a write of the same sectors to see
+// the data written.  So a request that overlaps one the device has,
+// unless both are reads, waits for it to finish; requests behind a
+// waiting one wait too, so that they still start in order.
+
+// Block device features
+#define VIRTIO_BLK_F_RO             (1 << 5)    // the disk is read-only
+
+// request types and status
+#define VIRTIO_BLK_T_IN             0
+#define VIRTIO_BLK_T_OUT            1
+#define VIRTIO_BLK_S_OK             0
+
+// the only queue of the block device
+#define VIRTIO_BLK_Q                0
+
+// descriptors taken by a request: a header, the pages and a status byte
+#define VBLK_CHAIN                  (IDE_MAXPAGES + 2)
+
+// header at the start of every request
+struct virtio_blk_outhdr {
+    uint32_t type;
+    uint32_t ioprio;
+    uint64_t sector;
+} __attribute__ ((packed));
+
+// driver state of the device
+struct virtio_blk {
+    uint16_t io_base;
+    int irq_line;
+    bool indirect;
+    uint64_t capacity;      // in sectors
+
+    struct virtq vq;
+
+    // each request given to the device takes a slot, which owns the
+    // descriptors VBLK_CHAIN * slot and on, or the indirect table
+    // indirect[slot] and the single descriptor slot
+    uint16_t nslots;
+    struct IdeReq *slot_reqs[IDE_DMA_NREQ];
+    struct virtio_blk_outhdr hdrs[IDE_DMA_NREQ];
+    uint8_t status[IDE_DMA_NREQ];
+    uint16_t free_slots[IDE_DMA_NREQ];
+    size_t free_slot_count;
+
+    // requests not yet given to the device, oldest first
+    struct IdeReq *waiting[IDE_DMA_NREQ];
+    uint32_t wait_head, wait_tail;
+
+    struct IdeReq reqs[IDE_DMA_NREQ];
+    struct IdeReq *free_reqs[IDE_DMA_NREQ];
+    size_t free_req_count;
+
+    // requests placed in the ring since the device was notified
+    size_t unkicked;
+};
+
+// the queue and the tables must be physically contiguous, which the kernel image is
+static uint8_t vq_mem[VRING_SIZE(VQ_MAX_SIZE)] __attribute__ ((aligned (PGSIZE)));
+static struct vring_desc indirect[IDE_DMA_NREQ][VBLK_CHAIN] __attribute__ ((aligned (16)));
+
+static struct virtio_blk vblk;
+
+// returns true if a and b both touch some sector, and one of them writes it
+static bool conflicts(struct IdeReq *a, struct IdeReq *b) {
+    if (!((a->ir_flags | b->ir_flags) & IDE_DMA_WRITE)) {
+        return false;
+    }
+    return a->ir_secno < b->ir_secno + b->ir_nsecs &&
+           b->ir_secno < a->ir_secno + a->ir_nsecs;
+}
+
+// builds the descriptor chain of the request in the slot, and places it
+// in the available ring.  the device isn't notified.
+static void post(uint16_t slot, struct IdeReq *ir) {
+    volatile struct vring_desc *desc;
+    uint16_t base, head;
+    uint32_t len = ir->ir_nsecs * 512;
+    int i;
+
+    vblk.hdrs[slot].type = (ir->ir_flags & IDE_DMA_WRITE) ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    vblk.hdrs[slot].ioprio = 0;
+    vblk.hdrs[slot].sector = ir->ir_secno;
+    vblk.status[slot] = 0xFF;
+    vblk.slot_reqs[slot] = ir;
+
+    // next fields index the table the chain is in
+    if (vblk.indirect) {
+        desc = indirect[slot];
+        base = 0;
+        head = slot;
+    } else {
+        desc = &vblk.vq.desc[VBLK_CHAIN * slot];
+        base = VBLK_CHAIN * slot;
+        head = base;
+    }
+
+    desc[0].addr = PADDR(&vblk.hdrs[slot]);
+    desc[0].len = sizeof(struct virtio_blk_outhdr);
+    desc[0].flags = VRING_DESC_F_NEXT;
+    desc[0].next = base + 1;
+    for (i = 0; len > 0; i++) {
+        desc[i + 1].addr = page2pa(ir->ir_pages[i]);
+        desc[i + 1].len = MIN(len, PGSIZE);
+        desc[i + 1].flags = VRING_DESC_F_NEXT |
+            ((ir->ir_flags & IDE_DMA_WRITE) ? 0 : VRING_DESC_F_WRITE);
+        desc[i + 1].next = base + i + 2;
+        len -= desc[i + 1].len;
+    }
+    desc[i + 1].addr = PADDR(&vblk.status[slot]);
+    desc[i + 1].len = 1;
+    desc[i + 1].flags = VRING_DESC_F_WRITE;
+    desc[i + 1].next = 0;
+
+    if (vblk.indirect) {
+        vblk.vq.desc[slot].addr = PADDR(indirect[slot]);
+        vblk.vq.desc[slot].len = (i + 2) * sizeof(struct vring_desc);
+        vblk.vq.desc[slot].flags = VRING_DESC_F_INDIRECT;
+        vblk.vq.desc[slot].next = 0;
+    }
+    virtq_avail(&vblk.vq, head);
+    vblk.unkicked++;
+}
+
+// gives waiting requests to the device, oldest first, while there are
+// free slots and the oldest doesn't conflict with one the device has
+static void post_waiting(void) {
+    struct IdeReq *ir;
+    uint16_t slot;
+
+    while (vblk.wait_head != vblk.wait_tail && vblk.free_slot_count > 0) {
+        ir = vblk.waiting[vblk.wait_head % IDE_DMA_NREQ];
+        for (slot = 0; slot < vblk.nslots; slot++) {
+            if (vblk.slot_reqs[slot] && conflicts(vblk.slot_reqs[slot], ir)) {
+                return;
+            }
+        }
+        vblk.wait_head++;
+        post(vblk.free_slots[--vblk.free_slot_count], ir);
+    }
+}
+
+// notifies the device of the requests placed in the ring since it last was
+void virtio_blk_kick(void) {
+    if (vblk.io_base && vblk.unkicked > 0) {
+        vblk.unkicked = 0;
+        virtq_kick(vblk.io_base, &vblk.vq);
+    }
+}
+
+// queues the transfer described by req, in e's address space.
+// the device is notified unless req has IDE_DMA_MORE.
+// returns 0 on success, -E_NOT_SUPP if there is no virtio disk,
+// -E_NO_MEM if IDE_DMA_NREQ transfers are queued already,
+// -E_INVAL if req is malformed or not mapped as it must be.
+int virtio_blk_submit(struct Env *e, struct IdeDma *req) {
+    struct IdeReq *ir;
+    int r;
+
+    if (!vblk.io_base) {
+        return -E_NOT_SUPP;
+    }
+    if (vblk.free_req_count == 0) {
+        return -E_NO_MEM;
+    }
+    ir = vblk.free_reqs[vblk.free_req_count - 1];
+    if ((r = ide_req_pin(e, req, ir)) < 0) {
+        return r;
+    }
+    vblk.free_req_count--;
+
+    vblk.waiting[vblk.wait_tail++ % IDE_DMA_NREQ] = ir;
+    post_waiting();
+    if (!(ir->ir_flags & IDE_DMA_MORE)) {
+        virtio_blk_kick();
+    }
+    return 0;
+}
+
+// handles an interrupt of the device: finishes the requests it is done
+// with, and gives it the requests that were waiting for them.
+// returns true if the trap was raised by the device, and handled
+bool virtio_blk_handler(int trapno) {
+    volatile struct vring_used_elem *elem;
+    struct IdeReq *ir;
+    uint16_t slot;
+
+    if (!vblk.io_base || trapno != IRQ_OFFSET + vblk.irq_line) {
+        return false;
+    }
+    // reading the ISR acknowledges the interrupt.  the line may be
+    // shared with another device, whose handler gets a turn if this
+    // one didn't interrupt
+    if (inb(vblk.io_base + VIRTIO_PCI_ISR) == 0) {
+        return false;
+    }
+
+    while (vblk.vq.last_used != vblk.vq.used->idx) {
+        elem = &vblk.vq.used->ring[vblk.vq.last_used % vblk.vq.size];
+        slot = vblk.indirect ? elem->id : elem->id / VBLK_CHAIN;
+        vblk.vq.last_used++;
+
+        ir = vblk.slot_reqs[slot];
+        vblk.slot_reqs[slot] = NULL;
+        vblk.free_slots[vblk.free_slot_count++] = slot;
+        ide_req_done(ir, vblk.status[slot] == VIRTIO_BLK_S_OK ? 0 : -E_UNSPECIFIED);
+        vblk.free_reqs[vblk.free_req_count++] = ir;
+    }
+
+    post_waiting();
+    virtio_blk_kick();
+    return true;
+}
+
+int virtio_blk_attach(struct pci_func *pcif) {
+    size_t i;
+    if (vblk.io_base) {
+        // only one disk is driven, the file server's
+        return 0;
+    }
+    pci_func_enable(pcif);
+    uint16_t io_base = pcif->reg_base[0];
+
+    // reset the device, and tell it a driver was found
+    outb(io_base + VIRTIO_PCI_STATUS, 0);
+    outb(io_base + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    outb(io_base + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+    // indirect descriptors are used if the device has them,
+    // requests are never bigger than IDE_DMA_MAXSECS
+    uint32_t features = inl(io_base + VIRTIO_PCI_HOST_FEATURES);
+    outl(io_base + VIRTIO_PCI_GUEST_FEATURES, features & VIRTIO_RING_F_INDIRECT_DESC);
+    vblk.indirect = features & VIRTIO_RING_F_INDIRECT_DESC;
+    vblk.capacity = inl(io_base + VIRTIO_PCI_CONFIG) |
+        (uint64_t)inl(io_base + VIRTIO_PCI_CONFIG + 4) << 32;
+
+    if (virtq_setup(io_base, &vblk.vq, VIRTIO_BLK_Q, vq_mem) < 0) {
+        outb(io_base + VIRTIO_PCI_STATUS, VIRTIO_STATUS_FAILED);
+        return 0;
+    }
+    vblk.nslots = MIN(IDE_DMA_NREQ, vblk.indirect ? vblk.vq.size : vblk.vq.size / VBLK_CHAIN);
+    if (vblk.nslots == 0) {
+        outb(io_base + VIRTIO_PCI_STATUS, VIRTIO_STATUS_FAILED);
+        return 0;
+    }
+    for (i = 0; i < vblk.nslots; i++) {
+        vblk.free_slots[vblk.free_slot_count++] = vblk.nslots - 1 - i;
+    }
+    for (i = 0; i < IDE_DMA_NREQ; i++) {
+        vblk.free_reqs[vblk.free_req_count++] = &vblk.reqs[i];
+    }
+    outb(io_base + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE |
+         VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+
+    vblk.irq_line = pcif->irq_line;
+    irq_enable(vblk.irq_line);
+    vblk.io_base = io_base;
+    cprintf("virtio-blk: %llu sectors%s, %d requests in flight\n", vblk.capacity,
+            (features & VIRTIO_BLK_F_RO) ? ", read-only" : "", vblk.nslots);
+    return true;
+}
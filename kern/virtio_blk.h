@@ -0,0 +1,18 @@
+#ifndef JOS_KERN_VIRTIO_BLK_H
+#define JOS_KERN_VIRTIO_BLK_H
+
+#include <kern/pci.h>
+#include <kern/virtio.h>
+
+// transitional (legacy) virtio block device
+#define VIRTIO_BLK_PRODUCT_ID 0x1001
+
+struct Env;
+struct IdeDma;
+
+int virtio_blk_attach(struct pci_func *pcif);
+int virtio_blk_submit(struct Env *e, struct IdeDma *req);
+void virtio_blk_kick(void);
+bool virtio_blk_handler(int trapno);
+
+#endif	// JOS_KERN_VIRTIO_BLK_H
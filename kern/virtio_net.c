@@ -0,0 +1,326 @@
+#include <inc/x86.h>
+#include <inc/string.h>
+#include <inc/error.h>
+#include <kern/env.h>
+#include <kern/virtio.h>
+#include <kern/virtio_net.h>
+#include <kern/netdev.h>
+#include <kern/pmap.h>
+#include <kern/picirq.h>
+#include <kern/sched.h>
+
+// Network device features
+#define VIRTIO_NET_F_MAC            (1 << 5)    // config holds the MAC address
+
+// queues of the network device
+#define VIRTIO_NET_RXQ              0
+#define VIRTIO_NET_TXQ              1
+
+// notify the device of refilled reception buffers in batches of this size
+#define RX_KICK_BATCH               16
+
+// header preceding every packet, without VIRTIO_NET_F_MRG_RXBUF
+struct virtio_net_hdr {
+    uint8_t flags;
+    uint8_t gso_type;
+    uint16_t hdr_len;
+    uint16_t gso_size;
+    uint16_t csum_start;
+    uint16_t csum_offset;
+} __attribute__ ((packed));
+
+// most virtio network devices driven at once
+#define VIRTIO_NET_MAX NETDEV_MAX
+
+// driver state of a single device
+struct virtio_net {
+    uint16_t io_base;
+    int irq_line;
+    uint8_t mac_addr[6];
+
+    struct virtq rxq;
+    struct virtq txq;
+
+    // each packet takes two descriptors, 2 * slot for the header,
+    // and 2 * slot + 1 for the data
+    struct virtio_net_hdr rx_hdrs[VQ_MAX_SIZE / 2];
+    struct virtio_net_hdr tx_hdrs[VQ_MAX_SIZE / 2];
+
+    struct PageInfo *rx_pages[VQ_MAX_SIZE / 2];
+    struct PageInfo *tx_pages[VQ_MAX_SIZE / 2];
+
+    // transmission slots not used by the device
+    uint16_t tx_free[VQ_MAX_SIZE / 2];
+    size_t tx_free_count;
+
+    // reception buffers given back to the ring since the device was notified
+    size_t rx_unkicked;
+    // packets placed in the ring since the device was notified
+    size_t tx_unkicked;
+};
+
+// the queues must be physically contiguous, which the kernel image is
+static uint8_t rxq_mem[VIRTIO_NET_MAX][VRING_SIZE(VQ_MAX_SIZE)] __attribute__ ((aligned (PGSIZE)));
+static uint8_t txq_mem[VIRTIO_NET_MAX][VRING_SIZE(VQ_MAX_SIZE)] __attribute__ ((aligned (PGSIZE)));
+
+static struct virtio_net virtio_nets[VIRTIO_NET_MAX];
+static size_t virtio_net_count = 0;
+
+// points the reception slot at its page, and gives it to the device
+static void post_rx_slot(struct virtio_net *dev, uint16_t slot) {
+    volatile struct vring_desc *hdr = &dev->rxq.desc[2 * slot];
+    volatile struct vring_desc *data = &dev->rxq.desc[2 * slot + 1];
+
+    hdr->addr = PADDR(&dev->rx_hdrs[slot]);
+    hdr->len = sizeof(struct virtio_net_hdr);
+    hdr->flags = VRING_DESC_F_NEXT | VRING_DESC_F_WRITE;
+    hdr->next = 2 * slot + 1;
+
+    //write data after a place for length as in pkt DS
+    data->addr = page2pa(dev->rx_pages[slot]) + sizeof(int);
+    data->len = PGSIZE - sizeof(int);
+    data->flags = VRING_DESC_F_WRITE;
+    data->next = 0;
+
+    virtq_avail(&dev->rxq, 2 * slot);
+}
+
+// releases the transmission slots the device is done with
+static void reclaim_tx(struct virtio_net *dev) {
+    struct virtq *txq = &dev->txq;
+    while (txq->last_used != txq->used->idx) {
+        uint16_t slot = txq->used->ring[txq->last_used % txq->size].id / 2;
+        txq->last_used++;
+        if (dev->tx_pages[slot] != NULL) {
+            // ensure the page gets recycled if every env unmapped it
+            page_decref(dev->tx_pages[slot]);
+            dev->tx_pages[slot] = NULL;
+        }
+        dev->tx_free[dev->tx_free_count++] = slot;
+    }
+}
+
+static void virtio_net_read_mac(void *arg, uint8_t *mac) {
+    struct virtio_net *dev = arg;
+    memcpy(mac, dev->mac_addr, sizeof(dev->mac_addr));
+}
+
+// notifies the device of the packets placed in the ring since it last was
+static void kick_tx(struct virtio_net *dev) {
+    if (dev->tx_unkicked > 0) {
+        dev->tx_unkicked = 0;
+        virtq_kick(dev->io_base, &dev->txq);
+    }
+}
+
+// takes an address to the packet data, and transmits it over the network.
+// the device isn't notified if more packets follow, but of all of them
+// at once with the last.
+// returns 0 on success, -E_RX_FULL if the transmit queue is full.
+static int virtio_net_transmit(void *arg, void *addr, size_t length, bool more) {
+    struct virtio_net *dev = arg;
+    reclaim_tx(dev);
+    if (dev->tx_free_count == 0) {
+        // the device must see the whole burst to free a slot
+        kick_tx(dev);
+        // ask for an interrupt once the device frees a slot
+        dev->txq.avail->flags &= ~VRING_AVAIL_F_NO_INTERRUPT;
+        curenv->env_waits_for_output = true;
+        curenv->env_status = ENV_WAITING_FOR_IO;
+        return -E_RX_FULL;
+    }
+    uint16_t slot = dev->tx_free[--dev->tx_free_count];
+
+    dev->tx_pages[slot] = page_lookup(curenv->env_pgdir, addr, NULL);
+    // ensure page doesn't get recycled when unmapped in userspace
+    dev->tx_pages[slot]->pp_ref += 1;
+    size_t offset = addr - ROUNDDOWN(addr, PGSIZE);
+
+    volatile struct vring_desc *hdr = &dev->txq.desc[2 * slot];
+    volatile struct vring_desc *data = &dev->txq.desc[2 * slot + 1];
+    memset(&dev->tx_hdrs[slot], 0, sizeof(struct virtio_net_hdr));
+    hdr->addr = PADDR(&dev->tx_hdrs[slot]);
+    hdr->len = sizeof(struct virtio_net_hdr);
+    hdr->flags = VRING_DESC_F_NEXT;
+    hdr->next = 2 * slot + 1;
+    data->addr = page2pa(dev->tx_pages[slot]) + offset;
+    data->len = length;
+    data->flags = 0;
+    data->next = 0;
+
+    virtq_avail(&dev->txq, 2 * slot);
+    dev->tx_unkicked++;
+    if (!more || dev->tx_free_count == 0) {
+        kick_tx(dev);
+    }
+    return 0;
+}
+
+// packets aren't tracked, as they are never sent in place
+static size_t virtio_net_take_completed(void *arg) {
+    return 0;
+}
+
+// takes an address to map the received packet at.
+// maps the page holding the next received packet, as a struct jif_pkt.
+// returns 0 on success, -E_RX_EMPTY if there is no packet is available.
+// returns -E_NO_MEM on allocation failure
+static int virtio_net_receive(void *arg, void *addr) {
+    struct virtio_net *dev = arg;
+    struct virtq *rxq = &dev->rxq;
+    int r;
+    if (rxq->last_used == rxq->used->idx) {
+        // no packets to receive
+        // env_status will be changed by an interrupt upon recv
+        curenv->env_waits_for_input = true;
+        curenv->env_status = ENV_WAITING_FOR_IO;
+        return -E_RX_EMPTY;
+    }
+    volatile struct vring_used_elem *elem = &rxq->used->ring[rxq->last_used % rxq->size];
+    uint16_t slot = elem->id / 2;
+
+    // allocate new page instead the one received
+    struct PageInfo *replacement_page = page_alloc(ALLOC_ZERO);
+    if (replacement_page == NULL) {
+        return -E_NO_MEM;
+    }
+
+    // write length to the beggining of page
+    int *pkt_size = (int *)page2kva(dev->rx_pages[slot]);
+    *pkt_size = (int)(elem->len - sizeof(struct virtio_net_hdr));
+
+    //map physical page to user space at supplied addr
+    if ((r = page_insert(curenv->env_pgdir, dev->rx_pages[slot], addr,
+                         PTE_U | PTE_P | PTE_W)) < 0) {
+        page_free(replacement_page);
+        return r;
+    }
+    rxq->last_used++;
+
+    // decrease ref so when user unmaps it, page is recycled
+    page_decref(dev->rx_pages[slot]);
+    dev->rx_pages[slot] = replacement_page;
+    dev->rx_pages[slot]->pp_ref += 1;
+
+    post_rx_slot(dev, slot);
+    // the device may be out of buffers once every packet was taken
+    if (++dev->rx_unkicked >= RX_KICK_BATCH || rxq->last_used == rxq->used->idx) {
+        dev->rx_unkicked = 0;
+        virtq_kick(dev->io_base, rxq);
+    }
+    return 0;
+}
+
+// handles a trap originatng from the virtio network device
+// ignores other types of traps
+// returns true if the trap was handled
+static bool virtio_net_handler(void *arg, int trapno) {
+    struct virtio_net *dev = arg;
+    int i;
+    if (trapno != IRQ_OFFSET + dev->irq_line) {
+        return false;
+    }
+
+    // reading the ISR acknowledges the interrupt
+    uint8_t isr = inb(dev->io_base + VIRTIO_PCI_ISR);
+    if (isr == 0) {
+        return true;
+    }
+
+    // the ISR doesn't tell which queue the device used, their rings do
+    bool received = dev->rxq.last_used != dev->rxq.used->idx;
+    bool sent = dev->txq.last_used != dev->txq.used->idx;
+    if (sent) {
+        // transmissions are reclaimed lazily again once someone can use them
+        dev->txq.avail->flags |= VRING_AVAIL_F_NO_INTERRUPT;
+    }
+
+    for (i = 0; i < NENV; i++) {
+        struct Env *env = &envs[i];
+        if (env->env_status != ENV_WAITING_FOR_IO) {
+            continue;
+        }
+        if (received && env->env_waits_for_input) {
+            env->env_waits_for_input = false;
+            sched_wakeup(env);
+        } else if (sent && env->env_waits_for_output) {
+            env->env_waits_for_output = false;
+            sched_wakeup(env);
+        }
+    }
+    return true;
+}
+
+// segmentation offload, scatter-gather and userspace drivers
+// are only supported by the e1000
+static const struct netdev_ops virtio_net_ops = {
+    .nd_name = "virtio-net",
+    .nd_transmit = virtio_net_transmit,
+    .nd_transmit_sg = NULL,
+    .nd_take_completed = virtio_net_take_completed,
+    .nd_receive = virtio_net_receive,
+    .nd_read_mac = virtio_net_read_mac,
+    .nd_bypass = NULL,
+    .nd_release = NULL,
+    .nd_handler = virtio_net_handler,
+};
+
+int virtio_net_attach(struct pci_func *pcif) {
+    size_t i;
+    if (virtio_net_count == VIRTIO_NET_MAX) {
+        return 0;
+    }
+    size_t index = virtio_net_count;
+    struct virtio_net *dev = &virtio_nets[index];
+    pci_func_enable(pcif);
+    dev->io_base = pcif->reg_base[0];
+
+    // reset the device, and tell it a driver was found
+    outb(dev->io_base + VIRTIO_PCI_STATUS, 0);
+    outb(dev->io_base + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    outb(dev->io_base + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+    // only the MAC address feature is used, packets are sent whole
+    uint32_t features = inl(dev->io_base + VIRTIO_PCI_HOST_FEATURES);
+    outl(dev->io_base + VIRTIO_PCI_GUEST_FEATURES, features & VIRTIO_NET_F_MAC);
+    if (features & VIRTIO_NET_F_MAC) {
+        for (i = 0; i < sizeof(dev->mac_addr); i++) {
+            dev->mac_addr[i] = inb(dev->io_base + VIRTIO_PCI_CONFIG + i);
+        }
+    }
+
+    if (virtq_setup(dev->io_base, &dev->rxq, VIRTIO_NET_RXQ, rxq_mem[index]) < 0 ||
+        virtq_setup(dev->io_base, &dev->txq, VIRTIO_NET_TXQ, txq_mem[index]) < 0) {
+        outb(dev->io_base + VIRTIO_PCI_STATUS, VIRTIO_STATUS_FAILED);
+        return 0;
+    }
+    virtio_net_count++;
+
+    // preallocate pages for storing reception data
+    for (i = 0; i < dev->rxq.size / 2; i++) {
+        dev->rx_pages[i] = page_alloc(ALLOC_ZERO);
+        if (dev->rx_pages[i] == NULL) {
+            panic("unable to allocate pages for network reception");
+        }
+        dev->rx_pages[i]->pp_ref += 1;
+        post_rx_slot(dev, i);
+    }
+
+    dev->tx_free_count = 0;
+    for (i = 0; i < dev->txq.size / 2; i++) {
+        dev->tx_free[dev->tx_free_count++] = i;
+    }
+    // completed transmissions are reclaimed lazily,
+    // interrupts are only needed once the queue fills up
+    dev->txq.avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+
+    outb(dev->io_base + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE |
+         VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+    virtq_kick(dev->io_base, &dev->rxq);
+
+    dev->irq_line = pcif->irq_line;
+    irq_enable(dev->irq_line);
+
+    netdev_register(dev, &virtio_net_ops);
+    return true;
+}
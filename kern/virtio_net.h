@@ -0,0 +1,12 @@
+#ifndef JOS_KERN_VIRTIO_NET_H
+#define JOS_KERN_VIRTIO_NET_H
+
+#include <kern/pci.h>
+#include <kern/virtio.h>
+
+// transitional (legacy) virtio network device
+#define VIRTIO_NET_PRODUCT_ID 0x1000
+
+int virtio_net_attach(struct pci_func *pcif);
+
+#endif	// JOS_KERN_VIRTIO_NET_H
@@ -77,13 +77,13 @@ fd_lookup(int fdnum, struct Fd **fd_store)
 
 	if (fdnum < 0 || fdnum >= MAXFD) {
 		if (debug)
-			cprintf("[%08x] bad fd %d\n", thisenv->env_id, fdnum);
+			cprintf("[%08x] bad fd %d\n", curenv->env_id, fdnum);
 		return -E_INVAL;
 	}
 	fd = INDEX2FD(fdnum);
 	if (!(uvpd[PDX(fd)] & PTE_P) || !(uvpt[PGNUM(fd)] & PTE_P)) {
 		if (debug)
-			cprintf("[%08x] closed fd %d\n", thisenv->env_id, fdnum);
+			cprintf("[%08x] closed fd %d\n", curenv->env_id, fdnum);
 		return -E_INVAL;
 	}
 	*fd_store = fd;
@@ -141,7 +141,7 @@ dev_lookup(int dev_id, struct Dev **dev)
 			*dev = devtab[i];
 			return 0;
 		}
-	cprintf("[%08x] unknown device type %d\n", thisenv->env_id, dev_id);
+	cprintf("[%08x] unknown device type %d\n", curenv->env_id, dev_id);
 	*dev = 0;
 	return -E_INVAL;
 }
@@ -212,7 +212,7 @@ read(int fdnum, void *buf, size_t n)
 	    || (r = dev_lookup(fd->fd_dev_id, &dev)) < 0)
 		return r;
 	if ((fd->fd_omode & O_ACCMODE) == O_WRONLY) {
-		cprintf("[%08x] read %d -- bad mode\n", thisenv->env_id, fdnum);
+		cprintf("[%08x] read %d -- bad mode\n", curenv->env_id, fdnum);
 		return -E_INVAL;
 	}
 	if (!dev->dev_read)
@@ -246,7 +246,7 @@ write(int fdnum, const void *buf, size_t n)
 	    || (r = dev_lookup(fd->fd_dev_id, &dev)) < 0)
 		return r;
 	if ((fd->fd_omode & O_ACCMODE) == O_RDONLY) {
-		cprintf("[%08x] write %d -- bad mode\n", thisenv->env_id, fdnum);
+		cprintf("[%08x] write %d -- bad mode\n", curenv->env_id, fdnum);
 		return -E_INVAL;
 	}
 	if (debug)
@@ -280,7 +280,7 @@ ftruncate(int fdnum, off_t newsize)
 		return r;
 	if ((fd->fd_omode & O_ACCMODE) == O_RDONLY) {
 		cprintf("[%08x] ftruncate %d -- bad mode\n",
-			thisenv->env_id, fdnum);
+			curenv->env_id, fdnum);
 		return -E_INVAL;
 	}
 	if (!dev->dev_trunc)
@@ -22,7 +22,7 @@ fsipc(unsigned type, void *dstva)
 	static_assert(sizeof(fsipcbuf) == PGSIZE);
 
 	if (debug)
-		cprintf("[%08x] fsipc %d %08x\n", thisenv->env_id, type, *(uint32_t *)&fsipcbuf);
+		cprintf("[%08x] fsipc %d %08x\n", curenv->env_id, type, *(uint32_t *)&fsipcbuf);
 
 	ipc_send(fsenv, type, &fsipcbuf, PTE_P | PTE_W | PTE_U);
 	return ipc_recv(NULL, dstva, NULL);
@@ -187,3 +187,16 @@ sync(void)
 	return fsipc(FSREQ_SYNC, NULL);
 }
 
+// Get the file server's block cache statistics into *stat, first
+// setting the cache's limit to 'limit' blocks unless it is 0.
+int
+fscache(uint32_t limit, struct BcStat *stat)
+{
+	int r;
+
+	fsipcbuf.cache.req_limit = limit;
+	if ((r = fsipc(FSREQ_CACHE, NULL)) < 0)
+		return r;
+	*stat = fsipcbuf.cacheRet.ret_stat;
+	return 0;
+}
@@ -23,7 +23,7 @@ nsipc(unsigned type)
 	static_assert(sizeof(nsipcbuf) == PGSIZE);
 
 	if (debug)
-		cprintf("[%08x] nsipc %d\n", thisenv->env_id, type);
+		cprintf("[%08x] nsipc %d\n", curenv->env_id, type);
 
 	ipc_send(nsenv, type, &nsipcbuf, PTE_P|PTE_W|PTE_U);
 	return ipc_recv(NULL, NULL, NULL);
@@ -19,12 +19,60 @@ struct Dev devpipe =
 
 #define PIPEBUFSIZ 32		// small to provoke races
 
+// Sleepers are woken through p_seq when the other side reads, writes
+// or closes.  A close bumps p_seq once its Fd page is gone, but the
+// pipe only looks closed once the data page is gone as well, and
+// nothing changes p_seq after that.  So a sleeper that sees the close
+// under way, between the two unmaps, doesn't sleep on p_seq but yields
+// until it is done.
+
 struct Pipe {
 	off_t p_rpos;		// read position
 	off_t p_wpos;		// write position
 	uint8_t p_buf[PIPEBUFSIZ];	// data buffer
+	uint32_t p_seq;		// bumped whenever a sleeper may proceed
+	uint32_t p_sleepers;	// envs sleeping on p_seq
+	uint32_t p_fdppn[2];	// physical pages of the two Fd pages
 };
 
+static int _pipeisclosed(struct Fd *fd, struct Pipe *p);
+
+// Returns true while some Fd page of p is mapped without the data page
+// that goes with it, or the other way round: while a close or a dup of
+// one of its ends is under way.
+static bool
+_pipeischanging(struct Pipe *p)
+{
+	int ref = pageref(p);
+
+	return ref != pages[p->p_fdppn[0]].pp_ref + pages[p->p_fdppn[1]].pp_ref;
+}
+
+// Sleep until p changes, given the value of p_seq read before
+// checking that the caller cannot proceed.  If no close was under way
+// when seq was read, the close will still bump p_seq; otherwise it is
+// seen here, either under way or done.
+static void
+pipe_sleep(struct Fd *fd, struct Pipe *p, uint32_t seq)
+{
+	if (_pipeischanging(p) || _pipeisclosed(fd, p)) {
+		sys_yield();
+		return;
+	}
+	__sync_fetch_and_add(&p->p_sleepers, 1);
+	sys_futex_wait(&p->p_seq, seq, 0);
+	__sync_fetch_and_sub(&p->p_sleepers, 1);
+}
+
+// Let sleepers on the other side know that p changed.
+static void
+pipe_wakeup(struct Pipe *p)
+{
+	__sync_fetch_and_add(&p->p_seq, 1);
+	if (p->p_sleepers)
+		sys_futex_wake(&p->p_seq, NENV);
+}
+
 int
 pipe(int pfd[2])
 {
@@ -48,6 +96,9 @@ pipe(int pfd[2])
 	if ((r = sys_page_map(0, va, 0, fd2data(fd1), PTE_P|PTE_W|PTE_U|PTE_SHARE)) < 0)
 		goto err3;
 
+	((struct Pipe *) va)->p_fdppn[0] = PGNUM(uvpt[PGNUM(fd0)]);
+	((struct Pipe *) va)->p_fdppn[1] = PGNUM(uvpt[PGNUM(fd1)]);
+
 	// set up fd structures
 	fd0->fd_dev_id = devpipe.dev_id;
 	fd0->fd_omode = O_RDONLY;
@@ -56,7 +107,7 @@ pipe(int pfd[2])
 	fd1->fd_omode = O_WRONLY;
 
 	if (debug)
-		cprintf("[%08x] pipecreate %08x\n", thisenv->env_id, uvpt[PGNUM(va)]);
+		cprintf("[%08x] pipecreate %08x\n", curenv->env_id, uvpt[PGNUM(va)]);
 
 	pfd[0] = fd2num(fd0);
 	pfd[1] = fd2num(fd1);
@@ -75,16 +126,17 @@ pipe(int pfd[2])
 static int
 _pipeisclosed(struct Fd *fd, struct Pipe *p)
 {
+	const volatile struct Env *e = curenv;
 	int n, nn, ret;
 
 	while (1) {
-		n = thisenv->env_runs;
+		n = e->env_runs;
 		ret = pageref(fd) == pageref(p);
-		nn = thisenv->env_runs;
+		nn = e->env_runs;
 		if (n == nn)
 			return ret;
 		if (n != nn && ret == 1)
-			cprintf("pipe race avoided\n", n, thisenv->env_runs, ret);
+			cprintf("pipe race avoided\n", n, e->env_runs, ret);
 	}
 }
 
@@ -106,33 +158,37 @@ devpipe_read(struct Fd *fd, void *vbuf, size_t n)
 {
 	uint8_t *buf;
 	size_t i;
+	uint32_t seq;
 	struct Pipe *p;
 
 	p = (struct Pipe*)fd2data(fd);
 	if (debug)
 		cprintf("[%08x] devpipe_read %08x %d rpos %d wpos %d\n",
-			thisenv->env_id, uvpt[PGNUM(p)], n, p->p_rpos, p->p_wpos);
+			curenv->env_id, uvpt[PGNUM(p)], n, p->p_rpos, p->p_wpos);
 
 	buf = vbuf;
 	for (i = 0; i < n; i++) {
-		while (p->p_rpos == p->p_wpos) {
+		while ((seq = p->p_seq), p->p_rpos == p->p_wpos) {
 			// pipe is empty
 			// if we got any data, return it
 			if (i > 0)
-				return i;
+				goto done;
 			// if all the writers are gone, note eof
 			if (_pipeisclosed(fd, p))
 				return 0;
-			// yield and see what happens
+			// sleep until a writer comes along
 			if (debug)
-				cprintf("devpipe_read yield\n");
-			sys_yield();
+				cprintf("devpipe_read sleep\n");
+			pipe_sleep(fd, p, seq);
 		}
 		// there's a byte.  take it.
 		// wait to increment rpos until the byte is taken!
 		buf[i] = p->p_buf[p->p_rpos % PIPEBUFSIZ];
 		p->p_rpos++;
 	}
+	done:
+	// writers waiting for room can go on
+	pipe_wakeup(p);
 	return i;
 }
 
@@ -140,27 +196,35 @@ static ssize_t
 devpipe_write(struct Fd *fd, const void *vbuf, size_t n)
 {
 	const uint8_t *buf;
-	size_t i;
+	size_t i, woken;
+	uint32_t seq;
 	struct Pipe *p;
 
 	p = (struct Pipe*) fd2data(fd);
 	if (debug)
 		cprintf("[%08x] devpipe_write %08x %d rpos %d wpos %d\n",
-			thisenv->env_id, uvpt[PGNUM(p)], n, p->p_rpos, p->p_wpos);
+			curenv->env_id, uvpt[PGNUM(p)], n, p->p_rpos, p->p_wpos);
 
 	buf = vbuf;
+	woken = 0;
 	for (i = 0; i < n; i++) {
-		while (p->p_wpos >= p->p_rpos + sizeof(p->p_buf)) {
+		while ((seq = p->p_seq), p->p_wpos >= p->p_rpos + sizeof(p->p_buf)) {
 			// pipe is full
 			// if all the readers are gone
 			// (it's only writers like us now),
 			// note eof
 			if (_pipeisclosed(fd, p))
 				return 0;
-			// yield and see what happens
+			// hand what we wrote to the readers, then
+			// sleep until one of them makes room
+			if (i > woken) {
+				pipe_wakeup(p);
+				woken = i;
+				continue;
+			}
 			if (debug)
-				cprintf("devpipe_write yield\n");
-			sys_yield();
+				cprintf("devpipe_write sleep\n");
+			pipe_sleep(fd, p, seq);
 		}
 		// there's room for a byte.  store it.
 		// wait to increment wpos until the byte is stored!
@@ -168,6 +232,8 @@ devpipe_write(struct Fd *fd, const void *vbuf, size_t n)
 		p->p_wpos++;
 	}
 
+	if (i > woken)
+		pipe_wakeup(p);
 	return i;
 }
 
@@ -185,7 +251,13 @@ devpipe_stat(struct Fd *fd, struct Stat *stat)
 static int
 devpipe_close(struct Fd *fd)
 {
+	struct Pipe *p = (struct Pipe*) fd2data(fd);
+
+	// The Fd page goes first, so that the other side doesn't take the
+	// pipe for closed while this side still has it (see _pipeisclosed).
 	(void) sys_page_unmap(0, fd);
-	return sys_page_unmap(0, fd2data(fd));
+	// Sleepers now either wake, or see the close under way.
+	pipe_wakeup(p);
+	return sys_page_unmap(0, p);
 }
 
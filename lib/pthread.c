@@ -0,0 +1,175 @@
+// Kernel-scheduled threads: each thread is an environment that shares
+// this one's address space (see sys_thread_create), so threads of one
+// program can run on several CPUs at once.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+// Thread i lives in the slot at PTHREAD_SLOT(i), laid out as
+//	[guard] [exception stack] [guard] [PTHREAD_STACK_PAGES of stack]
+// with unmapped guard pages, and its struct pthread at the top of its
+// stack.  The main thread keeps the normal stacks and has no slot.
+#define PTHREAD_BASE		0xE0000000
+#define PTHREAD_MAX		32
+#define PTHREAD_STACK_PAGES	4
+#define PTHREAD_SLOT_SIZE	((3 + PTHREAD_STACK_PAGES) * PGSIZE)
+#define PTHREAD_SLOT(i)		(PTHREAD_BASE + (i) * PTHREAD_SLOT_SIZE)
+#define PTHREAD_XSTACKTOP(i)	(PTHREAD_SLOT(i) + 2 * PGSIZE)
+#define PTHREAD_STACK(i)	(PTHREAD_SLOT(i) + 3 * PGSIZE)
+#define PTHREAD_STACKTOP(i)	(PTHREAD_SLOT(i) + PTHREAD_SLOT_SIZE)
+
+struct pthread {
+	envid_t pt_envid;		// Set by pthread_create, 0 until then
+	int pt_slot;
+	void *(*pt_func)(void *);
+	void *pt_arg;
+	void *pt_ret;			// Set by pthread_exit
+};
+
+static pthread_mutex_t slot_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool slot_used[PTHREAD_MAX];
+
+static void
+slot_free(int i)
+{
+	uintptr_t va;
+
+	for (va = PTHREAD_SLOT(i); va < PTHREAD_STACKTOP(i); va += PGSIZE)
+		sys_page_unmap(0, (void *) va);
+	pthread_mutex_lock(&slot_lock);
+	slot_used[i] = false;
+	pthread_mutex_unlock(&slot_lock);
+}
+
+static void
+pthread_entry(struct pthread *pt)
+{
+	pthread_exit(pt->pt_func(pt->pt_arg));
+}
+
+// Start a thread running func(arg).  Returns 0 on success, < 0 on
+// error.
+int
+pthread_create(pthread_t *thread, void *(*func)(void *), void *arg)
+{
+	struct pthread *pt;
+	uint32_t *esp;
+	uintptr_t va;
+	int i, r;
+
+	pthread_mutex_lock(&slot_lock);
+	for (i = 0; i < PTHREAD_MAX && slot_used[i]; i++)
+		;
+	if (i < PTHREAD_MAX)
+		slot_used[i] = true;
+	pthread_mutex_unlock(&slot_lock);
+	if (i == PTHREAD_MAX)
+		return -E_NO_FREE_ENV;
+
+	if ((r = sys_page_alloc(0, (void *) (PTHREAD_XSTACKTOP(i) - PGSIZE),
+				PTE_P|PTE_U|PTE_W)) < 0)
+		goto fail;
+	for (va = PTHREAD_STACK(i); va < PTHREAD_STACKTOP(i); va += PGSIZE)
+		if ((r = sys_page_alloc(0, (void *) va, PTE_P|PTE_U|PTE_W)) < 0)
+			goto fail;
+
+	pt = (struct pthread *) PTHREAD_STACKTOP(i) - 1;
+	pt->pt_envid = 0;
+	pt->pt_slot = i;
+	pt->pt_func = func;
+	pt->pt_arg = arg;
+	pt->pt_ret = NULL;
+
+	// Start in pthread_entry(pt) as if it had been called.
+	esp = (uint32_t *) pt - 2;
+	esp[0] = 0;
+	esp[1] = (uint32_t) pt;
+
+	if ((r = sys_thread_create(pthread_entry, esp,
+				   (void *) PTHREAD_XSTACKTOP(i), pt)) < 0)
+		goto fail;
+	pt->pt_envid = r;
+	sys_futex_wake((uint32_t *) &pt->pt_envid, NENV);
+	*thread = pt;
+	return 0;
+
+	fail:
+	slot_free(i);
+	return r;
+}
+
+// Wait for thread to finish, store the value it returned or passed to
+// pthread_exit in *ret_store if ret_store is not NULL, and release its
+// stacks.
+int
+pthread_join(pthread_t thread, void **ret_store)
+{
+	// pthread_create sets pt_envid once sys_thread_create returns, by
+	// when the thread may have handed out its pthread_self() already
+	while (thread->pt_envid == 0)
+		sys_futex_wait((uint32_t *) &thread->pt_envid, 0, 0);
+	wait(thread->pt_envid);
+	if (ret_store)
+		*ret_store = thread->pt_ret;
+	slot_free(thread->pt_slot);
+	return 0;
+}
+
+// End the calling thread, making ret available to pthread_join.  The
+// rest of the program keeps running until a thread calls exit(), which
+// ends every thread of the program.  From the main thread, this is
+// exit().
+void
+pthread_exit(void *ret)
+{
+	struct pthread *pt = pthread_self();
+
+	if (pt == NULL)
+		exit();
+	else {
+		pt->pt_ret = ret;
+		sys_thread_exit();
+	}
+	panic("pthread_exit: still running");
+}
+
+// The calling thread, or NULL in the main thread.  The thread's slot
+// is kept in its env_tls.
+pthread_t
+pthread_self(void)
+{
+	return (pthread_t) envs[ENVX(sys_getenvid())].env_tls;
+}
+
+// Mutexes sleep in the kernel when contended (see sys_futex_wait), and
+// cost no system call otherwise.
+void
+pthread_mutex_lock(pthread_mutex_t *m)
+{
+	uint32_t c;
+
+	if ((c = __sync_val_compare_and_swap(&m->m_state, 0, 1)) == 0)
+		return;
+	if (c != 2)
+		c = xchg(&m->m_state, 2);
+	while (c != 0) {
+		sys_futex_wait(&m->m_state, 2, 0);
+		c = xchg(&m->m_state, 2);
+	}
+}
+
+// Returns 0 if the mutex was taken, -E_AGAIN if it is held.
+int
+pthread_mutex_trylock(pthread_mutex_t *m)
+{
+	return __sync_val_compare_and_swap(&m->m_state, 0, 1) == 0 ? 0 : -E_AGAIN;
+}
+
+void
+pthread_mutex_unlock(pthread_mutex_t *m)
+{
+	if (__sync_fetch_and_sub(&m->m_state, 1) != 1) {
+		m->m_state = 0;
+		sys_futex_wake(&m->m_state, 1);
+	}
+}
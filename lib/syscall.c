@@ -40,7 +40,14 @@ syscall(int num, int check, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 void
 sys_cputs(const char *s, size_t len)
 {
-	syscall(SYS_cputs, 0, (uint32_t)s, len, 0, 0, 0);
+	int r;
+
+	// the kernel takes what fits in its console buffer, sleeping
+	// us when it is full
+	while (len > 0 && (r = syscall(SYS_cputs, 0, (uint32_t)s, len, 0, 0, 0)) >= 0) {
+		s += r;
+		len -= r;
+	}
 }
 
 int
@@ -123,14 +130,66 @@ sys_time_msec(void)
 	return (unsigned int) syscall(SYS_time_msec, 0, 0, 0, 0, 0, 0);
 }
 
-int sys_net_try_send(void *va, size_t length) {
-    return syscall(SYS_net_try_send, true, (uint32_t)va, length, 0, 0, 0);
+int sys_net_try_send(int dev, void *va, size_t length, int flags) {
+    return syscall(SYS_net_try_send, true, dev, (uint32_t)va, length, flags, 0);
+}
+
+int sys_net_recv(int dev, void *va) {
+    return syscall(SYS_net_recv, true, dev, (uint32_t)va, 0, 0, 0);
+}
+
+int sys_get_mac_addr(int dev, void *addr) {
+    return syscall(SYS_get_mac_addr, false, dev, (uint32_t)addr, 0, 0, 0);
+}
+
+int sys_net_try_send_tso(int dev, void *va, size_t length, uint16_t mss) {
+    return syscall(SYS_net_try_send_tso, true, dev, (uint32_t)va, length, mss, 0);
+}
+
+int sys_net_try_send_sg(int dev, const struct jif_sg *sg, size_t nsg, uint16_t mss) {
+    return syscall(SYS_net_try_send_sg, true, dev, (uint32_t)sg, nsg, mss, 0);
+}
+
+int sys_net_bypass(int dev, void *va) {
+    return syscall(SYS_net_bypass, true, dev, (uint32_t)va, 0, 0, 0);
+}
+
+int sys_env_set_affinity(envid_t envid, uint32_t mask) {
+    return syscall(SYS_env_set_affinity, true, envid, mask, 0, 0, 0);
+}
+
+int sys_env_set_priority(envid_t envid, int priority) {
+    return syscall(SYS_env_set_priority, true, envid, priority, 0, 0, 0);
+}
+
+int sys_futex_wait(const volatile uint32_t *addr, uint32_t expected, uint32_t timeout_ms) {
+    return syscall(SYS_futex_wait, false, (uint32_t)addr, expected, timeout_ms, 0, 0);
+}
+
+int sys_futex_wake(const volatile uint32_t *addr, int n) {
+    return syscall(SYS_futex_wake, true, (uint32_t)addr, n, 0, 0, 0);
+}
+
+envid_t sys_thread_create(void *eip, void *esp, void *xstacktop, void *tls) {
+    return syscall(SYS_thread_create, false, (uint32_t)eip, (uint32_t)esp, (uint32_t)xstacktop, (uint32_t)tls, 0);
+}
+
+void sys_thread_exit(void) {
+    syscall(SYS_thread_exit, false, 0, 0, 0, 0, 0);
+}
+
+int sys_prof_ctl(int op, int arg) {
+    return syscall(SYS_prof_ctl, true, op, arg, 0, 0, 0);
+}
+
+int sys_env_stat(envid_t envid, struct EnvStat *st) {
+    return syscall(SYS_env_stat, true, envid, (uint32_t)st, 0, 0, 0);
 }
 
-int sys_net_recv(void *va) {
-    return syscall(SYS_net_recv, true, (uint32_t)va, 0, 0, 0, 0);
+int sys_trace_ctl(int op) {
+    return syscall(SYS_trace_ctl, true, op, 0, 0, 0, 0);
 }
 
-int sys_get_mac_addr(void *addr) {
-    return syscall(SYS_get_mac_addr, true, (uint32_t)addr, 0, 0, 0, 0);
+int sys_ide_dma(struct IdeDma *req) {
+    return syscall(SYS_ide_dma, true, (uint32_t)req, 0, 0, 0, 0);
 }
\ No newline at end of file
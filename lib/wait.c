@@ -5,9 +5,11 @@ void
 wait(envid_t envid)
 {
 	const volatile struct Env *e;
+	unsigned status;
 
 	assert(envid != 0);
 	e = &envs[ENVX(envid)];
-	while (e->env_id == envid && e->env_status != ENV_FREE)
-		sys_yield();
+	while (e->env_id == envid && (status = e->env_status) != ENV_FREE)
+		// the kernel wakes env_status when it frees the env
+		sys_futex_wait(&e->env_status, status, 0);
 }
@@ -4,8 +4,9 @@
 extern union Nsipc nsipcbuf;
 
 
+// receives the packets of the given NIC
 void
-input(envid_t ns_envid)
+input(envid_t ns_envid, int nic)
 {
 	binaryname = "ns_input";
 
@@ -18,7 +19,7 @@ input(envid_t ns_envid)
 
 	int r, i;
 	while(1){
-		while ((r = sys_net_recv(&nsipcbuf))){
+		while ((r = sys_net_recv(nic, &nsipcbuf))){
 			if (r == -E_RX_EMPTY){
 				sys_yield();
 			}
@@ -29,6 +30,7 @@ input(envid_t ns_envid)
 		if (r < 0){
 			panic("input error: sys_net_recv returned: %e\n", r);
 		}
-		ipc_send(ns_envid, NSREQ_INPUT, &nsipcbuf, PTE_P | PTE_U);
+		// the page is handed over writable, as lwIP parses packets in place
+		ipc_send(ns_envid, NSREQ_INPUT, &nsipcbuf, PTE_P | PTE_U | PTE_W);
 	}
 }
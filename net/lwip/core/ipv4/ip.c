@@ -522,7 +522,12 @@ ip_output_if(struct pbuf *p, struct ip_addr *src, struct ip_addr *dest,
 
 #if IP_FRAG
   /* don't fragment if interface has mtu set to 0 [loopif] */
-  if (netif->mtu && (p->tot_len > netif->mtu))
+  if (netif->mtu && (p->tot_len > netif->mtu)
+#if LWIP_TSO
+      /* nor TSO segments, the netif cuts those into frames itself */
+      && !(p->flags & PBUF_FLAG_TSO)
+#endif /* LWIP_TSO */
+      )
     return ip_frag(p,netif,dest);
 #endif
 
@@ -58,6 +58,10 @@
 
 /* Forward declarations.*/
 static void tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb);
+static err_t tcp_seg_unshare(struct tcp_pcb *pcb, struct tcp_seg *seg);
+#if LWIP_TSO
+static void tcp_tso_split(struct tcp_pcb *pcb, u32_t wnd);
+#endif /* LWIP_TSO */
 
 /**
  * Called by tcp_close() to send a segment including flags but not data.
@@ -111,6 +115,27 @@ tcp_write(struct tcp_pcb *pcb, const void *data, u16_t len, u8_t apiflags)
   }
 }
 
+/**
+ * Largest payload tcp_enqueue() may put in one segment: the MSS, or a
+ * multiple of it if the outgoing netif segments TCP in hardware.
+ *
+ * @param pcb Protocol control block for the TCP connection
+ * @return maximum segment payload in bytes
+ */
+static u16_t
+tcp_maxseg(struct tcp_pcb *pcb)
+{
+#if LWIP_TSO
+  struct netif *netif;
+
+  netif = ip_route(&(pcb->remote_ip));
+  if (netif != NULL && (netif->flags & NETIF_FLAG_TSO) && pcb->mss > 0) {
+    return (TCP_TSO_MAXSEG / pcb->mss) * pcb->mss;
+  }
+#endif /* LWIP_TSO */
+  return pcb->mss;
+}
+
 /**
  * Enqueue either data or TCP options (but not both) for tranmission
  *
@@ -134,7 +159,7 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, u16_t len,
   struct pbuf *p;
   struct tcp_seg *seg, *useg, *queue;
   u32_t seqno;
-  u16_t left, seglen;
+  u16_t left, seglen, maxseg;
   void *ptr;
   u16_t queuelen;
 
@@ -181,11 +206,12 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, u16_t len,
    * the local "queue" variable. */
   useg = queue = seg = NULL;
   seglen = 0;
+  maxseg = tcp_maxseg(pcb);
   while (queue == NULL || left > 0) {
 
-    /* The segment length should be the MSS if the data to be enqueued
-     * is larger than the MSS. */
-    seglen = left > pcb->mss? pcb->mss: left;
+    /* The segment length should be the maximum segment size if the data
+     * to be enqueued is larger than it. */
+    seglen = left > maxseg? maxseg: left;
 
     /* Allocate memory for tcp_seg, and fill in fields. */
     seg = memp_malloc(MEMP_TCP_SEG);
@@ -331,7 +357,7 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, u16_t len,
     !(TCPH_FLAGS(useg->tcphdr) & (TCP_SYN | TCP_FIN)) &&
     !(flags & (TCP_SYN | TCP_FIN)) &&
     /* fit within max seg size */
-    useg->len + queue->len <= pcb->mss) {
+    useg->len + queue->len <= maxseg) {
     /* Remove TCP header from first segment of our to-be-queued list */
     if(pbuf_header(queue->p, -TCP_HLEN)) {
       /* Can we cope with this failing?  Just assert for now */
@@ -428,6 +454,9 @@ tcp_output(struct tcp_pcb *pcb)
 
   wnd = LWIP_MIN(pcb->snd_wnd, pcb->cwnd);
 
+#if LWIP_TSO
+  tcp_tso_split(pcb, wnd);
+#endif /* LWIP_TSO */
   seg = pcb->unsent;
 
   /* useg should point to last segment on unacked queue */
@@ -573,6 +602,9 @@ tcp_output(struct tcp_pcb *pcb)
     } else {
       tcp_seg_free(seg);
     }
+#if LWIP_TSO
+    tcp_tso_split(pcb, wnd);
+#endif /* LWIP_TSO */
     seg = pcb->unsent;
   }
 
@@ -587,6 +619,119 @@ tcp_output(struct tcp_pcb *pcb)
   return ERR_OK;
 }
 
+#if LWIP_TSO
+/**
+ * Called by tcp_output() when the first unsent segment is a TSO segment
+ * that does not fit into the send window. Cuts it after as many full MSS
+ * as the window allows (at least one), moving the rest into a new segment
+ * that follows it on the unsent queue. Without this a segment built while
+ * the window was large could stall the connection once cwnd shrinks.
+ *
+ * @param pcb the tcp_pcb for the TCP connection
+ * @param wnd the usable window tcp_output() is sending against
+ */
+static void
+tcp_tso_split(struct tcp_pcb *pcb, u32_t wnd)
+{
+  struct tcp_seg *seg, *tail;
+  struct pbuf *p;
+  u32_t avail;
+  u16_t headlen, taillen, hdrlen, oldclen;
+
+  seg = pcb->unsent;
+  if (seg == NULL || seg->len <= pcb->mss ||
+      ntohl(seg->tcphdr->seqno) - pcb->lastack + seg->len <= wnd) {
+    return;
+  }
+
+  /* the head is cut down in place */
+  if (tcp_seg_unshare(pcb, seg) != ERR_OK) {
+    return;
+  }
+
+  avail = wnd - LWIP_MIN(wnd, ntohl(seg->tcphdr->seqno) - pcb->lastack);
+  headlen = avail < pcb->mss? pcb->mss: (u16_t)((avail / pcb->mss) * pcb->mss);
+  taillen = seg->len - headlen;
+  hdrlen = TCPH_HDRLEN(seg->tcphdr) * 4;
+
+  tail = memp_malloc(MEMP_TCP_SEG);
+  if (tail == NULL) {
+    return;
+  }
+  if ((p = pbuf_alloc(PBUF_TRANSPORT, taillen, PBUF_RAM)) == NULL) {
+    memp_free(MEMP_TCP_SEG, tail);
+    return;
+  }
+  /* a retransmitted segment still carries the headers of the lower layers */
+  pbuf_header(seg->p, -(s16_t)((u8_t *)seg->tcphdr - (u8_t *)seg->p->payload));
+  pbuf_copy_partial(seg->p, p->payload, taillen, hdrlen + headlen);
+  tail->dataptr = p->payload;
+  if (pbuf_header(p, hdrlen)) {
+    pbuf_free(p);
+    memp_free(MEMP_TCP_SEG, tail);
+    return;
+  }
+  SMEMCPY(p->payload, seg->tcphdr, hdrlen);
+  tail->p = p;
+  tail->len = taillen;
+  tail->tcphdr = p->payload;
+  tail->tcphdr->seqno = htonl(ntohl(seg->tcphdr->seqno) + headlen);
+  tail->next = seg->next;
+
+  /* the head keeps all flags but PSH, which belongs to the end of the data */
+  TCPH_FLAGS_SET(seg->tcphdr, TCPH_FLAGS(seg->tcphdr) & ~TCP_PSH);
+  oldclen = pbuf_clen(seg->p);
+  pbuf_realloc(seg->p, hdrlen + headlen);
+  seg->len = headlen;
+  seg->next = tail;
+
+  pcb->snd_queuelen += pbuf_clen(seg->p) + pbuf_clen(tail->p) - oldclen;
+  LWIP_DEBUGF(TCP_OUTPUT_DEBUG, ("tcp_tso_split: %"U16_F" + %"U16_F"\n",
+                                 headlen, taillen));
+}
+#endif /* LWIP_TSO */
+
+/**
+ * Gives a segment a pbuf of its own if someone else still holds a
+ * reference to the one it was last sent in: the netif may hand a packet
+ * to the NIC in place and keep it until the card has read it (see
+ * sg_output in jif.c), and ARP may keep it queued. The headers of a
+ * segment are rewritten for every transmission, so they must not be
+ * written into a packet that is still on its way out.
+ *
+ * @param pcb the tcp_pcb whose snd_queuelen accounts for the segment
+ * @param seg the tcp_seg about to be changed
+ * @return ERR_OK if seg can be changed in place, ERR_MEM if there was no
+ *         memory for the copy
+ */
+static err_t
+tcp_seg_unshare(struct tcp_pcb *pcb, struct tcp_seg *seg)
+{
+  struct pbuf *p;
+  u16_t off;
+
+  if (seg->p->ref == 1) {
+    return ERR_OK;
+  }
+
+  /* a segment sent before still carries the headers of the lower layers */
+  off = (u16_t)((u8_t *)seg->tcphdr - (u8_t *)seg->p->payload);
+  p = pbuf_alloc(PBUF_IP, seg->p->tot_len - off, PBUF_RAM);
+  if (p == NULL) {
+    return ERR_MEM;
+  }
+  pbuf_copy_partial(seg->p, p->payload, p->tot_len, off);
+  seg->dataptr = (u8_t *)p->payload + TCPH_HDRLEN(seg->tcphdr) * 4;
+  pcb->snd_queuelen = pcb->snd_queuelen + pbuf_clen(p) - pbuf_clen(seg->p);
+  pbuf_free(seg->p);
+  seg->p = p;
+  seg->tcphdr = p->payload;
+
+  LWIP_DEBUGF(TCP_OUTPUT_DEBUG, ("tcp_seg_unshare: %"U32_F" copied\n",
+                                 ntohl(seg->tcphdr->seqno)));
+  return ERR_OK;
+}
+
 /**
  * Called by tcp_output() to actually send a TCP segment over IP.
  *
@@ -599,6 +744,13 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
   u16_t len;
   struct netif *netif;
 
+  if (tcp_seg_unshare(pcb, seg) != ERR_OK) {
+    /* the retransmission timer gets another chance at it */
+    if(pcb->rtime == -1)
+      pcb->rtime = 0;
+    return;
+  }
+
   /** @bug Exclude retransmitted segments from this count. */
   snmp_inc_tcpoutsegs();
 
@@ -641,12 +793,25 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
   seg->p->payload = seg->tcphdr;
 
   seg->tcphdr->chksum = 0;
+#if LWIP_TSO
+  /* segments longer than the MSS are only built for TSO capable netifs,
+     which fill in the checksum of every frame they cut the segment into */
+  if (seg->len > pcb->mss) {
+    seg->p->flags |= PBUF_FLAG_TSO;
+    seg->p->tso_mss = pcb->mss;
+  } else {
+    seg->p->flags &= ~PBUF_FLAG_TSO;
+  }
+  if (!(seg->p->flags & PBUF_FLAG_TSO))
+#endif /* LWIP_TSO */
+  {
 #if CHECKSUM_GEN_TCP
   seg->tcphdr->chksum = inet_chksum_pseudo(seg->p,
              &(pcb->local_ip),
              &(pcb->remote_ip),
              IP_PROTO_TCP, seg->p->tot_len);
 #endif
+  }
   TCP_STATS_INC(tcp.xmit);
 
 #if LWIP_NETIF_HWADDRHINT
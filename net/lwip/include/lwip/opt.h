@@ -717,6 +717,23 @@
 #define TCP_SND_BUF                     256
 #endif
 
+/**
+ * LWIP_TSO==1: Build TCP segments larger than the MSS for interfaces that
+ * set NETIF_FLAG_TSO, leaving the split into MSS-sized frames (and their
+ * IP/TCP checksums) to the network hardware.
+ */
+#ifndef LWIP_TSO
+#define LWIP_TSO                        0
+#endif
+
+/**
+ * TCP_TSO_MAXSEG: Upper bound on the payload of a single TSO segment
+ * (bytes). Rounded down to a multiple of the connection's MSS.
+ */
+#ifndef TCP_TSO_MAXSEG
+#define TCP_TSO_MAXSEG                  (8 * TCP_MSS)
+#endif
+
 /**
  * TCP_SND_QUEUELEN: TCP sender buffer space (pbufs). This must be at least
  * as much as (2 * TCP_SND_BUF/TCP_MSS) for things to work.
@@ -789,6 +806,15 @@
 #define PBUF_POOL_BUFSIZE               LWIP_MEM_ALIGN_SIZE(TCP_MSS+40+PBUF_LINK_HLEN)
 #endif
 
+/**
+ * LWIP_SUPPORT_CUSTOM_PBUF==1: Support pbufs whose memory is owned by the
+ * netif driver, which gets them back through a free callback (see
+ * pbuf_alloced_custom), e.g. to pass received frames up without copying.
+ */
+#ifndef LWIP_SUPPORT_CUSTOM_PBUF
+#define LWIP_SUPPORT_CUSTOM_PBUF        0
+#endif
+
 /*
    ------------------------------------------------
    ---------- Network Interfaces options ----------
@@ -47,7 +47,15 @@ thread_wait(volatile uint32_t *addr, uint32_t val, uint32_t msec) {
 	if (cur_tc->tc_wakeup)
 	    break;
 
-	thread_yield();
+	if (thread_queue.tq_first) {
+	    thread_yield();
+	} else {
+	    /* No other thread can change *addr or wake us up, so sleep
+	     * in the kernel until another env does, or until msec. */
+	    static uint32_t never_woken;
+	    sys_futex_wait(addr ? addr : &never_woken, addr ? val : 0,
+			   msec == ~0U ? 0 : msec - p);
+	}
 	p = sys_time_msec();
     }
 
@@ -32,6 +32,7 @@
 
 #include <inc/lib.h>
 #include <inc/ns.h>
+#include <inc/e1000.h>
 
 #include <jif/jif.h>
 
@@ -41,97 +42,383 @@
 #include "lwip/pbuf.h"
 #include "lwip/sys.h"
 #include <lwip/stats.h>
+#include <lwip/ip.h>
+#include <lwip/tcp.h>
 
 #include <netif/etharp.h>
 
-#define PKTMAP		0x10000000
+/* Received packet pages are moved here, where they stay until lwIP
+   frees the pbuf wrapping them */
+#define RXMAP		TXSLOT_NIC_BASE(NS_NIC_MAX)
+#define RXBUF_COUNT	128
+
+/* Packets handed to the NIC in place, at least as many as the e1000
+   transmit ring holds */
+#define TX_INFLIGHT	32
+
+/* One of the NICs bonded into the interface */
+struct jif_port {
+    int nic;		/* device index given to the net syscalls */
+    envid_t envid;	/* output environment of the NIC */
+    int txslot;		/* next transmit slot to fill */
+    int sg;		/* whether the NIC gathers and splits packets */
+    /* pbufs the NIC may still be reading, oldest first */
+    struct pbuf *tx_inflight[TX_INFLIGHT];
+    int tx_head;
+    int tx_count;
+};
 
 struct jif {
     struct eth_addr *ethaddr;
-    envid_t envid;
+    int nports;
+    struct jif_port port[NS_NIC_MAX];
+};
+
+struct jif_rxbuf {
+    struct pbuf_custom pc;	/* must come first, see rxbuf_free */
+    int used;
 };
 
+static struct jif_rxbuf rxbufs[RXBUF_COUNT];
+
+/* The e1000 as mapped by jif_bypass, see inc/e1000.h.
+   nic_regs is NULL unless the network server drives the card itself */
+#define NICMAP		0x11000000
+
+static volatile uint32_t *nic_regs;
+static struct tx_desc *nic_tx;
+static struct rx_desc *nic_rx;
+
+static void *
+rxbuf_va(struct jif_rxbuf *rb)
+{
+    return (void *)(RXMAP + (rb - rxbufs) * PGSIZE);
+}
+
+/* custom_free_function of received pbufs: releases the packet page */
+static void
+rxbuf_free(struct pbuf *p)
+{
+    struct jif_rxbuf *rb = (struct jif_rxbuf *)p;
+
+    sys_page_unmap(0, rxbuf_va(rb));
+    rb->used = 0;
+}
+
+/* Whether the received frame can be passed up the stack in place.
+   A pbuf wrapping the packet page (PBUF_REF) can hide headers, but not
+   grow them back, which UDP and ICMP do to answer a packet with itself
+   (port unreachable, echo reply), and IP to reassemble fragments.
+   Whole TCP segments, which carry the bulk of the data, never need it,
+   and every other frame is copied. */
+static int
+rxbuf_wrappable(struct jif_pkt *pkt)
+{
+    struct eth_hdr *ethhdr = (struct eth_hdr *)pkt->jp_data;
+    struct ip_hdr *iphdr = (struct ip_hdr *)(ethhdr + 1);
+
+    if (pkt->jp_len < sizeof(struct eth_hdr) + IP_HLEN ||
+	htons(ethhdr->type) != ETHTYPE_IP)
+	return 0;
+    return IPH_PROTO(iphdr) == IP_PROTO_TCP &&
+	!(IPH_OFFSET(iphdr) & htons(IP_MF | IP_OFFMASK));
+}
+
+/* Takes over the packet page at va, and wraps it in a pbuf without
+   copying it. Returns NULL if no receive buffer is free. */
+static struct pbuf *
+rxbuf_wrap(void *va)
+{
+    struct jif_pkt *pkt;
+    struct jif_rxbuf *rb;
+    struct pbuf *p;
+    int i;
+
+    for (i = 0; i < RXBUF_COUNT; i++)
+	if (!rxbufs[i].used)
+	    break;
+    if (i == RXBUF_COUNT)
+	return NULL;
+
+    rb = &rxbufs[i];
+    pkt = (struct jif_pkt *)rxbuf_va(rb);
+    if (sys_page_map(0, va, 0, pkt, PTE_P | PTE_U | PTE_W) < 0)
+	return NULL;
+
+    rb->used = 1;
+    rb->pc.custom_free_function = rxbuf_free;
+    p = pbuf_alloced_custom(PBUF_RAW, pkt->jp_len, PBUF_REF, &rb->pc,
+			    pkt->jp_data, PGSIZE - sizeof(struct jif_pkt));
+    if (p == NULL)
+	rxbuf_free(&rb->pc.pbuf);
+    return p;
+}
+
 static void
 low_level_init(struct netif *netif)
 {
-    int r;
+    struct jif *jif = netif->state;
+    int tso = 1;
+    int i;
 
     netif->hwaddr_len = 6;
     netif->mtu = 1500;
     netif->flags = NETIF_FLAG_BROADCAST;
+    /* segmentation is only set up by the kernel driver, and only
+       NICs that can gather packets can split them. lwIP doesn't know
+       which port a segment leaves through, so every port must */
+    for (i = 0; i < jif->nports; i++) {
+	struct jif_port *port = &jif->port[i];
+	if (nic_regs == NULL && sys_net_try_send_sg(port->nic, NULL, 0, 0) >= 0)
+	    port->sg = 1;
+	else
+	    tso = 0;
+    }
+    if (tso)
+	netif->flags |= NETIF_FLAG_TSO;
 
-    sys_get_mac_addr(netif->hwaddr);
+    /* the bond goes by the address of its first port */
+    sys_get_mac_addr(jif->port[0].nic, netif->hwaddr);
 }
 
 /*
- * low_level_output():
+ * select_port():
  *
- * Should do the actual transmission of the packet. The packet is
- * contained in the pbuf that is passed to the function. This pbuf
- * might be chained.
+ * Picks the port the frame leaves through, spreading flows over the
+ * bonded NICs. All frames of a TCP or UDP flow take the same port, so
+ * they are not reordered, and other IP traffic is spread by address.
+ *
+ */
+static struct jif_port *
+select_port(struct jif *jif, struct pbuf *p)
+{
+    struct eth_hdr *ethhdr = p->payload;
+    struct ip_hdr *iphdr;
+    u16_t *tports;
+    u32_t hash;
+
+    if (jif->nports == 1)
+	return &jif->port[0];
+    if (p->len < sizeof(struct eth_hdr) + IP_HLEN ||
+	htons(ethhdr->type) != ETHTYPE_IP)
+	return &jif->port[0];
+
+    iphdr = (struct ip_hdr *)(ethhdr + 1);
+    hash = iphdr->src.addr ^ iphdr->dest.addr;
+    /* fragments carry no ports after the first one */
+    if ((IPH_PROTO(iphdr) == IP_PROTO_TCP || IPH_PROTO(iphdr) == IP_PROTO_UDP) &&
+	!(IPH_OFFSET(iphdr) & htons(IP_MF | IP_OFFMASK)) &&
+	p->len >= sizeof(struct eth_hdr) + IPH_HL(iphdr) * 4 + 4) {
+	tports = (u16_t *)((u8_t *)iphdr + IPH_HL(iphdr) * 4);
+	hash ^= tports[0] ^ ((u32_t)tports[1] << 16);
+    }
+    hash ^= hash >> 16;
+    hash ^= hash >> 8;
+    return &jif->port[hash % jif->nports];
+}
+
+/*
+ * prepare_tso():
+ *
+ * The e1000 fills in the IP and TCP checksums of every frame it cuts a
+ * TSO segment into; it expects a zero IP checksum, and the TCP checksum
+ * seeded with the pseudo header sum excluding the length.
+ *
+ */
+static void
+prepare_tso(char *frame)
+{
+    struct ip_hdr *iphdr = (struct ip_hdr *)(frame + sizeof(struct eth_hdr));
+    struct tcp_hdr *tcphdr = (struct tcp_hdr *)((u8_t *)iphdr + IPH_HL(iphdr) * 4);
+    u32_t acc;
+
+    IPH_CHKSUM_SET(iphdr, 0);
+
+    acc = (iphdr->src.addr & 0xffffUL) + (iphdr->src.addr >> 16);
+    acc += (iphdr->dest.addr & 0xffffUL) + (iphdr->dest.addr >> 16);
+    acc += htons(IP_PROTO_TCP);
+    acc = (acc & 0xffffUL) + (acc >> 16);
+    acc = (acc & 0xffffUL) + (acc >> 16);
+    tcphdr->chksum = (u16_t)acc;
+}
+
+/* Releases the n oldest pbufs the NIC of the port was reading */
+static void
+tx_release(struct jif_port *port, int n)
+{
+    for (; n > 0 && port->tx_count > 0; n--) {
+	pbuf_free(port->tx_inflight[port->tx_head]);
+	port->tx_head = (port->tx_head + 1) % TX_INFLIGHT;
+	port->tx_count--;
+    }
+}
+
+/* Whether frames copied into transmit slots of the port may still wait
+   for the output environment, which sends the slots in order and zeroes
+   ts_len of each one it has handed to the NIC */
+static int
+txslot_pending(struct jif_port *port)
+{
+    int last = (port->txslot + TXSLOT_COUNT - 1) % TXSLOT_COUNT;
+    volatile struct jif_txslot *slot =
+	(struct jif_txslot *)(TXSLOT_NIC_BASE(port->nic) + last * TXSLOT_SIZE);
+
+    return slot->ts_len != 0;
+}
+
+/*
+ * sg_output():
+ *
+ * Hands the pbuf chain to the NIC in place, with one descriptor list for
+ * the whole chain. The chain is held until the NIC reports it is done
+ * reading it; TCP copies a segment it wants to change before then (see
+ * tcp_seg_unshare). Returns ERR_BUF if the chain can't be sent this way.
  *
  */
 static err_t
-low_level_output(struct netif *netif, struct pbuf *p)
+sg_output(struct jif_port *port, struct pbuf *p, u16_t mss)
 {
-    /* 
-    int r = sys_page_alloc(0, (void *)PKTMAP, PTE_U|PTE_W|PTE_P);
+    struct jif_sg sg[JIF_SG_MAX];
+    struct pbuf *q;
+    int nsg = 0;
+    int r;
+
+    if (port->tx_count == TX_INFLIGHT) {
+	/* make room with the packets the NIC finished meanwhile */
+	if ((r = sys_net_try_send_sg(port->nic, NULL, 0, 0)) > 0)
+	    tx_release(port, r);
+	if (port->tx_count == TX_INFLIGHT)
+	    return ERR_BUF;
+    }
+
+    for (q = p; q != NULL; q = q->next) {
+	if (q->len == 0)
+	    continue;
+	if (nsg == JIF_SG_MAX)
+	    return ERR_BUF;
+	sg[nsg].sg_addr = q->payload;
+	sg[nsg].sg_len = q->len;
+	nsg++;
+    }
+
+    while ((r = sys_net_try_send_sg(port->nic, sg, nsg, mss)) == -E_RX_FULL)
+	sys_yield();
     if (r < 0)
-	panic("jif: could not allocate page of memory");
-    struct jif_pkt *pkt = (struct jif_pkt *)PKTMAP;
+	return ERR_BUF;
 
-    
+    /* release the packets the NIC is done with */
+    tx_release(port, r);
 
-    char *txbuf = pkt->jp_data;
-    int txsize = 0;
-    */
-    struct jif *jif;
-    jif = netif->state;
-    struct pbuf *q = p;
-    while(q != NULL){
-	/* Send the data from the pbuf to the interface, one pbuf at a
-	   time. The size of the data in each pbuf is kept in the ->len
-	   variable. */
-
-        if (q->len > 2000){
-            panic("oversized packet, txsize %d\n", q->len);
-        }
-        // if this is the last buffer in a packet or a single buffer packet
-        if (q->next == NULL){
-            ipc_send(jif->envid, NSREQ_OUTPUT, q->payload, PTE_P|PTE_W|PTE_U);
-        }
-        // if the current packet consists of additional buffers, mark this
-        // by the NSREQ_OUTPUT_MULTI message
-        else{
-            ipc_send(jif->envid, NSREQ_OUTPUT_MULTI, q->payload, PTE_P|PTE_W|PTE_U);
-        }
-        q = q->next;
+    pbuf_ref(p);
+    port->tx_inflight[(port->tx_head + port->tx_count) % TX_INFLIGHT] = p;
+    port->tx_count++;
+    return ERR_OK;
+}
+
+/*
+ * bypass_output():
+ *
+ * Copies the chain into the buffer of the next free descriptor of the
+ * e1000 transmit ring, and hands it to the card, without entering the
+ * kernel. Returns ERR_BUF if the ring is full; waiting for the card
+ * here would spin the network server, and TCP sends the frame again.
+ *
+ */
+static err_t
+bypass_output(struct pbuf *p)
+{
+    int i = nic_regs[E1000_TDT / 4];
+
+    if (p->tot_len > PGSIZE) {
+	LWIP_DEBUGF(NETIF_DEBUG, ("jif: oversized packet, txsize %d\n", p->tot_len));
+	return ERR_BUF;
     }
 
+    if (!(nic_tx[i].status & TX_STATUS_DD))
+	return ERR_BUF;
 
+    nic_tx[i].length = pbuf_copy_partial(p, (void *)(NICMAP + E1000_MAP_TX_BUF(i)),
+					 p->tot_len, 0);
+    nic_tx[i].cmd = TX_CMD_RS | TX_CMD_EOP;
+    nic_tx[i].status = 0;
+    nic_regs[E1000_TDT / 4] = (i + 1) % TX_DESC_COUNT;
     return ERR_OK;
 }
 
 /*
- * low_level_input():
+ * low_level_output():
  *
- * Should allocate a pbuf and transfer the bytes of the incoming
- * packet from the interface into the pbuf.
+ * Should do the actual transmission of the packet. The packet is
+ * contained in the pbuf that is passed to the function. This pbuf
+ * might be chained.
+ *
+ * The chain is handed to the NIC in place when possible, and otherwise
+ * copied into a transmit slot for the output environment to send. Once
+ * a frame of a port went through the slots, the following ones do too
+ * until the output environment caught up, so they leave in order.
+ * Which of the bonded NICs sends it is picked by select_port.
  *
  */
-static struct pbuf *
-low_level_input(void *va)
+static err_t
+low_level_output(struct netif *netif, struct pbuf *p)
 {
-    struct jif_pkt *pkt = (struct jif_pkt *)va;
-    s16_t len = pkt->jp_len;
+    struct jif *jif;
+    struct jif_port *port;
+    u16_t mss = 0;
+    jif = netif->state;
+
+    if (nic_regs != NULL)
+	return bypass_output(p);
+
+    port = select_port(jif, p);
+#if LWIP_TSO
+    if (p->flags & PBUF_FLAG_TSO) {
+	/* the NIC wants all the headers in the first buffer */
+	if (p->len < sizeof(struct eth_hdr) + IP_HLEN + TCP_HLEN)
+	    goto copy;
+	mss = p->tso_mss;
+	prepare_tso(p->payload);
+    }
+#endif
+    /* frames still waiting in the slots would be overtaken */
+    if (port->sg && !txslot_pending(port) && sg_output(port, p, mss) == ERR_OK)
+	return ERR_OK;
+
+copy:
+    if (p->tot_len > TXSLOT_SIZE - sizeof(struct jif_txslot)) {
+	LWIP_DEBUGF(NETIF_DEBUG, ("jif: oversized packet, txsize %d\n", p->tot_len));
+	return ERR_BUF;
+    }
+
+    /* Copy the whole chain into the next transmit slot, and tell the
+       output environment to send it. */
+    struct jif_txslot *slot =
+	(struct jif_txslot *)(TXSLOT_NIC_BASE(port->nic) + port->txslot * TXSLOT_SIZE);
+    port->txslot = (port->txslot + 1) % TXSLOT_COUNT;
+
+    slot->ts_len = pbuf_copy_partial(p, slot->ts_data, p->tot_len, 0);
+    slot->ts_mss = 0;
+#if LWIP_TSO
+    if (p->flags & PBUF_FLAG_TSO) {
+	slot->ts_mss = p->tso_mss;
+	prepare_tso(slot->ts_data);
+    }
+#endif
 
+    ipc_send(port->envid, NSREQ_OUTPUT_TXSLOT, 0, 0);
+
+    return ERR_OK;
+}
+
+static struct pbuf *
+copy_input(void *rxbuf, s16_t len)
+{
     struct pbuf *p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
     if (p == 0)
 	return 0;
 
     /* We iterate over the pbuf chain until we have read the entire
      * packet into the pbuf. */
-    void *rxbuf = (void *) pkt->jp_data;
     int copied = 0;
     struct pbuf *q;
     for (q = p; q != NULL; q = q->next) {
@@ -147,6 +434,29 @@ low_level_input(void *va)
 
     return p;
 }
+
+/*
+ * low_level_input():
+ *
+ * Should allocate a pbuf and transfer the bytes of the incoming
+ * packet from the interface into the pbuf.
+ *
+ * The packet page of a TCP segment is passed up as is when possible,
+ * see rxbuf_wrappable. Other packets are copied, as are segments when
+ * all receive buffers are held by lwIP.
+ *
+ */
+static struct pbuf *
+low_level_input(void *va)
+{
+    struct jif_pkt *pkt = (struct jif_pkt *)va;
+    struct pbuf *p;
+
+    if (rxbuf_wrappable(pkt) && (p = rxbuf_wrap(va)) != NULL)
+	return p;
+
+    return copy_input(pkt->jp_data, pkt->jp_len);
+}
 /*
  * jif_output():
  *
@@ -174,20 +484,14 @@ jif_output(struct netif *netif, struct pbuf *p,
  *
  */
 
-void
-jif_input(struct netif *netif, void *va)
+static void
+packet_input(struct netif *netif, struct pbuf *p)
 {
     struct jif *jif;
     struct eth_hdr *ethhdr;
-    struct pbuf *p;
 
     jif = netif->state;
-  
-    /* move received packet into a new pbuf */
-    p = low_level_input(va);
 
-    /* no packet could be read, silently ignore this */
-    if (p == NULL) return;
     /* points to packet payload, which starts with an Ethernet header */
     ethhdr = p->payload;
 
@@ -211,6 +515,88 @@ jif_input(struct netif *netif, void *va)
     }
 }
 
+void
+jif_input(struct netif *netif, void *va)
+{
+    struct pbuf *p;
+  
+    /* move received packet into a new pbuf */
+    p = low_level_input(va);
+
+    /* no packet could be read, silently ignore this */
+    if (p == NULL) return;
+
+    packet_input(netif, p);
+}
+
+/*
+ * jif_bypass():
+ *
+ * Takes over the first e1000 from the kernel, mapping it at NICMAP. From
+ * then on packets are sent and received through the mapped rings, without
+ * the input and output environments. Must be called before jif_init,
+ * and the interface then has that NIC as its only port.
+ *
+ */
+
+int
+jif_bypass(void)
+{
+    int r;
+
+    if ((r = sys_net_bypass(0, (void *)NICMAP)) < 0)
+	return r;
+
+    nic_regs = (volatile uint32_t *)(NICMAP + E1000_MAP_REGS);
+    nic_tx = (struct tx_desc *)(NICMAP + E1000_MAP_TX_RING);
+    nic_rx = (struct rx_desc *)(NICMAP + E1000_MAP_RX_RING);
+    return 0;
+}
+
+/*
+ * jif_poll():
+ *
+ * Releases the pbufs the NICs finished sending in place, and in bypass
+ * mode passes the packets the e1000 received up the stack. Called when
+ * the kernel notifies the network server of an interrupt in bypass
+ * mode, and on every timer tick, so that sent pbufs don't wait for the
+ * next send to be freed.
+ *
+ */
+
+void
+jif_poll(struct netif *netif)
+{
+    struct jif *jif = netif->state;
+    struct pbuf *p;
+    int i, r;
+
+    for (i = 0; i < jif->nports; i++) {
+	struct jif_port *port = &jif->port[i];
+	if (port->tx_count > 0 &&
+	    (r = sys_net_try_send_sg(port->nic, NULL, 0, 0)) > 0)
+	    tx_release(port, r);
+    }
+
+    if (nic_regs == NULL)
+	return;
+
+    for (;;) {
+	i = (nic_regs[E1000_RDT / 4] + 1) % RX_DESC_COUNT;
+	if (!(nic_rx[i].status & RX_STATUS_DD))
+	    break;
+
+	p = copy_input((void *)(NICMAP + E1000_MAP_RX_BUF(i)), nic_rx[i].length);
+
+	/* give the buffer back to the card */
+	nic_rx[i].status = 0;
+	nic_regs[E1000_RDT / 4] = i;
+
+	if (p != NULL)
+	    packet_input(netif, p);
+    }
+}
+
 /*
  * jif_init():
  *
@@ -224,7 +610,8 @@ err_t
 jif_init(struct netif *netif)
 {
     struct jif *jif;
-    envid_t *output_envid; 
+    struct jif_ports *ports;
+    int i;
 
     jif = mem_malloc(sizeof(struct jif));
 
@@ -233,7 +620,7 @@ jif_init(struct netif *netif)
 	return ERR_MEM;
     }
 
-    output_envid = (envid_t *)netif->state;
+    ports = (struct jif_ports *)netif->state;
 
     netif->state = jif;
     netif->output = jif_output;
@@ -241,7 +628,15 @@ jif_init(struct netif *netif)
     memcpy(&netif->name[0], "en", 2);
 
     jif->ethaddr = (struct eth_addr *)&(netif->hwaddr[0]);
-    jif->envid = *output_envid; 
+    jif->nports = ports->count;
+    for (i = 0; i < ports->count; i++) {
+	jif->port[i].nic = i;
+	jif->port[i].envid = ports->output_envid[i];
+	jif->port[i].txslot = 0;
+	jif->port[i].sg = 0;
+	jif->port[i].tx_head = 0;
+	jif->port[i].tx_count = 0;
+    }
 
     low_level_init(netif);
 
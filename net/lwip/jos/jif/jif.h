@@ -1,4 +1,14 @@
 #include <lwip/netif.h>
+#include <inc/ns.h>
+
+/* Passed as the state of the netif to jif_init: the number of NICs bonded
+   into the interface, and the output environment of each */
+struct jif_ports {
+    int count;
+    envid_t output_envid[NS_NIC_MAX];
+};
 
 void	jif_input(struct netif *netif, void *va);
 err_t	jif_init(struct netif *netif);
+int	jif_bypass(void);
+void	jif_poll(struct netif *netif);
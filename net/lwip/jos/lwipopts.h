@@ -40,6 +40,11 @@ void *memcpy(void *dst, const void *src, size_t n);
 #define TCP_MSS			1460
 #define TCP_WND			24000
 #define TCP_SND_BUF		(16 * TCP_MSS)
+// let the e1000 cut large TCP segments into MSS sized frames
+#define LWIP_TSO		1
+#define TCP_TSO_MAXSEG		(8 * TCP_MSS)
+// let jif pass received pages up the stack without copying them
+#define LWIP_SUPPORT_CUSTOM_PBUF	1
 // lwip prints a warning if TCP_SND_QUEUELEN < (2 * TCP_SND_BUF/TCP_MSS), 
 // but 16 is faster.. 
 #define TCP_SND_QUEUELEN	(2 * TCP_SND_BUF/TCP_MSS)
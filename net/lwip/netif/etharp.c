@@ -957,6 +957,12 @@ etharp_query(struct netif *netif, struct ip_addr *ipaddr, struct pbuf *q)
             pbuf_free(p);
             p = NULL;
           }
+#if LWIP_TSO
+          else {
+            p->flags |= q->flags & PBUF_FLAG_TSO;
+            p->tso_mss = q->tso_mss;
+          }
+#endif /* LWIP_TSO */
         }
       } else {
         /* referencing the old pbuf is enough */
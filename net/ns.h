@@ -7,6 +7,13 @@
 
 #define TIMER_INTERVAL 250
 
+// Set to drive the e1000 directly from the network server (see jif_bypass),
+// instead of through the kernel driver and the input/output environments.
+// Given by make NS_BYPASS=1.
+#ifndef NS_BYPASS
+#define NS_BYPASS 0
+#endif
+
 // Virtual address at which to receive page mappings containing client requests.
 #define QUEUE_SIZE	20
 #define REQVA		(0x0ffff000 - QUEUE_SIZE * PGSIZE)
@@ -15,8 +22,8 @@
 void timer(envid_t ns_envid, uint32_t initial_to);
 
 /* input.c */
-void input(envid_t ns_envid);
+void input(envid_t ns_envid, int nic);
 
 /* output.c */
-void output(envid_t ns_envid);
+void output(envid_t ns_envid, int nic);
 
@@ -3,11 +3,17 @@
 
 extern union Nsipc nsipcbuf;
 
-// block the thread untill the packet has been sent to the driver
-static int send_packet(void *buffer, size_t length) {
+// block the thread untill the packet has been sent to the driver.
+// if mss is non zero, the NIC splits the packet into segments of mss bytes.
+// flags are passed on to sys_net_try_send.
+static int send_packet(int nic, void *buffer, size_t length, int mss, int flags) {
     int r = -E_RX_FULL;
     while (r == -E_RX_FULL) {
-        r = sys_net_try_send(buffer, length);
+        if (mss) {
+            r = sys_net_try_send_tso(nic, buffer, length, mss);
+        } else {
+            r = sys_net_try_send(nic, buffer, length, flags);
+        }
         if (r == -E_RX_FULL){
             sys_yield();
         }
@@ -15,14 +21,18 @@ static int send_packet(void *buffer, size_t length) {
     return r;
 }
 
+// sends packets through the given NIC
 void
-output(envid_t ns_envid)
+output(envid_t ns_envid, int nic)
 {
 	binaryname = "ns_output";
 
 	// LAB 6: Your code here:
 	// 	- read a packet from the network server
 	//	- send the packet to the device driver
+    // transmit slots of the NIC are consumed in the order the network
+    // server fills them
+    int txslot = 0;
     while (true) {
         int perm = 0;
         void *va = &nsipcbuf.pkt.jp_len;
@@ -33,6 +43,19 @@ output(envid_t ns_envid)
             panic("receiving IPC on output env failed: %e\n", req_type);
         }
 
+        if (req_type == NSREQ_OUTPUT_TXSLOT) {
+            struct jif_txslot *slot =
+                (struct jif_txslot *)(TXSLOT_NIC_BASE(nic) + txslot * TXSLOT_SIZE);
+            txslot = (txslot + 1) % TXSLOT_COUNT;
+            // the NIC is told of a burst once its last packet is queued
+            volatile struct jif_txslot *next =
+                (struct jif_txslot *)(TXSLOT_NIC_BASE(nic) + txslot * TXSLOT_SIZE);
+            int flags = next->ts_len != 0 ? NET_SEND_MORE : 0;
+            send_packet(nic, slot->ts_data, slot->ts_len, slot->ts_mss, flags);
+            slot->ts_len = 0;
+            continue;
+        }
+
         if (req_type != NSREQ_OUTPUT) {
             panic("unexpected message type for output env\n");
         }
@@ -42,7 +65,7 @@ output(envid_t ns_envid)
 			panic("buffer missing from message to output env\n");
 		}
 
-        send_packet(nsipcbuf.pkt.jp_data, nsipcbuf.pkt.jp_len);
+        send_packet(nic, nsipcbuf.pkt.jp_data, nsipcbuf.pkt.jp_len, 0, 0);
         sys_page_unmap(curenv->env_id, &nsipcbuf.pkt);
     }
 }
@@ -44,8 +44,9 @@ static struct timer_thread t_tcpf;
 static struct timer_thread t_tcps;
 
 static envid_t timer_envid;
-static envid_t input_envid;
-static envid_t output_envid;
+static envid_t input_envids[NS_NIC_MAX];
+// the NICs bonded into the interface, and their output environments
+static struct jif_ports ports;
 
 static bool buse[QUEUE_SIZE];
 static int next_i(int i) { return (i+1) % QUEUE_SIZE; }
@@ -142,7 +143,7 @@ serve_init(uint32_t ipaddr, uint32_t netmask, uint32_t gw)
 	thread_wait(&done, 0, (uint32_t)~0);
 	lwip_core_lock();
 
-	lwip_init(&nif, &output_envid, ipaddr, netmask, gw);
+	lwip_init(&nif, &ports, ipaddr, netmask, gw);
 
 	start_timer(&t_arp, &etharp_tmr, "arp timer", ARP_TMR_INTERVAL);
 	start_timer(&t_tcpf, &tcp_fasttmr, "tcp f timer", TCP_FAST_INTERVAL);
@@ -154,6 +155,8 @@ serve_init(uint32_t ipaddr, uint32_t netmask, uint32_t gw)
 		nif.hwaddr[0], nif.hwaddr[1], nif.hwaddr[2],
 		nif.hwaddr[3], nif.hwaddr[4], nif.hwaddr[5],
 		inet_ntoa(ia));
+	if (ports.count > 1)
+		cprintf("ns: bonding %d NICs\n", ports.count);
 
 	lwip_core_unlock();
 
@@ -277,10 +280,16 @@ serve(void) {
 
 		// first take care of requests that do not contain an argument page
 		if (reqno == NSREQ_TIMER) {
+			jif_poll(&nif);
 			process_timer(whom);
 			put_buffer(va);
 			continue;
 		}
+		if (reqno == NSREQ_INTERRUPT && whom == 0) {
+			jif_poll(&nif);
+			put_buffer(va);
+			continue;
+		}
 
 		// All remaining requests must contain an argument page
 		if (!(perm & PTE_P)) {
@@ -315,6 +324,8 @@ void
 umain(int argc, char **argv)
 {
 	envid_t ns_envid = sys_getenvid();
+	uint8_t mac[6];
+	int i, nic, r;
 
 	binaryname = "ns";
 
@@ -327,25 +338,46 @@ umain(int argc, char **argv)
 		return;
 	}
 
-	// fork off the input thread which will poll the NIC driver for input
-	// packets
-	input_envid = fork();
-	if (input_envid < 0)
-		panic("error forking");
-	else if (input_envid == 0) {
-		input(ns_envid);
-		return;
-	}
+	// the NICs are numbered from 0, up to the first missing one
+	while (ports.count < NS_NIC_MAX && sys_get_mac_addr(ports.count, mac) == 0)
+		ports.count++;
+	if (ports.count == 0)
+		panic("no network card found");
+
+#if NS_BYPASS
+	// drive the NIC from here, no input and output environments needed
+	if ((r = jif_bypass()) < 0)
+		panic("taking over the NIC: %e", r);
+	ports.count = 1;
+#else
+	for (nic = 0; nic < ports.count; nic++) {
+		// fork off the input thread which will poll the NIC driver
+		// for input packets
+		input_envids[nic] = fork();
+		if (input_envids[nic] < 0)
+			panic("error forking");
+		else if (input_envids[nic] == 0) {
+			input(ns_envid, nic);
+			return;
+		}
 
-	// fork off the output thread that will send the packets to the NIC
-	// driver
-	output_envid = fork();
-	if (output_envid < 0)
-		panic("error forking");
-	else if (output_envid == 0) {
-		output(ns_envid);
-		return;
+		// map the transmit slots shared with the output environment
+		for (i = 0; i < TXSLOT_COUNT * TXSLOT_SIZE; i += PGSIZE)
+			if ((r = sys_page_alloc(0, (void *)(TXSLOT_NIC_BASE(nic) + i),
+						PTE_P | PTE_U | PTE_W | PTE_SHARE)) < 0)
+				panic("allocating transmit slots: %e", r);
+
+		// fork off the output thread that will send the packets to
+		// the NIC driver
+		ports.output_envid[nic] = fork();
+		if (ports.output_envid[nic] < 0)
+			panic("error forking");
+		else if (ports.output_envid[nic] == 0) {
+			output(ns_envid, nic);
+			return;
+		}
 	}
+#endif
 
 	// lwIP requires a user threading library; start the library and jump
 	// into a thread to continue initialization.
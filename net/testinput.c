@@ -17,7 +17,7 @@ announce(void)
 	// for the gateway IP.
 
 	uint8_t mac[ETHARP_HWADDR_LEN] = {};
-	sys_get_mac_addr(mac);
+	sys_get_mac_addr(0, mac);
 	uint32_t myip = inet_addr(IP);
 	uint32_t gwip = inet_addr(DEFAULT);
 	int r;
@@ -77,7 +77,7 @@ umain(int argc, char **argv)
 	if (output_envid < 0)
 		panic("error forking");
 	else if (output_envid == 0) {
-		output(ns_envid);
+		output(ns_envid, 0);
 		return;
 	}
 
@@ -85,7 +85,7 @@ umain(int argc, char **argv)
 	if (input_envid < 0)
 		panic("error forking");
 	else if (input_envid == 0) {
-		input(ns_envid);
+		input(ns_envid, 0);
 		return;
 	}
 
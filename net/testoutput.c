@@ -21,7 +21,7 @@ umain(int argc, char **argv)
 	if (output_envid < 0)
 		panic("error forking");
 	else if (output_envid == 0) {
-		output(ns_envid);
+		output(ns_envid, 0);
 		return;
 	}
 
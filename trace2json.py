@@ -0,0 +1,144 @@
+#!/usr/bin/env python
+
+"""Convert a JOS kernel trace dump into Chrome trace JSON.
+
+Start tracing with 'trace start' (or 'trace run prog ...') in JOS, dump
+it with 'trace dump', then run
+
+    python trace2json.py jos.out > trace.json
+
+on the console log and load trace.json in chrome://tracing or
+ui.perfetto.dev.  Each CPU shows as a thread; traps and system calls
+are slices, and the other tracepoints are instant events.
+"""
+
+from __future__ import print_function
+
+import json, os, re, sys
+from optparse import OptionParser
+
+TRAP_NAMES = {0: "divide", 3: "breakpoint", 13: "gpflt", 14: "pgflt",
+              48: "syscall", 32: "timer", 33: "kbd", 36: "serial",
+              39: "spurious", 51: "error", 52: "ipi_wakeup",
+              53: "ipi_call"}
+IRQ_OFFSET = 32
+
+def syscall_names():
+    """Read the system call numbers from inc/syscall.h next to this
+    script, if it is there."""
+    names = []
+    path = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                        "inc", "syscall.h")
+    try:
+        text = open(path).read()
+    except IOError:
+        return names
+    body = re.search(r"enum\s*{(.*?)NSYSCALLS", text, re.S)
+    if body:
+        names = re.findall(r"SYS_(\w+)", body.group(1))
+    return names
+
+def last_dump(lines):
+    """Return (ncpu, khz, records) for the last complete dump."""
+    dump = cur = None
+    for line in lines:
+        m = re.match(r"TRACE BEGIN (\d+) (\d+)", line)
+        if m:
+            cur = (int(m.group(1)), int(m.group(2)), [])
+        elif line.startswith("TRACE END") and cur:
+            dump, cur = cur, None
+            lost = int(line.split()[2])
+            if lost:
+                print("trace2json: %d events lost to ring overflow" % lost,
+                      file=sys.stderr)
+        elif cur:
+            f = line.split()
+            try:
+                cur[2].append((int(f[0]), int(f[1], 16), f[2],
+                               int(f[3], 16), int(f[4], 16), int(f[5], 16)))
+            except (ValueError, IndexError):
+                pass    # other console output mixed in
+    return dump
+
+def convert(dump, khz):
+    ncpu, dump_khz, records = dump
+    khz = khz or dump_khz
+    if not khz:
+        print("trace2json: TSC rate unknown, assuming 1 GHz; use --khz",
+              file=sys.stderr)
+        khz = 1000000
+    sysnames = syscall_names()
+    t0 = min(r[1] for r in records) if records else 0
+    events = []
+    for cpu in range(ncpu):
+        events.append({"ph": "M", "name": "thread_name", "pid": 0,
+                       "tid": cpu, "args": {"name": "CPU %d" % cpu}})
+
+    open_slices = dict((cpu, []) for cpu in range(ncpu))
+
+    def close(cpu, ts, keep=0):
+        while len(open_slices[cpu]) > keep:
+            name = open_slices[cpu].pop()
+            events.append({"ph": "E", "name": name, "pid": 0, "tid": cpu,
+                           "ts": ts})
+
+    for cpu, tsc, ev, env, a0, a1 in records:
+        ts = (tsc - t0) * 1000.0 / khz
+        base = {"pid": 0, "tid": cpu, "ts": ts,
+                "args": {"env": "%08x" % env}}
+        if ev == "trap":
+            name = TRAP_NAMES.get(a0, "trap %d" % a0)
+            if a0 >= IRQ_OFFSET and a0 not in TRAP_NAMES:
+                name = "irq %d" % (a0 - IRQ_OFFSET)
+            base.update(ph="B", name=name)
+            base["args"]["eip"] = "%08x" % a1
+            open_slices[cpu].append(name)
+        elif ev == "syscall":
+            name = ("sys_" + sysnames[a0]) if a0 < len(sysnames) \
+                else "syscall %d" % a0
+            base.update(ph="B", name=name)
+            base["args"]["arg1"] = "%08x" % a1
+            open_slices[cpu].append(name)
+        elif ev == "syscall_ret":
+            if open_slices[cpu] and open_slices[cpu][-1].startswith("sys"):
+                close(cpu, ts, len(open_slices[cpu]) - 1)
+            continue
+        elif ev in ("trap_ret", "sched_halt"):
+            # whatever the CPU was doing in the kernel is over
+            close(cpu, ts)
+            if ev == "trap_ret":
+                continue
+            base.update(ph="i", s="t", name=ev)
+        else:
+            base.update(ph="i", s="t", name=ev)
+            if ev == "env_run":
+                base["args"]["to"] = "%08x" % a0
+                base["args"]["runs"] = a1
+            elif ev == "ipc_send":
+                base["args"]["to"] = "%08x" % a0
+                base["args"]["value"] = a1
+            elif ev == "ipc_recv":
+                base["args"]["blocks"] = a0
+            elif ev == "irq":
+                base["name"] = "irq %d" % a0
+        events.append(base)
+    if records:
+        end = (max(r[1] for r in records) - t0) * 1000.0 / khz
+        for cpu in range(ncpu):
+            close(cpu, end)
+    return {"traceEvents": events, "displayTimeUnit": "ns"}
+
+def main():
+    parser = OptionParser(usage="usage: %prog [--khz N] [console-log]")
+    parser.add_option("--khz", type="int", default=0,
+                      help="TSC rate in kHz, if the dump's is wrong")
+    opts, args = parser.parse_args()
+    lines = open(args[0]) if args else sys.stdin
+    dump = last_dump(lines)
+    if dump is None:
+        parser.error("no complete TRACE BEGIN ... TRACE END dump found")
+    json.dump(convert(dump, opts.khz), sys.stdout)
+    print()
+
+if __name__ == "__main__":
+    main()
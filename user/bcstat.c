@@ -0,0 +1,48 @@
+// Show the file server's block cache statistics, optionally changing
+// how many blocks it may cache first.
+//
+//	bcstat [-l limit]
+
+#include <inc/lib.h>
+
+static void
+usage(void)
+{
+	printf("usage: bcstat [-l limit]\n");
+	exit();
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct Argstate args;
+	struct BcStat st;
+	uint32_t limit = 0, lookups;
+	char *val;
+	int i, r;
+
+	argstart(&argc, argv, &args);
+	while ((i = argnext(&args)) >= 0)
+		if (i == 'l' && (val = argvalue(&args)))
+			limit = strtol(val, 0, 0);
+		else
+			usage();
+	if (argc > 1)
+		usage();
+
+	if ((r = fscache(limit, &st)) < 0) {
+		printf("bcstat: %e\n", r);
+		exit();
+	}
+	lookups = st.bs_hits + st.bs_misses;
+	printf("cached     %6d of %d blocks, %d pinned, %d dirty\n",
+	       st.bs_cached, st.bs_limit, st.bs_pinned, st.bs_dirty);
+	printf("hits       %6d (%d%%)\n", st.bs_hits,
+	       lookups ? st.bs_hits * 100 / lookups : 0);
+	printf("misses     %6d\n", st.bs_misses);
+	printf("evictions  %6d\n", st.bs_evictions);
+	printf("writebacks %6d\n", st.bs_writebacks);
+	printf("readahead  %6d blocks\n", st.bs_readahead);
+	printf("disk reads %6d\n", st.bs_reads);
+	printf("disk writes %5d\n", st.bs_writes);
+}
@@ -2,14 +2,19 @@
 
 void umain(int argc, char **argv) {
     uint8_t mac[6] = {};
-    sys_get_mac_addr(mac);
-    printf("the mac address of this device is: ");
-    int i;
-    for (i=0; i<6; i++) {
-        printf("%02x", mac[i]);
-        if (i != 5) {
-            printf(":");
+    int dev, i;
+    // devices are numbered from 0, up to the first missing one
+    for (dev = 0; sys_get_mac_addr(dev, mac) == 0; dev++) {
+        printf("the mac address of device %d is: ", dev);
+        for (i=0; i<6; i++) {
+            printf("%02x", mac[i]);
+            if (i != 5) {
+                printf(":");
+            }
         }
+        printf("\n");
     }
-    printf("\n");
-}
\ No newline at end of file
+    if (dev == 0) {
+        printf("no network device found\n");
+    }
+}
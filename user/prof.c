@@ -0,0 +1,67 @@
+// Control the kernel's sampling profiler.  The reports are printed on
+// the console.
+//
+//	prof start|stop|reset
+//	prof flat|graph [n]
+//	prof run program [args...]
+//
+// 'run' profiles one program: it discards old samples, samples while
+// the program runs, and prints a flat profile and a call graph.
+
+#include <inc/lib.h>
+
+static void
+usage(void)
+{
+	printf("usage: prof start|stop|reset\n"
+	       "       prof flat|graph [n]\n"
+	       "       prof run program [args...]\n");
+	exit();
+}
+
+void
+umain(int argc, char **argv)
+{
+	static const char *ops[] = {
+		[PROF_START] = "start",
+		[PROF_STOP] = "stop",
+		[PROF_RESET] = "reset",
+		[PROF_FLAT] = "flat",
+		[PROF_GRAPH] = "graph",
+	};
+	int op, n = 0, r;
+	char *end;
+
+	if (argc < 2)
+		usage();
+
+	if (strcmp(argv[1], "run") == 0) {
+		if (argc < 3)
+			usage();
+		sys_prof_ctl(PROF_RESET, 0);
+		sys_prof_ctl(PROF_START, 0);
+		if ((r = spawn(argv[2], (const char **) argv + 2)) < 0) {
+			sys_prof_ctl(PROF_STOP, 0);
+			printf("prof: spawn %s: %e\n", argv[2], r);
+			exit();
+		}
+		wait(r);
+		sys_prof_ctl(PROF_STOP, 0);
+		sys_prof_ctl(PROF_FLAT, 0);
+		sys_prof_ctl(PROF_GRAPH, 0);
+		return;
+	}
+
+	for (op = 0; op < sizeof(ops) / sizeof(ops[0]); op++)
+		if (strcmp(argv[1], ops[op]) == 0)
+			break;
+	if (op == sizeof(ops) / sizeof(ops[0]) || argc > 3)
+		usage();
+	if (argc == 3) {
+		n = strtol(argv[2], &end, 0);
+		if (*end != '\0')
+			usage();
+	}
+	if ((r = sys_prof_ctl(op, n)) < 0)
+		printf("prof: %e\n", r);
+}
@@ -0,0 +1,58 @@
+// Several threads bump a shared counter under a mutex, then the program
+// exits while another thread still spins, which must end that one too.
+
+#include <inc/lib.h>
+
+#define NTHREADS 4
+#define NROUNDS 10000
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile int counter;
+
+static void *
+worker(void *arg) {
+    int i;
+    for (i = 0; i < NROUNDS; i++) {
+        pthread_mutex_lock(&lock);
+        counter++;
+        pthread_mutex_unlock(&lock);
+    }
+    return arg;
+}
+
+static void *
+spinner(void *arg) {
+    for (;;) {
+        sys_yield();
+    }
+    return arg;
+}
+
+void
+umain(int argc, char **argv) {
+    pthread_t threads[NTHREADS];
+    void *ret;
+    int i, r;
+
+    for (i = 0; i < NTHREADS; i++) {
+        if ((r = pthread_create(&threads[i], worker, (void *)i)) < 0) {
+            panic("pthread_create: %e", r);
+        }
+    }
+    for (i = 0; i < NTHREADS; i++) {
+        pthread_join(threads[i], &ret);
+        if ((int)ret != i) {
+            panic("thread %d returned %d", i, (int)ret);
+        }
+    }
+
+    if (counter != NTHREADS * NROUNDS) {
+        panic("counter is %d, expected %d", counter, NTHREADS * NROUNDS);
+    }
+    cprintf("pthreads: %d threads counted to %d\n", NTHREADS, counter);
+
+    if ((r = pthread_create(&threads[0], spinner, NULL)) < 0) {
+        panic("pthread_create: %e", r);
+    }
+    cprintf("pthreads: exiting with a thread running\n");
+}
@@ -0,0 +1,161 @@
+// Show which environments are using the machine: every interval, list
+// the live environments by the CPU time they used in it, with the
+// system calls, page faults and IPC they made in it and the pages they
+// have mapped.
+//
+//	top [-d msec] [-n count]
+//
+// %CPU is relative to one CPU, so threads running on several CPUs at
+// once can use more than 100%.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+static struct EnvStat last[NENV];
+static envid_t last_id[NENV];
+
+static struct Row {
+	const volatile struct Env *e;
+	struct EnvStat now;		// Totals so far
+	struct EnvStat d;		// Used during the interval
+	uint32_t cpu;			// Tenths of a percent of one CPU
+} rows[NENV];
+
+static const char *
+type_name(enum EnvType type)
+{
+	switch (type) {
+	case ENV_TYPE_FS:
+		return "fs";
+	case ENV_TYPE_NS:
+		return "ns";
+	default:
+		return "user";
+	}
+}
+
+static char
+status_char(unsigned status)
+{
+	switch (status) {
+	case ENV_RUNNING:
+		return 'R';
+	case ENV_RUNNABLE:
+		return 'r';
+	case ENV_NOT_RUNNABLE:
+		return 'S';
+	case ENV_WAITING_FOR_IO:
+		return 'D';
+	default:
+		return 'Z';
+	}
+}
+
+// Take a snapshot of every live env into rows[], charging each with what
+// it used since the last snapshot.  dt is the interval in TSC cycles.
+static int
+snapshot(uint64_t dt)
+{
+	struct Row *row;
+	uint64_t used;
+	int i, n = 0;
+
+	for (i = 0; i < NENV; i++) {
+		if (envs[i].env_status == ENV_FREE)
+			continue;
+		row = &rows[n];
+		row->e = &envs[i];
+		if (sys_env_stat(envs[i].env_id, &row->now) < 0)
+			continue;
+		if (last_id[i] != envs[i].env_id) {
+			// a new env since the last snapshot
+			memset(&last[i], 0, sizeof(last[i]));
+			last_id[i] = envs[i].env_id;
+		}
+		row->d.es_utime = row->now.es_utime - last[i].es_utime;
+		row->d.es_stime = row->now.es_stime - last[i].es_stime;
+		row->d.es_syscalls = row->now.es_syscalls - last[i].es_syscalls;
+		row->d.es_pgfaults = row->now.es_pgfaults - last[i].es_pgfaults;
+		row->d.es_ipc_sends = row->now.es_ipc_sends - last[i].es_ipc_sends;
+		row->d.es_ipc_recvs = row->now.es_ipc_recvs - last[i].es_ipc_recvs;
+		last[i] = row->now;
+
+		// scale down so that 32-bit division will do
+		used = row->d.es_utime + row->d.es_stime;
+		row->cpu = (dt >> 16) ? (uint32_t) (used >> 16) * 1000
+			/ (uint32_t) (dt >> 16) : 0;
+		n++;
+	}
+	return n;
+}
+
+static void
+show(int n)
+{
+	struct Row tmp, *row;
+	uint64_t used;
+	int i, j;
+
+	// busiest first
+	for (i = 1; i < n; i++) {
+		tmp = rows[i];
+		for (j = i; j > 0 && rows[j - 1].cpu < tmp.cpu; j--)
+			rows[j] = rows[j - 1];
+		rows[j] = tmp;
+	}
+
+	printf("\n   ENVID   PARENT TYPE S  %%CPU %%SYS  SYSCALLS FAULTS  "
+	       "SENDS  RECVS  PAGES\n");
+	for (i = 0; i < n; i++) {
+		row = &rows[i];
+		used = row->d.es_utime + row->d.es_stime;
+		printf("%08x %08x %-4s %c %3d.%d %3d%% %9d %6d %6d %6d %6d\n",
+		       row->e->env_id, row->e->env_parent_id,
+		       type_name(row->e->env_type),
+		       status_char(row->e->env_status),
+		       row->cpu / 10, row->cpu % 10,
+		       (used >> 16) ? (uint32_t) (row->d.es_stime >> 16) * 100
+				/ (uint32_t) (used >> 16) : 0,
+		       row->d.es_syscalls, row->d.es_pgfaults,
+		       row->d.es_ipc_sends, row->d.es_ipc_recvs,
+		       row->now.es_pages);
+	}
+}
+
+static void
+usage(void)
+{
+	printf("usage: top [-d msec] [-n count]\n");
+	exit();
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct Argstate args;
+	uint32_t delay = 1000, sleep_word = 0;
+	int count = -1, i;
+	uint64_t then, now;
+	char *val;
+
+	argstart(&argc, argv, &args);
+	while ((i = argnext(&args)) >= 0)
+		if (i == 'd' && (val = argvalue(&args)))
+			delay = strtol(val, 0, 0);
+		else if (i == 'n' && (val = argvalue(&args)))
+			count = strtol(val, 0, 0);
+		else
+			usage();
+	if (argc > 1 || delay == 0)
+		usage();
+
+	then = read_tsc();
+	snapshot(0);
+	while (count < 0 || count-- > 0) {
+		// nobody wakes this word, so this sleeps for delay
+		sys_futex_wait(&sleep_word, 0, delay);
+		now = read_tsc();
+		show(snapshot(now - then));
+		then = now;
+	}
+}
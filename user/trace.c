@@ -0,0 +1,46 @@
+// Control kernel event tracing.  Dumps are printed on the console;
+// convert them with trace2json.py on the host.
+//
+//	trace start|stop|dump
+//	trace run program [args...]
+//
+// 'run' traces one program from start to exit and dumps the events.
+
+#include <inc/lib.h>
+
+static void
+usage(void)
+{
+	printf("usage: trace start|stop|dump\n"
+	       "       trace run program [args...]\n");
+	exit();
+}
+
+void
+umain(int argc, char **argv)
+{
+	int r = 0;
+
+	if (argc >= 3 && strcmp(argv[1], "run") == 0) {
+		if ((r = sys_trace_ctl(TRACE_CTL_START)) < 0) {
+			printf("trace: %e\n", r);
+			exit();
+		}
+		if ((r = spawn(argv[2], (const char **) argv + 2)) < 0) {
+			sys_trace_ctl(TRACE_CTL_STOP);
+			printf("trace: spawn %s: %e\n", argv[2], r);
+			exit();
+		}
+		wait(r);
+		r = sys_trace_ctl(TRACE_CTL_DUMP);
+	} else if (argc == 2 && strcmp(argv[1], "start") == 0)
+		r = sys_trace_ctl(TRACE_CTL_START);
+	else if (argc == 2 && strcmp(argv[1], "stop") == 0)
+		r = sys_trace_ctl(TRACE_CTL_STOP);
+	else if (argc == 2 && strcmp(argv[1], "dump") == 0)
+		r = sys_trace_ctl(TRACE_CTL_DUMP);
+	else
+		usage();
+	if (r < 0)
+		printf("trace: %e\n", r);
+}
@@ -0,0 +1,114 @@
+// Report what each CPU did during every interval: how long it was
+// idle, how often it halted and switched envs, and the traps it took,
+// from the kernel's counters at UCPUSTAT.
+//
+//	vmstat [-v] [-d msec] [-n count]
+//
+// -v also lists every vector that fired, not just the common ones.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NCOL	(sizeof(cols) / sizeof(cols[0]))
+// Entries in the page at UCPUSTAT; those of absent CPUs are all 0
+#define NCPU_MAX	(PGSIZE / sizeof(struct CpuStat))
+
+// The vectors with a column of their own
+static const struct {
+	const char *name;
+	int vec;
+} cols[] = {
+	{ "timer", IRQ_OFFSET + IRQ_TIMER },
+	{ "kbd", IRQ_OFFSET + IRQ_KBD },
+	{ "serial", IRQ_OFFSET + IRQ_SERIAL },
+	{ "ide", IRQ_OFFSET + IRQ_IDE },
+	{ "pgflt", T_PGFLT },
+	{ "syscall", T_SYSCALL },
+	{ "ipi", IRQ_OFFSET + IRQ_IPI_WAKEUP },
+	{ "ipicall", IRQ_OFFSET + IRQ_IPI_CALL },
+};
+
+static struct CpuStat last[NCPU_MAX];
+
+static void
+show(uint64_t dt, bool verbose)
+{
+	struct CpuStat now;
+	uint32_t idle, other;
+	int cpu, i, c;
+
+	printf("\ncpu idle%%  halts switch");
+	for (c = 0; c < NCOL; c++)
+		printf(" %7s", cols[c].name);
+	printf("   other\n");
+
+	for (cpu = 0; cpu < NCPU_MAX && cpustats[cpu].cs_online; cpu++) {
+		now = cpustats[cpu];
+		// scale down so that 32-bit division will do
+		idle = (dt >> 16) ? (uint32_t) ((now.cs_idle_tsc
+			- last[cpu].cs_idle_tsc) >> 16) * 100
+			/ (uint32_t) (dt >> 16) : 0;
+		printf("%3d %4d%% %6d %6d", cpu, MIN(idle, 100),
+		       now.cs_halts - last[cpu].cs_halts,
+		       now.cs_switches - last[cpu].cs_switches);
+
+		other = 0;
+		for (i = 0; i < CPUSTAT_NVEC; i++)
+			other += now.cs_traps[i] - last[cpu].cs_traps[i];
+		for (c = 0; c < NCOL; c++) {
+			i = cols[c].vec;
+			printf(" %7d", now.cs_traps[i] - last[cpu].cs_traps[i]);
+			other -= now.cs_traps[i] - last[cpu].cs_traps[i];
+		}
+		printf(" %7d\n", other);
+
+		if (verbose)
+			for (i = 0; i < CPUSTAT_NVEC; i++)
+				if (now.cs_traps[i] != last[cpu].cs_traps[i])
+					printf("      vector %2d: %d\n", i,
+					       now.cs_traps[i] - last[cpu].cs_traps[i]);
+		last[cpu] = now;
+	}
+}
+
+static void
+usage(void)
+{
+	printf("usage: vmstat [-v] [-d msec] [-n count]\n");
+	exit();
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct Argstate args;
+	uint32_t delay = 1000, sleep_word = 0;
+	int count = -1, cpu, i;
+	bool verbose = false;
+	uint64_t then, now;
+	char *val;
+
+	argstart(&argc, argv, &args);
+	while ((i = argnext(&args)) >= 0)
+		if (i == 'v')
+			verbose = true;
+		else if (i == 'd' && (val = argvalue(&args)))
+			delay = strtol(val, 0, 0);
+		else if (i == 'n' && (val = argvalue(&args)))
+			count = strtol(val, 0, 0);
+		else
+			usage();
+	if (argc > 1 || delay == 0)
+		usage();
+
+	then = read_tsc();
+	for (cpu = 0; cpu < NCPU_MAX; cpu++)
+		last[cpu] = cpustats[cpu];
+	while (count < 0 || count-- > 0) {
+		// nobody wakes this word, so this sleeps for delay
+		sys_futex_wait(&sleep_word, 0, delay);
+		now = read_tsc();
+		show(now - then, verbose);
+		then = now;
+	}
+}